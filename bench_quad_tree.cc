@@ -0,0 +1,538 @@
+/*
+	Benchmarks point_quad_tree over a range of data set sizes, point
+	distributions and node capacities.
+
+	Usage: bench_quad_tree [csv file] [maximum number of points] [layout csv file]
+
+	Prints a table and writes one CSV row per configuration to the csv file
+	(bench_quad_tree.csv by default) for tracking regressions. The node
+	layouts of linear_quad_tree are compared on the largest data sets, with
+	the results going to the layout csv file (bench_quad_tree_layout.csv by
+	default).
+*/
+
+#include <quad_tree/quad_tree.h>
+#include <quad_tree/linear_quad_tree.h>
+
+#include <boost/array.hpp>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include <stdint.h>
+
+typedef boost::array<float, 2> Point;
+typedef std::vector<Point>::iterator PointIterator;
+
+typedef std::chrono::steady_clock bench_clock;
+
+/*
+	All points lie within [0, extent] in both dimensions
+*/
+const float extent = 100;
+
+const int number_of_queries = 2000;
+
+enum distribution
+{
+	uniform,
+	clustered,
+	duplicates,
+	gaussian
+};
+
+const char *distribution_names[] = { "uniform", "clustered", "duplicates", "gaussian" };
+
+/*
+	Generates the same points for the same arguments on every run
+*/
+std::vector<Point> generate(distribution d, size_t number_of_points)
+{
+	std::mt19937 generator(1234);
+
+	std::uniform_real_distribution<float> coordinate(0, extent);
+
+	std::vector<Point> centers(32);
+
+	for (size_t index = 0; index < centers.size(); ++index)
+	{
+		centers[index][0] = coordinate(generator);
+		centers[index][1] = coordinate(generator);
+	}
+
+	std::normal_distribution<float> spread(0, 0.5);
+
+	std::normal_distribution<float> bell(extent / 2, extent / 10);
+
+	std::uniform_int_distribution<int> grid(0, 31);
+
+	std::uniform_int_distribution<size_t> center(0, centers.size() - 1);
+
+	std::vector<Point> points;
+
+	points.reserve(number_of_points);
+
+	while (points.size() < number_of_points)
+	{
+		Point p = {{ 0, 0 }};
+
+		switch (d)
+		{
+			case uniform:
+				p[0] = coordinate(generator);
+				p[1] = coordinate(generator);
+				break;
+
+			case clustered:
+			{
+				const Point &c = centers[center(generator)];
+
+				p[0] = c[0] + spread(generator);
+				p[1] = c[1] + spread(generator);
+				break;
+			}
+
+			/*
+				1024 distinct positions only
+			*/
+			case duplicates:
+				p[0] = grid(generator) * (extent / 31);
+				p[1] = grid(generator) * (extent / 31);
+				break;
+
+			case gaussian:
+				p[0] = bell(generator);
+				p[1] = bell(generator);
+				break;
+		}
+
+		if (p[0] < 0 || p[0] > extent || p[1] < 0 || p[1] > extent)
+		{
+			continue;
+		}
+
+		points.push_back(p);
+	}
+
+	return points;
+}
+
+/*
+	Windows with a side of 2% of the extent (by default) centered on data
+	points, so that queries follow the distribution
+*/
+std::vector<std::pair<Point, Point> > generate_windows(const std::vector<Point> &points, float half_side = extent / 100, int number_of_queries = ::number_of_queries)
+{
+	std::mt19937 generator(5678);
+
+	std::uniform_int_distribution<size_t> pick(0, points.size() - 1);
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		const Point &p = points[pick(generator)];
+
+		std::pair<Point, Point> window;
+
+		for (int dimension = 0; dimension < 2; ++dimension)
+		{
+			window.first[dimension] = p[dimension] - half_side;
+			window.second[dimension] = p[dimension] + half_side;
+		}
+
+		windows.push_back(window);
+	}
+
+	return windows;
+}
+
+inline double nanoseconds(bench_clock::duration duration)
+{
+	return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+/*
+	Sorts latencies in place and returns the given percentile
+*/
+double percentile(std::vector<double> &latencies, double fraction)
+{
+	if (true == latencies.empty())
+	{
+		return 0;
+	}
+
+	const size_t index = std::min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()));
+
+	std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+
+	return latencies[index];
+}
+
+struct measurement
+{
+	double m_bulk_load_points_per_second;
+
+	double m_add_points_per_second;
+
+	double m_add_p50_ns;
+	double m_add_p99_ns;
+	double m_add_max_ns;
+
+	double m_range_p50_ns;
+	double m_range_p99_ns;
+
+	double m_results_per_range;
+
+	double m_nearest_p50_ns;
+	double m_nearest_p99_ns;
+
+	size_t m_nodes;
+
+	size_t m_bytes;
+
+	int m_depth;
+};
+
+template<int Capacity>
+measurement run(std::vector<Point> &points, const std::vector<std::pair<Point, Point> > &windows, quad_tree::split_policy policy = quad_tree::midpoint_split)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, Capacity> quad_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = extent;
+
+	const ::quad_tree::split_limits limits(::quad_tree::maximum_depth_limit, 0, policy);
+
+	measurement m;
+
+	{
+		quad_tree tree(boundary, limits);
+
+		const bench_clock::time_point start = bench_clock::now();
+
+		tree.bulk_load(points.begin(), points.end());
+
+		m.m_bulk_load_points_per_second = points.size() / (nanoseconds(bench_clock::now() - start) * 1e-9);
+	}
+
+	quad_tree tree(boundary, limits);
+
+	std::vector<double> latencies(points.size());
+
+	const bench_clock::time_point start = bench_clock::now();
+
+	for (size_t index = 0; index < points.size(); ++index)
+	{
+		const bench_clock::time_point before = bench_clock::now();
+
+		tree.add(points.begin() + index);
+
+		latencies[index] = nanoseconds(bench_clock::now() - before);
+	}
+
+	m.m_add_points_per_second = points.size() / (nanoseconds(bench_clock::now() - start) * 1e-9);
+
+	m.m_add_p50_ns = percentile(latencies, 0.5);
+	m.m_add_p99_ns = percentile(latencies, 0.99);
+	m.m_add_max_ns = *std::max_element(latencies.begin(), latencies.end());
+
+	if (tree.number_of_points() != points.size())
+	{
+		throw std::logic_error("Not all points made it into the tree");
+	}
+
+	latencies.resize(windows.size());
+
+	size_t results = 0;
+
+	for (size_t query = 0; query < windows.size(); ++query)
+	{
+		::quad_tree::counting_visitor visitor;
+
+		const bench_clock::time_point before = bench_clock::now();
+
+		tree.visit_range(windows[query], visitor);
+
+		latencies[query] = nanoseconds(bench_clock::now() - before);
+
+		results += visitor.m_count;
+	}
+
+	m.m_range_p50_ns = percentile(latencies, 0.5);
+	m.m_range_p99_ns = percentile(latencies, 0.99);
+
+	m.m_results_per_range = static_cast<double>(results) / windows.size();
+
+	typename quad_tree::nearest_scratch scratch;
+
+	std::vector<PointIterator> neighbours;
+
+	for (size_t query = 0; query < windows.size(); ++query)
+	{
+		neighbours.clear();
+
+		const Point center = quad_tree::center(windows[query]);
+
+		const bench_clock::time_point before = bench_clock::now();
+
+		tree.nearest(center, 10, std::back_inserter(neighbours), scratch);
+
+		latencies[query] = nanoseconds(bench_clock::now() - before);
+	}
+
+	m.m_nearest_p50_ns = percentile(latencies, 0.5);
+	m.m_nearest_p99_ns = percentile(latencies, 0.99);
+
+	const ::quad_tree::tree_statistics statistics = tree.statistics();
+
+	m.m_nodes = statistics.m_nodes + statistics.m_overflow_chunks;
+
+	m.m_bytes = statistics.m_bytes;
+
+	m.m_depth = statistics.m_depth;
+
+	return m;
+}
+
+const char *csv_header =
+	"distribution,points,capacity,split,bulk_load_points_per_second,add_points_per_second,"
+	"add_p50_ns,add_p99_ns,add_max_ns,range_p50_ns,range_p99_ns,results_per_range,"
+	"nearest_p50_ns,nearest_p99_ns,nodes,bytes,depth";
+
+const char *split_names[] = { "midpoint", "median", "mean" };
+
+void report(std::ostream &csv, distribution d, size_t number_of_points, int capacity, quad_tree::split_policy policy, const measurement &m)
+{
+	csv
+		<< distribution_names[d] << "," << number_of_points << "," << capacity << "," << split_names[policy] << ","
+		<< m.m_bulk_load_points_per_second << "," << m.m_add_points_per_second << ","
+		<< m.m_add_p50_ns << "," << m.m_add_p99_ns << "," << m.m_add_max_ns << ","
+		<< m.m_range_p50_ns << "," << m.m_range_p99_ns << "," << m.m_results_per_range << ","
+		<< m.m_nearest_p50_ns << "," << m.m_nearest_p99_ns << ","
+		<< m.m_nodes << "," << m.m_bytes << "," << m.m_depth << std::endl;
+
+	std::cout
+		<< std::setw(10) << distribution_names[d]
+		<< std::setw(9) << number_of_points
+		<< std::setw(4) << capacity
+		<< std::setw(9) << split_names[policy]
+		<< std::fixed << std::setprecision(2)
+		<< std::setw(10) << m.m_bulk_load_points_per_second * 1e-6
+		<< std::setw(10) << m.m_add_points_per_second * 1e-6
+		<< std::setprecision(0)
+		<< std::setw(8) << m.m_add_p50_ns
+		<< std::setw(8) << m.m_add_p99_ns
+		<< std::setw(9) << m.m_range_p50_ns
+		<< std::setw(9) << m.m_range_p99_ns
+		<< std::setw(9) << m.m_nearest_p50_ns
+		<< std::setw(9) << m.m_nearest_p99_ns
+		<< std::setw(9) << m.m_nodes
+		<< std::setprecision(1)
+		<< std::setw(9) << m.m_bytes / (1024.0 * 1024.0)
+		<< std::setw(6) << m.m_depth
+		<< std::endl;
+}
+
+/*
+	Writes to more memory than the caches hold, so that the next query
+	starts with cold caches (and a cold TLB)
+*/
+struct cache_flusher
+{
+	std::vector<char> m_buffer;
+
+	cache_flusher()
+	:
+		m_buffer(static_cast<size_t>(64) << 20)
+	{
+
+	}
+
+	inline void flush()
+	{
+		for (size_t index = 0; index < m_buffer.size(); index += 64)
+		{
+			++m_buffer[index];
+		}
+	}
+};
+
+const char *layout_names[] = { "breadth_first", "depth_first", "van_emde_boas" };
+
+const char *layout_csv_header = "distribution,points,capacity,layout,query,cold_p50_ns,cold_p99_ns,warm_p50_ns";
+
+/*
+	Times queries on the linear trees of one tree in each layout, once
+	with the caches flushed before every query and once warm
+*/
+template<int Capacity>
+void run_layouts(std::ostream &csv, distribution d, std::vector<Point> &points, cache_flusher &flusher)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, Capacity> quad_tree;
+
+	typedef ::quad_tree::linear_quad_tree<quad_tree> linear_quad_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = extent;
+
+	quad_tree tree(boundary);
+
+	tree.bulk_load(points.begin(), points.end());
+
+	/*
+		Tiny windows measure descents, the larger ones descents plus
+		scanning a few leaves
+	*/
+	const char *query_names[] = { "point", "window" };
+
+	const std::vector<std::pair<Point, Point> > windows[] =
+	{
+		generate_windows(points, extent / 100000, 200),
+		generate_windows(points, extent / 100, 200)
+	};
+
+	const ::quad_tree::node_layout layouts[] = { ::quad_tree::breadth_first_layout, ::quad_tree::depth_first_layout, ::quad_tree::van_emde_boas_layout };
+
+	for (int layout = 0; layout < 3; ++layout)
+	{
+		const linear_quad_tree linear(tree, layouts[layout]);
+
+		for (int query_kind = 0; query_kind < 2; ++query_kind)
+		{
+			const std::vector<std::pair<Point, Point> > &queries = windows[query_kind];
+
+			std::vector<double> cold(queries.size());
+			std::vector<double> warm(queries.size());
+
+			for (size_t query = 0; query < queries.size(); ++query)
+			{
+				::quad_tree::counting_visitor visitor;
+
+				flusher.flush();
+
+				const bench_clock::time_point before = bench_clock::now();
+
+				linear.visit_range(queries[query], visitor);
+
+				cold[query] = nanoseconds(bench_clock::now() - before);
+			}
+
+			for (size_t query = 0; query < queries.size(); ++query)
+			{
+				::quad_tree::counting_visitor visitor;
+
+				const bench_clock::time_point before = bench_clock::now();
+
+				linear.visit_range(queries[query], visitor);
+
+				warm[query] = nanoseconds(bench_clock::now() - before);
+			}
+
+			const double cold_p50 = percentile(cold, 0.5);
+			const double cold_p99 = percentile(cold, 0.99);
+			const double warm_p50 = percentile(warm, 0.5);
+
+			csv
+				<< distribution_names[d] << "," << points.size() << "," << Capacity << "," << layout_names[layout] << ","
+				<< query_names[query_kind] << "," << cold_p50 << "," << cold_p99 << "," << warm_p50 << std::endl;
+
+			std::cout
+				<< std::setw(10) << distribution_names[d]
+				<< std::setw(9) << points.size()
+				<< std::setw(4) << Capacity
+				<< std::setw(15) << layout_names[layout]
+				<< std::setw(7) << query_names[query_kind]
+				<< std::setprecision(0)
+				<< std::setw(10) << cold_p50
+				<< std::setw(10) << cold_p99
+				<< std::setw(10) << warm_p50
+				<< std::endl;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const std::string filename = (argc > 1) ? argv[1] : "bench_quad_tree.csv";
+
+	const size_t maximum_number_of_points = (argc > 2) ? std::strtoul(argv[2], 0, 10) : 1000000;
+
+	const std::string layout_filename = (argc > 3) ? argv[3] : "bench_quad_tree_layout.csv";
+
+	std::ofstream csv(filename.c_str());
+
+	if (false == csv.good())
+	{
+		throw std::runtime_error("Could not open " + filename);
+	}
+
+	csv << csv_header << std::endl;
+
+	std::cout
+		<< "distribution   points cap    split  bulk M/s   add M/s add p50 add p99 range p50 range p99  knn p50  knn p99    nodes      MiB depth" << std::endl;
+
+	for (size_t number_of_points = 10000; number_of_points <= maximum_number_of_points; number_of_points *= 10)
+	{
+		for (int d = uniform; d <= gaussian; ++d)
+		{
+			std::vector<Point> points = generate(distribution(d), number_of_points);
+
+			const std::vector<std::pair<Point, Point> > windows = generate_windows(points);
+
+			report(csv, distribution(d), number_of_points, 4, quad_tree::midpoint_split, run<4>(points, windows));
+			report(csv, distribution(d), number_of_points, 16, quad_tree::midpoint_split, run<16>(points, windows));
+			report(csv, distribution(d), number_of_points, 64, quad_tree::midpoint_split, run<64>(points, windows));
+
+			/*
+				The adaptive split policies only pay off on skewed data
+			*/
+			if (clustered == d || gaussian == d)
+			{
+				for (int policy = quad_tree::median_split; policy <= quad_tree::mean_split; ++policy)
+				{
+					report(csv, distribution(d), number_of_points, 16, quad_tree::split_policy(policy), run<16>(points, windows, quad_tree::split_policy(policy)));
+				}
+			}
+		}
+	}
+
+	std::ofstream layout_csv(layout_filename.c_str());
+
+	if (false == layout_csv.good())
+	{
+		throw std::runtime_error("Could not open " + layout_filename);
+	}
+
+	layout_csv << layout_csv_header << std::endl;
+
+	std::cout << std::endl << "distribution   points cap         layout  query  cold p50  cold p99  warm p50" << std::endl;
+
+	cache_flusher flusher;
+
+	size_t largest = 10000;
+
+	while (largest * 10 <= maximum_number_of_points)
+	{
+		largest *= 10;
+	}
+
+	for (int d = uniform; d <= clustered; ++d)
+	{
+		std::vector<Point> points = generate(distribution(d), largest);
+
+		run_layouts<16>(layout_csv, distribution(d), points, flusher);
+	}
+}
@@ -0,0 +1,992 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_BOX_QUAD_TREE_HH
+#define FPS_BOX_QUAD_TREE_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief A quad tree of axis aligned boxes, e.g. bounding boxes of
+		entities or road segments.
+
+		Every box is kept at the deepest node it fits into completely: Boxes
+		straddling the boundary between the children of a node stay in that
+		node, all others move down when a leaf is split. Queries therefore
+		look at every node along their way, but never at a box's node unless
+		the query touches the node's boundary, and no box is stored twice.
+
+		*BoxIterator must be a std::pair<Point, Point> holding the lower and
+		upper corners of the box. Boxes may be degenerate (points or line
+		segments). Boundaries are inclusive, i.e. boxes which only touch
+		overlap.
+
+		NOTE: The same notes as for point_quad_tree apply: The tree keeps
+		iterators into the original data set, copies the corners into its
+		nodes, allocates its nodes through Allocation and honours
+		split_limits. Boxes beyond NodeCapacity at a node go into an overflow
+		chain. Boxes must not be moved in the data set without telling the
+		tree (see update()).
+	*/
+	template
+	<
+		class Point,
+		class BoxIterator,
+		int NodeCapacity,
+		class Allocation = arena_allocation<>
+	>
+	struct box_quad_tree
+	{
+		typedef point_quad_tree<Point, BoxIterator, NodeCapacity> quad_tree_t;
+
+		typedef std::pair<Point, Point> Boundary;
+
+		typedef Boundary Box;
+
+		typedef Point point_type;
+
+		typedef BoxIterator box_iterator;
+
+		typedef typename point_traits<Point>::coordinate_type coordinate_type;
+
+		static_assert(2 == point_traits<Point>::dimensions, "box_quad_tree only handles two dimensional points");
+
+		struct node;
+
+		typedef typename Allocation::template pool<node> pool_type;
+
+		typedef typename pool_type::pointer node_pointer;
+
+		/*
+			The lanes of node::m_corners
+		*/
+		enum corner
+		{
+			low_x,
+			low_y,
+			high_x,
+			high_y
+		};
+
+		struct node
+		{
+			/*
+				All null for leaves. Indexed by point_quad_tree::quadrant().
+			*/
+			node_pointer m_children[4];
+
+			Boundary m_boundary;
+
+			/*
+				The boxes at this node. Only the first m_number_of_boxes
+				entries are valid.
+			*/
+			int m_number_of_boxes;
+
+			BoxIterator m_boxes[NodeCapacity];
+
+			/*
+				Overflow chain as in point_quad_tree::node. Interior nodes
+				may have one, too.
+			*/
+			node_pointer m_overflow;
+
+			/*
+				The corners of the boxes, lane c being m_corners[c *
+				NodeCapacity] and following. The padding lets interval_filter
+				read whole vectors past the last lane.
+			*/
+			coordinate_type m_corners[4 * NodeCapacity + simd_lane_padding - 1];
+
+			node(const Boundary &boundary)
+			:
+				m_boundary(boundary),
+				m_number_of_boxes(0),
+				m_overflow()
+			{
+				std::fill(m_children, m_children + 4, node_pointer());
+				std::fill(m_corners, m_corners + 4 * NodeCapacity + simd_lane_padding - 1, coordinate_type());
+			}
+
+			inline bool has_children() const
+			{
+				return static_cast<bool>(m_children[0]);
+			}
+
+			inline const coordinate_type *lane(corner c) const
+			{
+				return m_corners + c * NodeCapacity;
+			}
+
+			/**
+				Appends a box. The node must not be full.
+			*/
+			inline void push_back(BoxIterator box_it, const Box &box)
+			{
+				m_boxes[m_number_of_boxes] = box_it;
+
+				m_corners[low_x * NodeCapacity + m_number_of_boxes] = box.first[0];
+				m_corners[low_y * NodeCapacity + m_number_of_boxes] = box.first[1];
+				m_corners[high_x * NodeCapacity + m_number_of_boxes] = box.second[0];
+				m_corners[high_y * NodeCapacity + m_number_of_boxes] = box.second[1];
+
+				++m_number_of_boxes;
+			}
+
+			/**
+				Returns the corners stored for the box at index
+			*/
+			inline Box box(int index) const
+			{
+				Box box;
+
+				box.first[0] = m_corners[low_x * NodeCapacity + index];
+				box.first[1] = m_corners[low_y * NodeCapacity + index];
+				box.second[0] = m_corners[high_x * NodeCapacity + index];
+				box.second[1] = m_corners[high_y * NodeCapacity + index];
+
+				return box;
+			}
+
+			inline void assign(int index, const node &from, int from_index)
+			{
+				m_boxes[index] = from.m_boxes[from_index];
+
+				for (int c = 0; c < 4; ++c)
+				{
+					m_corners[c * NodeCapacity + index] = from.m_corners[c * NodeCapacity + from_index];
+				}
+			}
+
+			inline const node *next_chunk() const
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+
+			inline node *next_chunk()
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+
+			/**
+				Returns the number of boxes at this node including its
+				overflow chain
+			*/
+			inline size_t size() const
+			{
+				size_t size = 0;
+
+				for (const node *chunk = this; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					size += chunk->m_number_of_boxes;
+				}
+
+				return size;
+			}
+		};
+
+		pool_type m_pool;
+
+		node_pointer m_root;
+
+		split_limits m_limits;
+
+		explicit box_quad_tree
+		(
+			const Boundary &boundary,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_limits(limits)
+		{
+			quad_tree_t::check_boundary(boundary);
+			check_midpoint_split(limits);
+			check_default_capacity(limits);
+
+			m_root = m_pool.create(boundary);
+		}
+
+		box_quad_tree
+		(
+			const Boundary &boundary,
+			BoxIterator boxes_begin,
+			BoxIterator boxes_end,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_limits(limits)
+		{
+			quad_tree_t::check_boundary(boundary);
+			check_midpoint_split(limits);
+			check_default_capacity(limits);
+
+			m_root = m_pool.create(boundary);
+
+			add(boxes_begin, boxes_end);
+		}
+
+		static inline bool boxes_overlap(const Box &a, const Box &b)
+		{
+			return quad_tree_t::boundaries_intersect(a, b);
+		}
+
+		/**
+			Returns the child of n box fits into completely or -1 if the box
+			straddles the children. Corners on the center belong to the
+			lower children like points do.
+		*/
+		static inline int fitting_child(const node &n, const Box &box)
+		{
+			const Point center = quad_tree_t::center(n.m_boundary);
+
+			const int quadrant = quad_tree_t::quadrant(center, box.first);
+
+			return quadrant == quad_tree_t::quadrant(center, box.second) ? quadrant : -1;
+		}
+
+		inline void add(BoxIterator boxes_begin, BoxIterator boxes_end)
+		{
+			for (BoxIterator it = boxes_begin; it != boxes_end; ++it)
+			{
+				add(it);
+			}
+		}
+
+		/**
+			Returns true if the box was added to the tree, i.e. it lies
+			within the root boundary completely
+		*/
+		inline bool add(BoxIterator box_it)
+		{
+			return add(box_it, *box_it);
+		}
+
+		/**
+			Adds box_it with the corners box without dereferencing it
+		*/
+		bool add(BoxIterator box_it, const Box &box)
+		{
+			if (box.first[0] > box.second[0] || box.first[1] > box.second[1])
+			{
+				throw std::runtime_error("Order of box corners not preserved");
+			}
+
+			if (false == quad_tree_t::boundary_is_inside(box, m_root->m_boundary))
+			{
+				return false;
+			}
+
+			node *n = &*m_root;
+
+			int depth = 0;
+
+			for (; true == n->has_children(); ++depth)
+			{
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				const int quadrant = fitting_child(*n, box);
+
+				if (-1 == quadrant)
+				{
+					break;
+				}
+
+				n = &*n->m_children[quadrant];
+			}
+
+			append(*n, box_it, box);
+
+			if (false == n->has_children() && n->m_overflow && true == can_split(*n, depth))
+			{
+				split(*n, depth);
+			}
+
+			return true;
+		}
+
+		/**
+			See point_quad_tree::can_split()
+		*/
+		inline bool can_split(const node &n, int depth) const
+		{
+			return quad_tree_t::can_split(n.m_boundary, depth, m_limits);
+		}
+
+		inline void append(node &n, BoxIterator box_it, const Box &box)
+		{
+			if (n.m_number_of_boxes < NodeCapacity)
+			{
+				n.push_back(box_it, box);
+				return;
+			}
+
+			if (!n.m_overflow || NodeCapacity == n.m_overflow->m_number_of_boxes)
+			{
+				node_pointer chunk = m_pool.create(n.m_boundary);
+
+				chunk->m_overflow = n.m_overflow;
+
+				n.m_overflow = chunk;
+			}
+
+			n.m_overflow->push_back(box_it, box);
+		}
+
+		/**
+			Splits the leaf n at depth: Boxes fitting into a child move
+			there, the others stay. Children overflowing in turn are split
+			as well, in the same loop.
+		*/
+		void split(node &n, int depth)
+		{
+			fixed_stack<std::pair<node*, int> > stack;
+
+			stack.push(std::make_pair(&n, depth));
+
+			while (false == stack.empty())
+			{
+				const std::pair<node*, int> entry = stack.pop();
+
+				split(*entry.first);
+
+				for (int index = 3; index >= 0; --index)
+				{
+					node &c = *entry.first->m_children[index];
+
+					if (c.m_overflow && true == can_split(c, entry.second + 1))
+					{
+						stack.push(std::make_pair(&c, entry.second + 1));
+					}
+				}
+			}
+		}
+
+		/**
+			Splits the leaf n once, leaving overflowing children as they are
+		*/
+		void split(node &n)
+		{
+			FPS_QUAD_TREE_COUNT(m_splits, 1);
+
+			const Point center = quad_tree_t::center(n.m_boundary);
+
+			for (int index = 0; index < 4; ++index)
+			{
+				n.m_children[index] = m_pool.create(quad_tree_t::child_boundary(n.m_boundary, center, index));
+			}
+
+			node_pointer overflow = n.m_overflow;
+
+			/*
+				The node may get its own boxes back, so they are taken out
+				first
+			*/
+			const int number_of_boxes = n.m_number_of_boxes;
+
+			BoxIterator boxes[NodeCapacity];
+
+			Box corners[NodeCapacity];
+
+			for (int index = 0; index < number_of_boxes; ++index)
+			{
+				boxes[index] = n.m_boxes[index];
+				corners[index] = n.box(index);
+			}
+
+			n.m_number_of_boxes = 0;
+			n.m_overflow = node_pointer();
+
+			for (int index = 0; index < number_of_boxes; ++index)
+			{
+				distribute(n, boxes[index], corners[index]);
+			}
+
+			while (overflow)
+			{
+				const node_pointer chunk = overflow;
+
+				for (int index = 0; index < chunk->m_number_of_boxes; ++index)
+				{
+					distribute(n, chunk->m_boxes[index], chunk->box(index));
+				}
+
+				overflow = chunk->m_overflow;
+
+				chunk->m_overflow = node_pointer();
+
+				m_pool.release(chunk);
+			}
+		}
+
+		/**
+			Appends a box to the child of n it fits into or to n itself
+		*/
+		inline void distribute(node &n, BoxIterator box_it, const Box &box)
+		{
+			const int quadrant = fitting_child(n, box);
+
+			append(-1 == quadrant ? n : *n.m_children[quadrant], box_it, box);
+		}
+
+		/**
+			Removes box_it from the tree. The box has to be where it was
+			when it was added (or last updated). Children left with few
+			enough boxes are merged back into their parent.
+
+			Returns false if the box is not in the tree.
+		*/
+		inline bool remove(BoxIterator box_it)
+		{
+			return remove(box_it, *box_it);
+		}
+
+		/**
+			Removes box_it which was added with the corners box
+		*/
+		inline bool remove(BoxIterator box_it, const Box &box)
+		{
+			if (false == quad_tree_t::boundary_is_inside(box, m_root->m_boundary))
+			{
+				return false;
+			}
+
+			/*
+				The nodes passed on the way down, merged bottom up once the
+				box is gone
+			*/
+			node *path[maximum_depth_limit + 1];
+
+			int depth = 0;
+
+			node *n = &*m_root;
+
+			for (;;)
+			{
+				const int quadrant = true == n->has_children() ? fitting_child(*n, box) : -1;
+
+				if (-1 == quadrant)
+				{
+					break;
+				}
+
+				path[depth++] = n;
+
+				n = &*n->m_children[quadrant];
+			}
+
+			for (node *chunk = n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_boxes; ++index)
+				{
+					if (chunk->m_boxes[index] == box_it)
+					{
+						erase(*n, *chunk, index);
+
+						if (true == n->has_children())
+						{
+							merge(*n);
+						}
+
+						while (0 < depth)
+						{
+							merge(*path[--depth]);
+						}
+
+						return true;
+					}
+				}
+			}
+
+			return false;
+		}
+
+		/**
+			Moves box_it to the corners new_box. Call this before changing
+			the box in the data set.
+		*/
+		inline bool update(BoxIterator box_it, const Box &new_box)
+		{
+			return update(box_it, *box_it, new_box);
+		}
+
+		/**
+			Moves box_it from old_box, which it was added or last updated
+			with, to new_box without dereferencing it
+		*/
+		inline bool update(BoxIterator box_it, const Box &old_box, const Box &new_box)
+		{
+			if (false == remove(box_it, old_box))
+			{
+				return false;
+			}
+
+			return add(box_it, new_box);
+		}
+
+		/**
+			See point_quad_tree::erase()
+		*/
+		inline void erase(node &n, node &chunk, int index)
+		{
+			node &last = n.m_overflow ? *n.m_overflow : n;
+
+			chunk.assign(index, last, last.m_number_of_boxes - 1);
+
+			--last.m_number_of_boxes;
+
+			if (&last != &n && 0 == last.m_number_of_boxes)
+			{
+				const node_pointer empty = n.m_overflow;
+
+				n.m_overflow = empty->m_overflow;
+
+				empty->m_overflow = node_pointer();
+
+				m_pool.release(empty);
+			}
+		}
+
+		/**
+			Turns n back into a leaf if its children are leaves and their
+			boxes fit into n together with its own
+		*/
+		void merge(node &n)
+		{
+			if (n.m_overflow)
+			{
+				return;
+			}
+
+			int number_of_boxes = n.m_number_of_boxes;
+
+			for (int index = 0; index < 4; ++index)
+			{
+				const node &c = *n.m_children[index];
+
+				if (true == c.has_children() || c.m_overflow)
+				{
+					return;
+				}
+
+				number_of_boxes += c.m_number_of_boxes;
+			}
+
+			if (number_of_boxes > NodeCapacity)
+			{
+				return;
+			}
+
+			for (int index = 0; index < 4; ++index)
+			{
+				const node_pointer c = n.m_children[index];
+
+				n.m_children[index] = node_pointer();
+
+				for (int box = 0; box < c->m_number_of_boxes; ++box)
+				{
+					n.push_back(c->m_boxes[box], c->box(box));
+				}
+
+				m_pool.release(c);
+			}
+		}
+
+		/**
+			Returns the mask of the first count boxes of chunk overlapping
+			range. count must not exceed 64.
+		*/
+		static inline uint64_t overlap_mask(const node &chunk, int base, int count, const Box &range)
+		{
+			typedef interval_filter<coordinate_type> filter;
+
+			const coordinate_type lowest = std::numeric_limits<coordinate_type>::lowest();
+			const coordinate_type highest = std::numeric_limits<coordinate_type>::max();
+
+			uint64_t mask = filter::mask(chunk.lane(low_x) + base, count, lowest, range.second[0]);
+
+			if (0 != mask)
+			{
+				mask &= filter::mask(chunk.lane(high_x) + base, count, range.first[0], highest);
+			}
+
+			if (0 != mask)
+			{
+				mask &= filter::mask(chunk.lane(low_y) + base, count, lowest, range.second[1]);
+			}
+
+			if (0 != mask)
+			{
+				mask &= filter::mask(chunk.lane(high_y) + base, count, range.first[1], highest);
+			}
+
+			return mask;
+		}
+
+		/**
+			Calls visitor(box_it) for every box overlapping range
+		*/
+		template<class Visitor>
+		inline void visit_overlapping(const Box &range, Visitor &visitor) const
+		{
+			visit_overlapping(*m_root, range, visitor);
+		}
+
+		template<class Visitor>
+		void visit_overlapping(const node &start, const Box &range, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				if (false == quad_tree_t::boundaries_intersect(n.m_boundary, range))
+				{
+					continue;
+				}
+
+				if (true == quad_tree_t::boundary_is_inside(n.m_boundary, range))
+				{
+					visit_all(n, visitor);
+					continue;
+				}
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					FPS_QUAD_TREE_COUNT(m_points_tested, chunk->m_number_of_boxes);
+
+					for (int base = 0; base < chunk->m_number_of_boxes; base += 64)
+					{
+						uint64_t mask = overlap_mask(*chunk, base, std::min(64, chunk->m_number_of_boxes - base), range);
+
+						while (0 != mask)
+						{
+							visitor(chunk->m_boxes[base + lowest_bit(mask)]);
+
+							mask &= mask - 1;
+						}
+					}
+				}
+
+				push_children(n, stack);
+			}
+		}
+
+		/**
+			Pushes the children of n, if any, so that they are popped in
+			quadrant order
+		*/
+		static inline void push_children(const node &n, fixed_stack<const node*> &stack)
+		{
+			if (true == n.has_children())
+			{
+				for (int index = 3; index >= 0; --index)
+				{
+					stack.push(&*n.m_children[index]);
+				}
+			}
+		}
+
+		/**
+			Calls visitor(box_it) for every box in the subtree at n
+		*/
+		template<class Visitor>
+		void visit_all(const node &start, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					for (int index = 0; index < chunk->m_number_of_boxes; ++index)
+					{
+						visitor(chunk->m_boxes[index]);
+					}
+				}
+
+				push_children(n, stack);
+			}
+		}
+
+		/**
+			Writes the iterators of all boxes overlapping range to out and
+			returns the advanced output iterator
+		*/
+		template<class OutputIterator>
+		inline OutputIterator query_overlapping(const Box &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_overlapping(range, visitor);
+
+			return visitor.m_out;
+		}
+
+		/*
+			A box of an ancestor of the node visited by
+			visit_overlapping_pairs()
+		*/
+		struct pair_entry
+		{
+			BoxIterator m_box_it;
+
+			Box m_box;
+
+			pair_entry(BoxIterator box_it, const Box &box)
+			:
+				m_box_it(box_it),
+				m_box(box)
+			{
+
+			}
+		};
+
+		/**
+			@brief The working memory of visit_overlapping_pairs().
+
+			Keep one around to avoid reallocating. A scratch object must not
+			be used by two calls at the same time.
+		*/
+		struct pair_scratch
+		{
+			/*
+				The boxes of the nodes on the current path which overlap the
+				current node. The boxes for a node are appended behind those
+				of its parent.
+			*/
+			std::vector<pair_entry> m_ancestors;
+		};
+
+		/**
+			Calls visitor(a, b) once for every pair of distinct boxes which
+			overlap (broad phase collision detection).
+
+			A box is only tested against the boxes of its own node and those
+			boxes of the nodes above that touch its node, so the cost follows
+			the number of boxes near each other rather than the square of
+			the number of boxes. Pairs are reported in no particular order
+			and either way round.
+		*/
+		template<class Visitor>
+		void visit_overlapping_pairs(Visitor &visitor, pair_scratch &scratch) const
+		{
+			scratch.m_ancestors.clear();
+
+			visit_overlapping_pairs(*m_root, 0, visitor, scratch);
+		}
+
+		/**
+			Convenience version of visit_overlapping_pairs() which allocates
+			its own scratch
+		*/
+		template<class Visitor>
+		inline void visit_overlapping_pairs(Visitor &visitor) const
+		{
+			pair_scratch scratch;
+
+			visit_overlapping_pairs(visitor, scratch);
+		}
+
+		/*
+			A node visit_overlapping_pairs() still has to visit with the
+			range of scratch.m_ancestors holding the boxes above it which
+			overlap it
+		*/
+		struct pair_frame
+		{
+			const node *m_node;
+
+			size_t m_ancestors_begin;
+
+			size_t m_ancestors_end;
+
+			pair_frame()
+			:
+				m_node(0),
+				m_ancestors_begin(0),
+				m_ancestors_end(0)
+			{
+
+			}
+
+			pair_frame(const node *n, size_t ancestors_begin, size_t ancestors_end)
+			:
+				m_node(n),
+				m_ancestors_begin(ancestors_begin),
+				m_ancestors_end(ancestors_end)
+			{
+
+			}
+		};
+
+		/**
+			The boxes above start overlapping its boundary are
+			scratch.m_ancestors[ancestors_begin] and following. The ranges of
+			the children of a node are appended behind each other, the one
+			of the child visited first last. Since the nodes are visited
+			depth first, everything past the range of a node popped from the
+			stack belongs to subtrees already done and is dropped.
+		*/
+		template<class Visitor>
+		void visit_overlapping_pairs(const node &start, size_t ancestors_begin, Visitor &visitor, pair_scratch &scratch) const
+		{
+			std::vector<pair_entry> &ancestors = scratch.m_ancestors;
+
+			const size_t ancestors_end = ancestors.size();
+
+			fixed_stack<pair_frame> stack;
+
+			stack.push(pair_frame(&start, ancestors_begin, ancestors_end));
+
+			while (false == stack.empty())
+			{
+				const pair_frame frame = stack.pop();
+
+				const node &n = *frame.m_node;
+
+				ancestors.resize(frame.m_ancestors_end, pair_entry(BoxIterator(), Box()));
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					for (int index = 0; index < chunk->m_number_of_boxes; ++index)
+					{
+						const Box box = chunk->box(index);
+
+						for (size_t ancestor = frame.m_ancestors_begin; ancestor < frame.m_ancestors_end; ++ancestor)
+						{
+							if (true == boxes_overlap(ancestors[ancestor].m_box, box))
+							{
+								visitor(ancestors[ancestor].m_box_it, chunk->m_boxes[index]);
+							}
+						}
+
+						/*
+							Each pair within the node once: the box against
+							the boxes before it in the chain
+						*/
+						for (const node *other = &n; other != chunk; other = other->next_chunk())
+						{
+							for (int other_index = 0; other_index < other->m_number_of_boxes; ++other_index)
+							{
+								if (true == boxes_overlap(other->box(other_index), box))
+								{
+									visitor(other->m_boxes[other_index], chunk->m_boxes[index]);
+								}
+							}
+						}
+
+						for (int other_index = 0; other_index < index; ++other_index)
+						{
+							if (true == boxes_overlap(chunk->box(other_index), box))
+							{
+								visitor(chunk->m_boxes[other_index], chunk->m_boxes[index]);
+							}
+						}
+					}
+				}
+
+				if (false == n.has_children())
+				{
+					continue;
+				}
+
+				for (int child = 3; child >= 0; --child)
+				{
+					const node &c = *n.m_children[child];
+
+					if (false == c.has_children() && 0 == c.m_number_of_boxes)
+					{
+						continue;
+					}
+
+					const size_t child_begin = ancestors.size();
+
+					for (size_t ancestor = frame.m_ancestors_begin; ancestor < frame.m_ancestors_end; ++ancestor)
+					{
+						if (true == boxes_overlap(ancestors[ancestor].m_box, c.m_boundary))
+						{
+							ancestors.push_back(ancestors[ancestor]);
+						}
+					}
+
+					for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+					{
+						for (int index = 0; index < chunk->m_number_of_boxes; ++index)
+						{
+							const Box box = chunk->box(index);
+
+							if (true == boxes_overlap(box, c.m_boundary))
+							{
+								ancestors.push_back(pair_entry(chunk->m_boxes[index], box));
+							}
+						}
+					}
+
+					stack.push(pair_frame(&c, child_begin, ancestors.size()));
+				}
+			}
+
+			ancestors.resize(ancestors_end, pair_entry(BoxIterator(), Box()));
+		}
+
+		size_t number_of_boxes() const
+		{
+			return number_of_boxes(*m_root);
+		}
+
+		size_t number_of_boxes(const node &start) const
+		{
+			fixed_stack<const node*> stack;
+
+			size_t number = 0;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				number += n.size();
+
+				push_children(n, stack);
+			}
+
+			return number;
+		}
+
+	private:
+		box_quad_tree(const box_quad_tree&);
+
+		box_quad_tree &operator=(const box_quad_tree&);
+	};
+
+} // namespace
+
+#endif
@@ -0,0 +1,234 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_QUAD_TREE_CAPACITY_TUNING_HH
+#define FPS_QUAD_TREE_CAPACITY_TUNING_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief The knobs of tune_capacity().
+	*/
+	struct tuning_options
+	{
+		/*
+			At most this many points, evenly spaced in the data, are put into
+			the trees timed
+		*/
+		size_t m_sample_size;
+
+		/*
+			The number of range queries timed per capacity
+		*/
+		int m_number_of_queries;
+
+		/*
+			The side of the query windows relative to the side of the
+			boundary. Windows are centered on sampled points, so they follow
+			the distribution of the data.
+		*/
+		double m_window_fraction;
+
+		/*
+			The limits of the trees timed. m_capacity is what is tuned.
+		*/
+		split_limits m_limits;
+
+		tuning_options
+		(
+			size_t sample_size = 100000,
+			int number_of_queries = 2000,
+			double window_fraction = 0.02,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_sample_size(sample_size),
+			m_number_of_queries(number_of_queries),
+			m_window_fraction(window_fraction),
+			m_limits(limits)
+		{
+
+		}
+	};
+
+	/**
+		@brief What tune_capacity() measured.
+	*/
+	struct capacity_tuning
+	{
+		/*
+			The capacity with the fastest queries. Put it into
+			split_limits::m_capacity.
+		*/
+		int m_capacity;
+
+		/*
+			The capacities tried and the mean time per query for each
+		*/
+		std::vector<int> m_capacities;
+
+		std::vector<double> m_nanoseconds_per_query;
+
+		/*
+			The points of the sample within the boundary, at most
+			tuning_options::m_sample_size
+		*/
+		size_t m_sample_size;
+
+		/*
+			The number of points the timed queries reported in total. Keeps
+			the queries from being optimized away.
+		*/
+		size_t m_results;
+	};
+
+	/**
+		Picks the leaf capacity for QuadTree (a point_quad_tree) and the
+		points in [points_begin, points_end) within boundary by timing range
+		queries on a sample of the points with NodeCapacity, half of it and
+		so on down to 1.
+
+		The trees timed store indices into the sample. Their windows are
+		enlarged by the square root of the sampling ratio, so a window holds
+		about as many points of the sample as one of m_window_fraction holds
+		of all points. Timing is subject to noise, so the result is best
+		used for data sets queried long enough to amortize the tuning.
+	*/
+	template<class QuadTree, class RandomAccessIterator>
+	capacity_tuning tune_capacity
+	(
+		const typename QuadTree::Boundary &boundary,
+		RandomAccessIterator points_begin,
+		RandomAccessIterator points_end,
+		const tuning_options &options = tuning_options()
+	)
+	{
+		typedef typename QuadTree::point_type Point;
+
+		typedef typename QuadTree::Boundary Boundary;
+
+		typedef point_quad_tree<Point, uint32_t, QuadTree::node_capacity> sample_tree;
+
+		typedef std::chrono::steady_clock clock;
+
+		if (0 == options.m_sample_size || options.m_number_of_queries <= 0 || false == (options.m_window_fraction > 0))
+		{
+			throw std::runtime_error("Nothing to tune with");
+		}
+
+		std::vector<Point> sample;
+
+		const size_t number_of_points = points_end - points_begin;
+
+		const size_t stride = std::max(static_cast<size_t>(1), (number_of_points + options.m_sample_size - 1) / options.m_sample_size);
+
+		for (size_t index = 0; index < number_of_points; index += stride)
+		{
+			if (true == QuadTree::point_intersects_boundary(points_begin[index], boundary))
+			{
+				sample.push_back(points_begin[index]);
+			}
+		}
+
+		if (true == sample.empty())
+		{
+			throw std::runtime_error("No points within boundary to tune with");
+		}
+
+		const double fraction = std::min(1.0, options.m_window_fraction * std::sqrt(static_cast<double>(stride)));
+
+		std::vector<Boundary> windows;
+
+		std::mt19937 generator(1234);
+
+		std::uniform_int_distribution<size_t> pick(0, sample.size() - 1);
+
+		for (int query = 0; query < options.m_number_of_queries; ++query)
+		{
+			const Point &center = sample[pick(generator)];
+
+			Boundary window;
+
+			for (int dimension = 0; dimension < 2; ++dimension)
+			{
+				const double half_side = 0.5 * fraction * (static_cast<double>(boundary.second[dimension]) - boundary.first[dimension]);
+
+				window.first[dimension] = static_cast<typename QuadTree::coordinate_type>(std::max<double>(boundary.first[dimension], center[dimension] - half_side));
+				window.second[dimension] = static_cast<typename QuadTree::coordinate_type>(std::min<double>(boundary.second[dimension], center[dimension] + half_side));
+			}
+
+			windows.push_back(window);
+		}
+
+		capacity_tuning tuning;
+
+		tuning.m_capacity = QuadTree::node_capacity;
+		tuning.m_results = 0;
+		tuning.m_sample_size = sample.size();
+
+		for (int capacity = QuadTree::node_capacity; capacity >= 1; capacity /= 2)
+		{
+			split_limits limits = options.m_limits;
+
+			limits.m_capacity = capacity;
+
+			sample_tree tree(boundary, limits);
+
+			tree.bulk_load_indices(sample.begin(), sample.end());
+
+			counting_visitor visitor;
+
+			/*
+				One pass to warm the caches, one to time
+			*/
+			for (size_t query = 0; query < windows.size(); ++query)
+			{
+				tree.visit_range(windows[query], visitor);
+			}
+
+			const clock::time_point start = clock::now();
+
+			for (size_t query = 0; query < windows.size(); ++query)
+			{
+				tree.visit_range(windows[query], visitor);
+			}
+
+			const double nanoseconds = std::chrono::duration<double, std::nano>(clock::now() - start).count() / windows.size();
+
+			tuning.m_results += visitor.m_count;
+
+			if (false == tuning.m_capacities.empty() && nanoseconds < *std::min_element(tuning.m_nanoseconds_per_query.begin(), tuning.m_nanoseconds_per_query.end()))
+			{
+				tuning.m_capacity = capacity;
+			}
+
+			tuning.m_capacities.push_back(capacity);
+			tuning.m_nanoseconds_per_query.push_back(nanoseconds);
+		}
+
+		return tuning;
+	}
+
+} // namespace
+
+#endif
@@ -0,0 +1,521 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_CONCURRENT_QUAD_TREE_HH
+#define FPS_CONCURRENT_QUAD_TREE_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief A point quad tree any number of threads can add() to and query at
+		the same time.
+
+		Only leaves are ever locked, each with a spin lock of its own, and only
+		for as long as it takes to append a point or to test its points. Threads
+		descend through interior nodes without any locking: The four children of
+		a node are allocated as one block, completely filled in (including all
+		further splits their points need) and only then published with a single
+		atomic store to the parent. Threads that find a leaf replaced by children
+		after locking it unlock it and descend further.
+
+		Insertions therefore only contend with each other when they hit the same
+		leaf at the same time, which for spread out data mostly happens near the
+		root while the tree is still small.
+
+		NOTE: Points are added like in point_quad_tree, including overflow buckets
+		for points which can not be split apart, but there is no lazy splitting,
+		no removal and no uniqueness check. Use the statics of point_quad_tree for
+		boundary arithmetic.
+
+		NOTE: Visitors are called with the leaf they are visiting locked. They
+		must not call back into the tree.
+
+		NOTE: Nodes are allocated with new since the pools of the allocation
+		policies are not thread safe. Nodes are never moved or freed before the
+		tree is destroyed.
+	*/
+	template<class Point, class PointIterator, int NodeCapacity>
+	struct concurrent_point_quad_tree
+	{
+		typedef point_quad_tree<Point, PointIterator, NodeCapacity> quad_tree_t;
+
+		typedef typename quad_tree_t::Boundary Boundary;
+
+		typedef Point point_type;
+
+		typedef PointIterator point_iterator;
+
+		typedef typename quad_tree_t::coordinate_type coordinate_type;
+
+		struct node
+		{
+			/*
+				0 for leaves, otherwise the four children north west, north
+				east, south west and south east in one block
+			*/
+			std::atomic<node*> m_children;
+
+			std::atomic<bool> m_locked;
+
+			Boundary m_boundary;
+
+			int m_number_of_points;
+
+			PointIterator m_points[NodeCapacity];
+
+			/*
+				The overflow chain as in point_quad_tree::node
+			*/
+			node *m_overflow;
+
+			bool m_coincident;
+
+			coordinate_type m_coordinates[2 * NodeCapacity + simd_lane_padding - 1];
+
+			node()
+			:
+				m_children(0),
+				m_locked(false),
+				m_number_of_points(0),
+				m_overflow(0),
+				m_coincident(false)
+			{
+				std::fill(m_coordinates, m_coordinates + 2 * NodeCapacity + simd_lane_padding - 1, coordinate_type());
+			}
+
+			~node()
+			{
+				delete[] m_children.load();
+
+				while (0 != m_overflow)
+				{
+					node *chunk = m_overflow;
+
+					m_overflow = chunk->m_overflow;
+
+					chunk->m_overflow = 0;
+
+					delete chunk;
+				}
+			}
+
+			inline void lock()
+			{
+				for (int spin = 0; true == m_locked.exchange(true, std::memory_order_acquire); ++spin)
+				{
+					if (spin >= 64)
+					{
+						std::this_thread::yield();
+					}
+				}
+			}
+
+			inline void unlock()
+			{
+				m_locked.store(false, std::memory_order_release);
+			}
+
+			inline const coordinate_type *x() const
+			{
+				return m_coordinates;
+			}
+
+			inline const coordinate_type *y() const
+			{
+				return m_coordinates + NodeCapacity;
+			}
+
+			inline void push_back(PointIterator point_it, const Point &position)
+			{
+				m_points[m_number_of_points] = point_it;
+				m_coordinates[m_number_of_points] = position[0];
+				m_coordinates[NodeCapacity + m_number_of_points] = position[1];
+
+				++m_number_of_points;
+			}
+
+			inline Point position(int index) const
+			{
+				Point position;
+
+				position[0] = m_coordinates[index];
+				position[1] = m_coordinates[NodeCapacity + index];
+
+				return position;
+			}
+
+		private:
+			node(const node&);
+
+			node &operator=(const node&);
+		};
+
+		node *m_root;
+
+		split_limits m_limits;
+
+		explicit concurrent_point_quad_tree
+		(
+			const Boundary &boundary,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_root(0),
+			m_limits(limits)
+		{
+			quad_tree_t::check_boundary(boundary);
+			check_midpoint_split(limits);
+			check_default_capacity(limits);
+
+			m_root = new node;
+
+			m_root->m_boundary = boundary;
+		}
+
+		~concurrent_point_quad_tree()
+		{
+			delete m_root;
+		}
+
+		inline void add(PointIterator points_begin, PointIterator points_end)
+		{
+			for (PointIterator it = points_begin; it != points_end; ++it)
+			{
+				add(it);
+			}
+		}
+
+		/**
+			Returns true if the point was added, i.e. it lies within the
+			root boundary. Safe to call from any number of threads.
+		*/
+		bool add(PointIterator point_it)
+		{
+			const Point position = *point_it;
+
+			if (false == quad_tree_t::point_intersects_boundary(position, m_root->m_boundary))
+			{
+				return false;
+			}
+
+			node *n = m_root;
+
+			int depth = 0;
+
+			for (;;)
+			{
+				node *children = n->m_children.load(std::memory_order_acquire);
+
+				if (0 != children)
+				{
+					n = &children[quad_tree_t::quadrant(quad_tree_t::center(n->m_boundary), position)];
+
+					++depth;
+
+					continue;
+				}
+
+				n->lock();
+
+				if (0 != n->m_children.load(std::memory_order_relaxed))
+				{
+					n->unlock();
+
+					continue;
+				}
+
+				insert(*n, point_it, position, depth);
+
+				n->unlock();
+
+				return true;
+			}
+		}
+
+		/**
+			Adds a point to the leaf n at depth, which is either locked or
+			not published yet. See point_quad_tree::add().
+		*/
+		void insert(node &n, PointIterator point_it, const Point &position, int depth)
+		{
+			const bool bucket = (0 != n.m_overflow);
+
+			const bool coincident = bucket && true == n.m_coincident && n.x()[0] == position[0] && n.y()[0] == position[1];
+
+			append(n, point_it, position);
+
+			if (0 == n.m_overflow || true == coincident || (true == bucket && false == n.m_coincident))
+			{
+				return;
+			}
+
+			n.m_coincident = coincides(n);
+
+			if (true == n.m_coincident || false == can_split(n, depth))
+			{
+				return;
+			}
+
+			split(n, depth);
+		}
+
+		static inline void append(node &n, PointIterator point_it, const Point &position)
+		{
+			if (n.m_number_of_points < NodeCapacity)
+			{
+				n.push_back(point_it, position);
+				return;
+			}
+
+			if (0 == n.m_overflow || NodeCapacity == n.m_overflow->m_number_of_points)
+			{
+				node *chunk = new node;
+
+				chunk->m_boundary = n.m_boundary;
+				chunk->m_overflow = n.m_overflow;
+
+				n.m_overflow = chunk;
+			}
+
+			n.m_overflow->push_back(point_it, position);
+		}
+
+		/**
+			Returns true if all points of the leaf n including its overflow
+			chain have the same coordinates
+		*/
+		static inline bool coincides(const node &n)
+		{
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->m_overflow)
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					if (chunk->x()[index] != n.x()[0] || chunk->y()[index] != n.y()[0])
+					{
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		inline bool can_split(const node &n, int depth) const
+		{
+			return quad_tree_t::can_split(n.m_boundary, depth, m_limits);
+		}
+
+		/**
+			Distributes the points of the leaf n at depth over a new block
+			of children, splits those further as needed and publishes the
+			block. Until then no other thread can see the children, so the
+			blocks below it are filled in and stored in the same loop.
+		*/
+		void split(node &n, int depth)
+		{
+			fixed_stack<std::pair<node*, int> > stack;
+
+			node *children = distribute(n);
+
+			push_splits(children, depth + 1, stack);
+
+			while (false == stack.empty())
+			{
+				const std::pair<node*, int> entry = stack.pop();
+
+				node *grandchildren = distribute(*entry.first);
+
+				push_splits(grandchildren, entry.second + 1, stack);
+
+				entry.first->m_children.store(grandchildren, std::memory_order_relaxed);
+			}
+
+			n.m_children.store(children, std::memory_order_release);
+		}
+
+		/**
+			Moves the points of the leaf n to a new block of children and
+			returns it without publishing it
+		*/
+		node *distribute(node &n)
+		{
+			const Point center = quad_tree_t::center(n.m_boundary);
+
+			node *children = new node[4];
+
+			for (int index = 0; index < 4; ++index)
+			{
+				children[index].m_boundary = quad_tree_t::child_boundary(n.m_boundary, center, index);
+			}
+
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->m_overflow)
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					const Point position = chunk->position(index);
+
+					append(children[quad_tree_t::quadrant(center, position)], chunk->m_points[index], position);
+				}
+			}
+
+			while (0 != n.m_overflow)
+			{
+				node *chunk = n.m_overflow;
+
+				n.m_overflow = chunk->m_overflow;
+
+				chunk->m_overflow = 0;
+
+				delete chunk;
+			}
+
+			n.m_number_of_points = 0;
+			n.m_coincident = false;
+
+			return children;
+		}
+
+		/**
+			Marks the overflowing children at depth whose points all
+			coincide like insert() does and pushes the others it would
+			split
+		*/
+		inline void push_splits(node *children, int depth, fixed_stack<std::pair<node*, int> > &stack)
+		{
+			for (int index = 0; index < 4; ++index)
+			{
+				node &c = children[index];
+
+				if (0 == c.m_overflow)
+				{
+					continue;
+				}
+
+				c.m_coincident = coincides(c);
+
+				if (false == c.m_coincident && true == can_split(c, depth))
+				{
+					stack.push(std::make_pair(&c, depth));
+				}
+			}
+		}
+
+		/**
+			Calls visitor(point_it) for every point within range. Safe to
+			call concurrently with add().
+		*/
+		template<class Visitor>
+		inline void visit_range(const Boundary &range, Visitor &visitor) const
+		{
+			visit_range(*m_root, range, visitor);
+		}
+
+		template<class Visitor>
+		void visit_range(node &start, const Boundary &range, Visitor &visitor) const
+		{
+			fixed_stack<node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				node &n = *stack.pop();
+
+				if (false == quad_tree_t::boundaries_intersect(n.m_boundary, range))
+				{
+					continue;
+				}
+
+				node *children = n.m_children.load(std::memory_order_acquire);
+
+				if (0 == children)
+				{
+					n.lock();
+
+					children = n.m_children.load(std::memory_order_relaxed);
+
+					if (0 == children)
+					{
+						for (const node *chunk = &n; 0 != chunk; chunk = chunk->m_overflow)
+						{
+							for (int base = 0; base < chunk->m_number_of_points; base += 64)
+							{
+								const int count = std::min(64, chunk->m_number_of_points - base);
+
+								uint64_t mask = boundary_mask<interval_filter>(chunk->x() + base, chunk->y() + base, count, range);
+
+								while (0 != mask)
+								{
+									visitor(chunk->m_points[base + lowest_bit(mask)]);
+
+									mask &= mask - 1;
+								}
+							}
+						}
+					}
+
+					n.unlock();
+
+					if (0 == children)
+					{
+						continue;
+					}
+				}
+
+				for (int index = 3; index >= 0; --index)
+				{
+					stack.push(&children[index]);
+				}
+			}
+		}
+
+		template<class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_range(range, visitor);
+
+			return visitor.m_out;
+		}
+
+		size_t number_of_points() const
+		{
+			counting_visitor visitor;
+
+			visit_range(m_root->m_boundary, visitor);
+
+			return visitor.m_count;
+		}
+
+		static inline bool point_intersects_boundary(const Point &point, const Boundary &boundary)
+		{
+			return quad_tree_t::point_intersects_boundary(point, boundary);
+		}
+
+	private:
+		concurrent_point_quad_tree(const concurrent_point_quad_tree&);
+
+		concurrent_point_quad_tree &operator=(const concurrent_point_quad_tree&);
+	};
+
+} // namespace
+
+#endif
@@ -0,0 +1,466 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_LINEAR_QUAD_TREE_HH
+#define FPS_LINEAR_QUAD_TREE_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief The orders linear_quad_tree can store its nodes in.
+
+		The four children of a node always stay together, so the layouts
+		order these blocks of siblings (and the root on its own):
+
+		- breadth_first_layout: Level by level. Descents jump further the
+		  deeper they get.
+		- depth_first_layout: Preorder, i.e. Z-order (Morton order) for the
+		  blocks. Descents into the first children are sequential, the
+		  others skip whole subtrees.
+		- van_emde_boas_layout: The blocks of the top half of the tree's
+		  height are laid out recursively, followed by each of the subtrees
+		  hanging off it, again recursively. Every descent then touches
+		  O(log_B N) cache lines or pages for all block sizes B at once.
+	*/
+	enum node_layout
+	{
+		breadth_first_layout,
+		depth_first_layout,
+		van_emde_boas_layout
+	};
+
+	/**
+		@brief A read only, pointerless copy of a point_quad_tree.
+
+		All nodes live in one array, in breadth first order unless another
+		node_layout is asked for. The four children of a node are stored
+		next to each other in the order north west, north east, south west,
+		south east, so a node only needs the index of its first child.
+		Leaves instead store where their points start in one shared array
+		of point iterators. Boundaries are not stored at all but derived
+		from the root boundary while descending, using the same arithmetic
+		as QuadTree, so they come out identical.
+
+		A node takes 8 bytes no matter what Point and PointIterator are. The
+		coordinates of the points are kept next to the iterators as separate
+		x and y arrays so leaves are filtered with SIMD like in QuadTree.
+
+		NOTE: The same lifetime requirements for the points as for QuadTree
+		apply. The linear tree does not refer to the tree it was built from.
+	*/
+	template<class QuadTree>
+	struct linear_quad_tree
+	{
+		typedef typename QuadTree::Boundary Boundary;
+
+		typedef typename QuadTree::point_type Point;
+
+		typedef typename QuadTree::point_iterator PointIterator;
+
+		typedef typename QuadTree::coordinate_type coordinate_type;
+
+		/*
+			Marks interior nodes in node::m_number_of_points
+		*/
+		static const uint32_t interior = 0xffffffff;
+
+		struct node
+		{
+			/*
+				Interior nodes: The index of the first child in m_nodes.
+				Leaves: The index of the first point in m_points.
+			*/
+			uint32_t m_index;
+
+			/*
+				The number of points of a leaf or interior for interior
+				nodes
+			*/
+			uint32_t m_number_of_points;
+
+			inline bool has_children() const
+			{
+				return interior == m_number_of_points;
+			}
+		};
+
+		Boundary m_boundary;
+
+		std::vector<node> m_nodes;
+
+		std::vector<PointIterator> m_points;
+
+		/*
+			The coordinates of m_points as copied from the leaves, padded
+			for the SIMD filters
+		*/
+		std::vector<coordinate_type> m_x;
+
+		std::vector<coordinate_type> m_y;
+
+		/**
+			Flattens tree. The boundaries of the children are derived from
+			their parents on the fly, so tree has to split at midpoints.
+		*/
+		explicit linear_quad_tree(const QuadTree &tree, node_layout layout = breadth_first_layout)
+		:
+			m_boundary(tree.m_root->m_boundary)
+		{
+			typedef typename QuadTree::node source_node;
+
+			check_midpoint_split(tree.m_limits);
+
+			std::deque<const source_node*> queue;
+
+			queue.push_back(&*tree.m_root);
+
+			m_nodes.resize(1);
+
+			for (size_t index = 0; false == queue.empty(); ++index)
+			{
+				const source_node &n = *queue.front();
+
+				queue.pop_front();
+
+				if (true == n.has_children())
+				{
+					m_nodes[index].m_index = static_cast<uint32_t>(m_nodes.size());
+					m_nodes[index].m_number_of_points = interior;
+
+					m_nodes.resize(m_nodes.size() + 4);
+
+					queue.push_back(&*n.m_north_west);
+					queue.push_back(&*n.m_north_east);
+					queue.push_back(&*n.m_south_west);
+					queue.push_back(&*n.m_south_east);
+
+					continue;
+				}
+
+				m_nodes[index].m_index = static_cast<uint32_t>(m_points.size());
+				m_nodes[index].m_number_of_points = static_cast<uint32_t>(n.leaf_size());
+
+				for (const source_node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					m_points.insert(m_points.end(), chunk->m_points, chunk->m_points + chunk->m_number_of_points);
+
+					m_x.insert(m_x.end(), chunk->x(), chunk->x() + chunk->m_number_of_points);
+					m_y.insert(m_y.end(), chunk->y(), chunk->y() + chunk->m_number_of_points);
+				}
+			}
+
+			if (breadth_first_layout != layout)
+			{
+				relayout(layout);
+			}
+
+			m_x.resize(m_x.size() + simd_lane_padding);
+			m_y.resize(m_y.size() + simd_lane_padding);
+		}
+
+		/**
+			Reorders the nodes, which are in breadth first order, and then
+			the points to follow the leaves
+		*/
+		void relayout(node_layout layout)
+		{
+			/*
+				The indices of the first nodes of the sibling blocks in
+				their new order
+			*/
+			std::vector<uint32_t> blocks;
+
+			blocks.reserve(1 + (m_nodes.size() - 1) / 4);
+
+			if (depth_first_layout == layout)
+			{
+				lay_out_depth_first(0, blocks);
+			}
+			else
+			{
+				/*
+					Nodes come after their parents, so one backward pass
+					finds all heights
+				*/
+				std::vector<uint8_t> heights(m_nodes.size(), 0);
+
+				for (size_t index = m_nodes.size(); index > 0; --index)
+				{
+					const node &n = m_nodes[index - 1];
+
+					if (true == n.has_children())
+					{
+						for (int child = 0; child < 4; ++child)
+						{
+							heights[index - 1] = std::max<uint8_t>(heights[index - 1], heights[n.m_index + child] + 1);
+						}
+					}
+				}
+
+				lay_out_van_emde_boas(0, heights[0] + 1, blocks);
+			}
+
+			std::vector<uint32_t> positions(m_nodes.size());
+
+			std::vector<node> nodes;
+
+			nodes.reserve(m_nodes.size());
+
+			for (size_t block = 0; block < blocks.size(); ++block)
+			{
+				for (uint32_t index = blocks[block]; index < blocks[block] + block_size(blocks[block]); ++index)
+				{
+					positions[index] = static_cast<uint32_t>(nodes.size());
+
+					nodes.push_back(m_nodes[index]);
+				}
+			}
+
+			std::vector<PointIterator> points;
+			std::vector<coordinate_type> x;
+			std::vector<coordinate_type> y;
+
+			points.reserve(m_points.size());
+			x.reserve(m_x.size() + simd_lane_padding);
+			y.reserve(m_y.size() + simd_lane_padding);
+
+			for (size_t index = 0; index < nodes.size(); ++index)
+			{
+				node &n = nodes[index];
+
+				if (true == n.has_children())
+				{
+					n.m_index = positions[n.m_index];
+					continue;
+				}
+
+				const uint32_t first = n.m_index;
+
+				n.m_index = static_cast<uint32_t>(points.size());
+
+				points.insert(points.end(), m_points.begin() + first, m_points.begin() + first + n.m_number_of_points);
+
+				x.insert(x.end(), m_x.begin() + first, m_x.begin() + first + n.m_number_of_points);
+				y.insert(y.end(), m_y.begin() + first, m_y.begin() + first + n.m_number_of_points);
+			}
+
+			m_nodes.swap(nodes);
+			m_points.swap(points);
+			m_x.swap(x);
+			m_y.swap(y);
+		}
+
+		/**
+			The root stands alone, all other nodes come in blocks of four
+			siblings
+		*/
+		static inline uint32_t block_size(uint32_t first)
+		{
+			return 0 == first ? 1 : 4;
+		}
+
+		void lay_out_depth_first(uint32_t first, std::vector<uint32_t> &blocks) const
+		{
+			blocks.push_back(first);
+
+			for (uint32_t index = first; index < first + block_size(first); ++index)
+			{
+				if (true == m_nodes[index].has_children())
+				{
+					lay_out_depth_first(m_nodes[index].m_index, blocks);
+				}
+			}
+		}
+
+		/**
+			Lays out the first number_of_levels levels of blocks of the
+			subtree starting with the block first
+		*/
+		void lay_out_van_emde_boas(uint32_t first, int number_of_levels, std::vector<uint32_t> &blocks) const
+		{
+			if (1 == number_of_levels)
+			{
+				blocks.push_back(first);
+				return;
+			}
+
+			const int top_levels = number_of_levels / 2;
+
+			lay_out_van_emde_boas(first, top_levels, blocks);
+
+			/*
+				The blocks right below the top part
+			*/
+			std::vector<uint32_t> frontier(1, first);
+
+			for (int level = 0; level < top_levels && false == frontier.empty(); ++level)
+			{
+				std::vector<uint32_t> next;
+
+				for (size_t block = 0; block < frontier.size(); ++block)
+				{
+					for (uint32_t index = frontier[block]; index < frontier[block] + block_size(frontier[block]); ++index)
+					{
+						if (true == m_nodes[index].has_children())
+						{
+							next.push_back(m_nodes[index].m_index);
+						}
+					}
+				}
+
+				frontier.swap(next);
+			}
+
+			for (size_t block = 0; block < frontier.size(); ++block)
+			{
+				lay_out_van_emde_boas(frontier[block], number_of_levels - top_levels, blocks);
+			}
+		}
+
+		inline size_t number_of_nodes() const
+		{
+			return m_nodes.size();
+		}
+
+		inline size_t number_of_points() const
+		{
+			return m_points.size();
+		}
+
+		/**
+			Calls visitor(point_it) for every point within range. See
+			QuadTree::visit_range().
+		*/
+		template<class Visitor>
+		inline void visit_range(const Boundary &range, Visitor &visitor) const
+		{
+			visit_range(m_nodes[0], m_boundary, range, visitor);
+		}
+
+		template<class Visitor>
+		void visit_range(const node &start, const Boundary &start_boundary, const Boundary &range, Visitor &visitor) const
+		{
+			fixed_stack<std::pair<const node*, Boundary> > stack;
+
+			stack.push(std::make_pair(&start, start_boundary));
+
+			while (false == stack.empty())
+			{
+				const std::pair<const node*, Boundary> entry = stack.pop();
+
+				const node &n = *entry.first;
+
+				const Boundary &boundary = entry.second;
+
+				if (false == QuadTree::boundaries_intersect(boundary, range))
+				{
+					continue;
+				}
+
+				if (true == QuadTree::boundary_is_inside(boundary, range))
+				{
+					visit_all(n, visitor);
+					continue;
+				}
+
+				if (true == n.has_children())
+				{
+					const Point center = QuadTree::center(boundary);
+
+					for (int child = 3; child >= 0; --child)
+					{
+						stack.push(std::make_pair(&m_nodes[n.m_index + child], QuadTree::child_boundary(boundary, center, child)));
+					}
+
+					continue;
+				}
+
+				for (uint32_t base = n.m_index; base < n.m_index + n.m_number_of_points; base += 64)
+				{
+					const int count = static_cast<int>(std::min<uint32_t>(64, n.m_index + n.m_number_of_points - base));
+
+					uint64_t mask = boundary_mask<interval_filter>(&m_x[base], &m_y[base], count, range);
+
+					while (0 != mask)
+					{
+						visitor(m_points[base + lowest_bit(mask)]);
+
+						mask &= mask - 1;
+					}
+				}
+			}
+		}
+
+		template<class Visitor>
+		void visit_all(const node &start, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				if (true == n.has_children())
+				{
+					for (int child = 3; child >= 0; --child)
+					{
+						stack.push(&m_nodes[n.m_index + child]);
+					}
+
+					continue;
+				}
+
+				for (uint32_t index = n.m_index; index < n.m_index + n.m_number_of_points; ++index)
+				{
+					visitor(m_points[index]);
+				}
+			}
+		}
+
+		/**
+			Writes the iterators of all points within range to out and
+			returns the advanced output iterator.
+		*/
+		template<class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_range(range, visitor);
+
+			return visitor.m_out;
+		}
+	};
+
+	/**
+		Returns a linear_quad_tree copy of tree with its nodes in the given
+		layout
+	*/
+	template<class QuadTree>
+	inline linear_quad_tree<QuadTree> freeze(const QuadTree &tree, node_layout layout = breadth_first_layout)
+	{
+		return linear_quad_tree<QuadTree>(tree, layout);
+	}
+
+} // namespace
+
+#endif
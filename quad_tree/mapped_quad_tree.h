@@ -0,0 +1,504 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_MAPPED_QUAD_TREE_HH
+#define FPS_MAPPED_QUAD_TREE_HH
+
+#include <quad_tree/linear_quad_tree.h>
+
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace quad_tree
+{
+	/**
+		@brief The header of the file format written by save_mapped().
+
+		A file holds one linear_quad_tree (see there) with the point iterators
+		replaced by 32 bit indices into the range the tree was built from. It
+		consists of this header followed by the sections listed in it,
+		each starting at an offset that is a multiple of 64:
+
+		- The root boundary as four coordinates (lower x, lower y, upper x,
+		  upper y)
+		- The nodes, 8 bytes each, exactly like linear_quad_tree::node
+		- The point indices, one uint32_t per point
+		- The x and the y coordinates of the points in the same order, each
+		  padded by simd_lane_padding coordinates
+
+		Everything is stored in the byte order of the machine writing it. The
+		magic number doubles as a byte order check. Readers reject files with
+		a different version or coordinate type.
+	*/
+	struct mapped_header
+	{
+		char m_magic[8];
+
+		uint32_t m_version;
+
+		/*
+			sizeof(coordinate_type)
+		*/
+		uint32_t m_coordinate_size;
+
+		/*
+			One of the coordinate_kind values
+		*/
+		uint32_t m_coordinate_kind;
+
+		uint32_t m_reserved;
+
+		uint64_t m_number_of_nodes;
+
+		uint64_t m_number_of_points;
+
+		uint64_t m_boundary_offset;
+
+		uint64_t m_nodes_offset;
+
+		uint64_t m_indices_offset;
+
+		uint64_t m_x_offset;
+
+		uint64_t m_y_offset;
+
+		/*
+			The size of the whole file
+		*/
+		uint64_t m_size;
+
+		enum coordinate_kind
+		{
+			floating_point = 0,
+			signed_integer = 1,
+			unsigned_integer = 2
+		};
+
+		static const uint32_t current_version = 1;
+
+		static inline const char *magic()
+		{
+			return "FPSQUAD1";
+		}
+
+		template<class Coordinate>
+		static inline uint32_t kind()
+		{
+			if (false == std::numeric_limits<Coordinate>::is_integer)
+			{
+				return floating_point;
+			}
+
+			return std::numeric_limits<Coordinate>::is_signed ? signed_integer : unsigned_integer;
+		}
+
+		static inline uint64_t align(uint64_t offset)
+		{
+			return (offset + 63) & ~static_cast<uint64_t>(63);
+		}
+
+		/**
+			Returns the header of a file holding the given numbers of nodes
+			(of node_size bytes each) and points with all sections laid out
+		*/
+		template<class Coordinate>
+		static mapped_header layout(uint64_t number_of_nodes, uint64_t number_of_points, uint64_t node_size)
+		{
+			const uint64_t padded_points = number_of_points + simd_lane_padding;
+
+			mapped_header header;
+
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.m_magic, magic(), sizeof(header.m_magic));
+
+			header.m_version = current_version;
+			header.m_coordinate_size = sizeof(Coordinate);
+			header.m_coordinate_kind = kind<Coordinate>();
+			header.m_number_of_nodes = number_of_nodes;
+			header.m_number_of_points = number_of_points;
+
+			header.m_boundary_offset = align(sizeof(header));
+			header.m_nodes_offset = align(header.m_boundary_offset + 4 * sizeof(Coordinate));
+			header.m_indices_offset = align(header.m_nodes_offset + number_of_nodes * node_size);
+			header.m_x_offset = align(header.m_indices_offset + number_of_points * sizeof(uint32_t));
+			header.m_y_offset = align(header.m_x_offset + padded_points * sizeof(Coordinate));
+			header.m_size = header.m_y_offset + padded_points * sizeof(Coordinate);
+
+			return header;
+		}
+	};
+
+	/**
+		Writes linear in the format described at mapped_header. The points of
+		linear must lie in the range starting at points_begin, and there may
+		be at most 2^32 - 1 of them. Throws std::runtime_error if writing fails.
+	*/
+	template<class QuadTree>
+	void save_mapped(const linear_quad_tree<QuadTree> &linear, typename QuadTree::point_iterator points_begin, std::ostream &o)
+	{
+		typedef typename QuadTree::coordinate_type coordinate_type;
+
+		typedef typename linear_quad_tree<QuadTree>::node node;
+
+		if (linear.number_of_points() >= 0xffffffffu)
+		{
+			throw std::runtime_error("Too many points for 32 bit indices");
+		}
+
+		const mapped_header header = mapped_header::layout<coordinate_type>(linear.number_of_nodes(), linear.number_of_points(), sizeof(node));
+
+		std::vector<char> file(header.m_size, 0);
+
+		std::memcpy(&file[0], &header, sizeof(header));
+
+		const coordinate_type boundary[4] =
+		{
+			linear.m_boundary.first[0],
+			linear.m_boundary.first[1],
+			linear.m_boundary.second[0],
+			linear.m_boundary.second[1]
+		};
+
+		std::memcpy(&file[header.m_boundary_offset], boundary, sizeof(boundary));
+		std::memcpy(&file[header.m_nodes_offset], &linear.m_nodes[0], header.m_number_of_nodes * sizeof(node));
+
+		uint32_t *indices = reinterpret_cast<uint32_t*>(&file[header.m_indices_offset]);
+
+		for (size_t index = 0; index < linear.number_of_points(); ++index)
+		{
+			indices[index] = static_cast<uint32_t>(linear.m_points[index] - points_begin);
+		}
+
+		std::memcpy(&file[header.m_x_offset], &linear.m_x[0], linear.m_x.size() * sizeof(coordinate_type));
+		std::memcpy(&file[header.m_y_offset], &linear.m_y[0], linear.m_y.size() * sizeof(coordinate_type));
+
+		if (false == static_cast<bool>(o.write(&file[0], static_cast<std::streamsize>(file.size()))))
+		{
+			throw std::runtime_error("Writing the tree failed");
+		}
+	}
+
+	template<class QuadTree>
+	void save_mapped(const linear_quad_tree<QuadTree> &linear, typename QuadTree::point_iterator points_begin, const char *filename)
+	{
+		std::ofstream o(filename, std::ios::binary | std::ios::trunc);
+
+		if (false == o.is_open())
+		{
+			throw std::runtime_error("Could not open file for writing");
+		}
+
+		save_mapped(linear, points_begin, o);
+	}
+
+	/**
+		@brief A read only file mapped into memory.
+	*/
+	struct mapped_file
+	{
+		const void *m_data;
+
+		size_t m_size;
+
+		explicit mapped_file(const char *filename)
+		:
+			m_data(0),
+			m_size(0)
+		{
+			const int file = ::open(filename, O_RDONLY);
+
+			if (-1 == file)
+			{
+				throw std::runtime_error("Could not open file");
+			}
+
+			struct stat status;
+
+			if (-1 == ::fstat(file, &status) || 0 == status.st_size)
+			{
+				::close(file);
+
+				throw std::runtime_error("Could not determine the file size");
+			}
+
+			void *data = ::mmap(0, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+
+			::close(file);
+
+			if (MAP_FAILED == data)
+			{
+				throw std::runtime_error("Could not map file");
+			}
+
+			m_data = data;
+			m_size = static_cast<size_t>(status.st_size);
+		}
+
+		~mapped_file()
+		{
+			::munmap(const_cast<void*>(m_data), m_size);
+		}
+
+	private:
+		mapped_file(const mapped_file&);
+
+		mapped_file &operator=(const mapped_file&);
+	};
+
+	/**
+		@brief Queries a tree written by save_mapped() in place.
+
+		The constructor only checks the header and sets up pointers into the
+		memory, so opening a mapped file costs next to nothing and the pages
+		are only read (and shared between processes mapping the same file)
+		as queries touch them. Queries work like the ones of
+		linear_quad_tree, including the SIMD filtering of leaves, but report
+		the indices of the points into the range the tree was built from
+		instead of iterators.
+
+		NOTE: Only the header and the section bounds are validated. The nodes
+		themselves are trusted, so only map files written by save_mapped().
+
+		NOTE: The memory must stay mapped and unchanged while the tree is
+		used. The tree is read only and all its methods may be called from
+		any number of threads at the same time.
+	*/
+	template<class QuadTree>
+	struct mapped_quad_tree
+	{
+		typedef typename QuadTree::Boundary Boundary;
+
+		typedef typename QuadTree::point_type Point;
+
+		typedef typename QuadTree::coordinate_type coordinate_type;
+
+		typedef typename linear_quad_tree<QuadTree>::node node;
+
+		Boundary m_boundary;
+
+		const node *m_nodes;
+
+		const uint32_t *m_indices;
+
+		const coordinate_type *m_x;
+
+		const coordinate_type *m_y;
+
+		size_t m_number_of_nodes;
+
+		size_t m_number_of_points;
+
+		/**
+			Throws std::runtime_error if data does not hold a compatible
+			tree of the given size
+		*/
+		mapped_quad_tree(const void *data, size_t size)
+		{
+			const char *bytes = static_cast<const char*>(data);
+
+			mapped_header header;
+
+			if (size < sizeof(header))
+			{
+				throw std::runtime_error("File too small for a header");
+			}
+
+			std::memcpy(&header, bytes, sizeof(header));
+
+			if (0 != std::memcmp(header.m_magic, mapped_header::magic(), sizeof(header.m_magic)))
+			{
+				throw std::runtime_error("Not a mapped quad tree");
+			}
+
+			if (mapped_header::current_version != header.m_version)
+			{
+				throw std::runtime_error("Unsupported mapped quad tree version");
+			}
+
+			if (sizeof(coordinate_type) != header.m_coordinate_size || mapped_header::kind<coordinate_type>() != header.m_coordinate_kind)
+			{
+				throw std::runtime_error("Mapped quad tree has a different coordinate type");
+			}
+
+			if (header.m_size > size || 0 == header.m_number_of_nodes)
+			{
+				throw std::runtime_error("Mapped quad tree is truncated");
+			}
+
+			if
+			(
+				0 != (header.m_boundary_offset & 63) ||
+				0 != (header.m_nodes_offset & 63) ||
+				0 != (header.m_indices_offset & 63) ||
+				0 != (header.m_x_offset & 63) ||
+				0 != (header.m_y_offset & 63) ||
+				header.m_nodes_offset + header.m_number_of_nodes * sizeof(node) > header.m_size ||
+				header.m_indices_offset + header.m_number_of_points * sizeof(uint32_t) > header.m_size ||
+				header.m_x_offset + (header.m_number_of_points + simd_lane_padding) * sizeof(coordinate_type) > header.m_size ||
+				header.m_y_offset + (header.m_number_of_points + simd_lane_padding) * sizeof(coordinate_type) > header.m_size
+			)
+			{
+				throw std::runtime_error("Mapped quad tree has invalid offsets");
+			}
+
+			const coordinate_type *boundary = reinterpret_cast<const coordinate_type*>(bytes + header.m_boundary_offset);
+
+			m_boundary.first[0] = boundary[0];
+			m_boundary.first[1] = boundary[1];
+			m_boundary.second[0] = boundary[2];
+			m_boundary.second[1] = boundary[3];
+
+			m_nodes = reinterpret_cast<const node*>(bytes + header.m_nodes_offset);
+			m_indices = reinterpret_cast<const uint32_t*>(bytes + header.m_indices_offset);
+			m_x = reinterpret_cast<const coordinate_type*>(bytes + header.m_x_offset);
+			m_y = reinterpret_cast<const coordinate_type*>(bytes + header.m_y_offset);
+
+			m_number_of_nodes = static_cast<size_t>(header.m_number_of_nodes);
+			m_number_of_points = static_cast<size_t>(header.m_number_of_points);
+		}
+
+		explicit mapped_quad_tree(const mapped_file &file)
+		:
+			mapped_quad_tree(file.m_data, file.m_size)
+		{
+
+		}
+
+		inline size_t number_of_nodes() const
+		{
+			return m_number_of_nodes;
+		}
+
+		inline size_t number_of_points() const
+		{
+			return m_number_of_points;
+		}
+
+		/**
+			Calls visitor(index) for every point within range
+		*/
+		template<class Visitor>
+		inline void visit_range(const Boundary &range, Visitor &visitor) const
+		{
+			visit_range(m_nodes[0], m_boundary, range, visitor);
+		}
+
+		template<class Visitor>
+		void visit_range(const node &start, const Boundary &start_boundary, const Boundary &range, Visitor &visitor) const
+		{
+			fixed_stack<std::pair<const node*, Boundary> > stack;
+
+			stack.push(std::make_pair(&start, start_boundary));
+
+			while (false == stack.empty())
+			{
+				const std::pair<const node*, Boundary> entry = stack.pop();
+
+				const node &n = *entry.first;
+
+				const Boundary &boundary = entry.second;
+
+				if (false == QuadTree::boundaries_intersect(boundary, range))
+				{
+					continue;
+				}
+
+				if (true == QuadTree::boundary_is_inside(boundary, range))
+				{
+					visit_all(n, visitor);
+					continue;
+				}
+
+				if (true == n.has_children())
+				{
+					const Point center = QuadTree::center(boundary);
+
+					for (int child = 3; child >= 0; --child)
+					{
+						stack.push(std::make_pair(&m_nodes[n.m_index + child], QuadTree::child_boundary(boundary, center, child)));
+					}
+
+					continue;
+				}
+
+				for (uint32_t base = n.m_index; base < n.m_index + n.m_number_of_points; base += 64)
+				{
+					const int count = static_cast<int>(std::min<uint32_t>(64, n.m_index + n.m_number_of_points - base));
+
+					uint64_t mask = boundary_mask<interval_filter>(m_x + base, m_y + base, count, range);
+
+					while (0 != mask)
+					{
+						visitor(m_indices[base + lowest_bit(mask)]);
+
+						mask &= mask - 1;
+					}
+				}
+			}
+		}
+
+		template<class Visitor>
+		void visit_all(const node &start, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				if (true == n.has_children())
+				{
+					for (int child = 3; child >= 0; --child)
+					{
+						stack.push(&m_nodes[n.m_index + child]);
+					}
+
+					continue;
+				}
+
+				for (uint32_t index = n.m_index; index < n.m_index + n.m_number_of_points; ++index)
+				{
+					visitor(m_indices[index]);
+				}
+			}
+		}
+
+		/**
+			Writes the indices of all points within range to out and returns
+			the advanced output iterator
+		*/
+		template<class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_range(range, visitor);
+
+			return visitor.m_out;
+		}
+	};
+
+} // namespace
+
+#endif
@@ -0,0 +1,945 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_OCTREE_HH
+#define FPS_OCTREE_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief The point_quad_tree for points with more than two components.
+
+		Every interior node has 2^D children where D is
+		point_traits<Point>::dimensions, i.e. for three dimensional points this
+		is an octree. The child a point belongs to is its orthant: bit d of the
+		child index is set if the point lies above the center in dimension d.
+		Like in point_quad_tree points on a shared face belong to the lower
+		child.
+
+		NOTE: The same notes as for point_quad_tree apply: The tree keeps
+		iterators into the original data set, copies the coordinates into its
+		leaves structure of arrays, allocates its nodes through Allocation,
+		honours split_limits and collects points which can not be split apart
+		in overflow buckets. It does not check for duplicates and does not do
+		lazy splitting.
+	*/
+	template
+	<
+		class Point,
+		class PointIterator,
+		int NodeCapacity,
+		class Allocation = arena_allocation<>
+	>
+	struct point_octree
+	{
+		typedef point_octree<Point, PointIterator, NodeCapacity, Allocation> octree_t;
+
+		/*
+			Represents the lower and upper corners
+		*/
+		typedef std::pair<Point, Point> Boundary;
+
+		typedef Point point_type;
+
+		typedef PointIterator point_iterator;
+
+		typedef typename point_traits<Point>::coordinate_type coordinate_type;
+
+		static const int dimensions = point_traits<Point>::dimensions;
+
+		static const int number_of_children = 1 << dimensions;
+
+		static_assert(dimensions > 0 && dimensions <= 6, "point_octree supports one to six dimensions");
+
+		/**
+			How many entries the traversals of a tree of maximum_depth_limit
+			levels keep on their stacks at most
+		*/
+		static const int traversal_stack_size = (number_of_children - 1) * maximum_depth_limit + number_of_children;
+
+		struct node;
+
+		typedef typename Allocation::template pool<node> pool_type;
+
+		typedef typename pool_type::pointer node_pointer;
+
+		struct node
+		{
+			/*
+				All null for leaves. Indexed by orthant().
+			*/
+			node_pointer m_children[number_of_children];
+
+			Boundary m_boundary;
+
+			/*
+				The points at this node. Only the first m_number_of_points
+				entries are valid.
+			*/
+			int m_number_of_points;
+
+			PointIterator m_points[NodeCapacity];
+
+			/*
+				Overflow bucket as in point_quad_tree::node
+			*/
+			node_pointer m_overflow;
+
+			bool m_coincident;
+
+			/*
+				The coordinates of the points in dimension d are
+				m_coordinates[d * NodeCapacity] and following. The padding
+				lets interval_filter read whole vectors past the last lane.
+			*/
+			coordinate_type m_coordinates[dimensions * NodeCapacity + simd_lane_padding - 1];
+
+			node(const Boundary &boundary)
+			:
+				m_boundary(boundary),
+				m_number_of_points(0),
+				m_overflow(),
+				m_coincident(false)
+			{
+				std::fill(m_children, m_children + number_of_children, node_pointer());
+				std::fill(m_coordinates, m_coordinates + dimensions * NodeCapacity + simd_lane_padding - 1, coordinate_type());
+			}
+
+			inline bool has_children() const
+			{
+				return static_cast<bool>(m_children[0]);
+			}
+
+			inline const coordinate_type *lane(int dimension) const
+			{
+				return m_coordinates + dimension * NodeCapacity;
+			}
+
+			/**
+				Appends a point with the given coordinates. The node must not
+				be full.
+			*/
+			inline void push_back(PointIterator point_it, const Point &position)
+			{
+				m_points[m_number_of_points] = point_it;
+
+				for (int dimension = 0; dimension < dimensions; ++dimension)
+				{
+					m_coordinates[dimension * NodeCapacity + m_number_of_points] = position[dimension];
+				}
+
+				++m_number_of_points;
+			}
+
+			/**
+				Returns the coordinates stored for the point at index
+			*/
+			inline Point position(int index) const
+			{
+				Point position;
+
+				for (int dimension = 0; dimension < dimensions; ++dimension)
+				{
+					position[dimension] = m_coordinates[dimension * NodeCapacity + index];
+				}
+
+				return position;
+			}
+
+			inline void assign(int index, const node &from, int from_index)
+			{
+				m_points[index] = from.m_points[from_index];
+
+				for (int dimension = 0; dimension < dimensions; ++dimension)
+				{
+					m_coordinates[dimension * NodeCapacity + index] = from.m_coordinates[dimension * NodeCapacity + from_index];
+				}
+			}
+
+			inline const node *next_chunk() const
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+
+			inline node *next_chunk()
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+		};
+
+		pool_type m_pool;
+
+		node_pointer m_root;
+
+		split_limits m_limits;
+
+		point_octree
+		(
+			const Boundary &boundary,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_limits(limits)
+		{
+			check_boundary(boundary);
+			check_midpoint_split(limits);
+			check_default_capacity(limits);
+
+			m_root = m_pool.create(boundary);
+		}
+
+		point_octree
+		(
+			const Boundary &boundary,
+			PointIterator points_begin,
+			PointIterator points_end,
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_limits(limits)
+		{
+			check_boundary(boundary);
+			check_midpoint_split(limits);
+			check_default_capacity(limits);
+
+			m_root = m_pool.create(boundary);
+
+			add(points_begin, points_end);
+		}
+
+		static inline void check_boundary(const Boundary &boundary)
+		{
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				if (boundary.first[dimension] == boundary.second[dimension])
+				{
+					throw std::runtime_error("Degenerate boundary");
+				}
+
+				if (boundary.first[dimension] > boundary.second[dimension])
+				{
+					throw std::runtime_error("Order of boundary points not preserved");
+				}
+			}
+		}
+
+		static inline bool point_intersects_boundary(const Point &point, const Boundary &boundary)
+		{
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				if (point[dimension] < boundary.first[dimension] || point[dimension] > boundary.second[dimension])
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		static inline bool boundaries_intersect(const Boundary &a, const Boundary &b)
+		{
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				if (a.second[dimension] < b.first[dimension] || a.first[dimension] > b.second[dimension])
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+			Returns true if inner lies completely within outer
+		*/
+		static inline bool boundary_is_inside(const Boundary &inner, const Boundary &outer)
+		{
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				if (inner.first[dimension] < outer.first[dimension] || inner.second[dimension] > outer.second[dimension])
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		static inline Point center(const Boundary &boundary)
+		{
+			Point center;
+
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				center[dimension] = coordinate_traits<coordinate_type>::midpoint(boundary.first[dimension], boundary.second[dimension]);
+			}
+
+			return center;
+		}
+
+		/**
+			Returns the index of the child of a node with the given center
+			that point belongs to
+		*/
+		static inline int orthant(const Point &center, const Point &point)
+		{
+			int orthant = 0;
+
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				orthant |= (point[dimension] > center[dimension] ? 1 : 0) << dimension;
+			}
+
+			return orthant;
+		}
+
+		static inline Boundary child_boundary(const Boundary &boundary, const Point &center, int orthant)
+		{
+			Boundary child(boundary.first, center);
+
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				if (0 != (orthant & (1 << dimension)))
+				{
+					child.first[dimension] = center[dimension];
+					child.second[dimension] = boundary.second[dimension];
+				}
+			}
+
+			return child;
+		}
+
+		static inline node &child(const node &n, const Point &position)
+		{
+			return *n.m_children[orthant(center(n.m_boundary), position)];
+		}
+
+		inline void add(PointIterator points_begin, PointIterator points_end)
+		{
+			for (PointIterator it = points_begin; it != points_end; ++it)
+			{
+				add(it);
+			}
+		}
+
+		/**
+			Returns true if the point was added to the tree, i.e. it lies
+			within the root boundary
+		*/
+		inline bool add(PointIterator point_it)
+		{
+			const Point &position = *point_it;
+
+			if (false == point_intersects_boundary(position, m_root->m_boundary))
+			{
+				return false;
+			}
+
+			node *leaf = &*m_root;
+
+			int depth = 0;
+
+			for (; true == leaf->has_children(); ++depth)
+			{
+				leaf = &child(*leaf, position);
+			}
+
+			node &n = *leaf;
+
+			const bool bucket = static_cast<bool>(n.m_overflow);
+
+			const bool coincident = bucket && true == n.m_coincident && true == coincides(n, position);
+
+			append(n, point_it, position);
+
+			if (!n.m_overflow || true == coincident || (true == bucket && false == n.m_coincident))
+			{
+				return true;
+			}
+
+			settle(n, depth);
+
+			return true;
+		}
+
+		/**
+			See point_quad_tree::settle(). There is no lazy splitting.
+		*/
+		inline void settle(node &n, int depth)
+		{
+			if (true == should_split(n, depth))
+			{
+				split(n, depth);
+			}
+		}
+
+		inline bool should_split(node &n, int depth)
+		{
+			n.m_coincident = false;
+			n.m_coincident = coincides(n, n.position(0));
+
+			return false == n.m_coincident && true == can_split(n, depth);
+		}
+
+		/**
+			Returns true if all points of the leaf n including its overflow
+			chain are at position
+		*/
+		inline bool coincides(const node &n, const Point &position) const
+		{
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					for (int dimension = 0; dimension < dimensions; ++dimension)
+					{
+						if (chunk->lane(dimension)[index] != position[dimension])
+						{
+							return false;
+						}
+					}
+				}
+
+				if (true == n.m_coincident)
+				{
+					break;
+				}
+			}
+
+			return true;
+		}
+
+		inline bool can_split(const node &n, int depth) const
+		{
+			if (depth >= m_limits.m_maximum_depth)
+			{
+				return false;
+			}
+
+			const Point center = octree_t::center(n.m_boundary);
+
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				const coordinate_type low = n.m_boundary.first[dimension];
+				const coordinate_type high = n.m_boundary.second[dimension];
+
+				if (false == (low < center[dimension] && center[dimension] < high))
+				{
+					return false;
+				}
+
+				if
+				(
+					static_cast<double>(center[dimension]) - static_cast<double>(low) < m_limits.m_minimum_cell_size ||
+					static_cast<double>(high) - static_cast<double>(center[dimension]) < m_limits.m_minimum_cell_size
+				)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		inline void append(node &n, PointIterator point_it, const Point &position)
+		{
+			if (n.m_number_of_points < NodeCapacity)
+			{
+				n.push_back(point_it, position);
+				return;
+			}
+
+			if (!n.m_overflow || NodeCapacity == n.m_overflow->m_number_of_points)
+			{
+				node_pointer chunk = m_pool.create(n.m_boundary);
+
+				chunk->m_overflow = n.m_overflow;
+
+				n.m_overflow = chunk;
+			}
+
+			n.m_overflow->push_back(point_it, position);
+		}
+
+		/**
+			Splits the leaf n at depth and distributes its points including
+			its overflow chain over the new children in one pass. Children
+			overflowing in turn are settled in the same loop.
+		*/
+		void split(node &n, int depth)
+		{
+			fixed_stack<std::pair<node*, int>, traversal_stack_size> stack;
+
+			stack.push(std::make_pair(&n, depth));
+
+			while (false == stack.empty())
+			{
+				const std::pair<node*, int> entry = stack.pop();
+
+				split(*entry.first);
+
+				for (int index = number_of_children - 1; index >= 0; --index)
+				{
+					node &c = *entry.first->m_children[index];
+
+					if (c.m_overflow && true == should_split(c, entry.second + 1))
+					{
+						stack.push(std::make_pair(&c, entry.second + 1));
+					}
+				}
+			}
+		}
+
+		/**
+			Splits the leaf n once, leaving overflowing children as they are
+		*/
+		void split(node &n)
+		{
+			const Point center = octree_t::center(n.m_boundary);
+
+			for (int index = 0; index < number_of_children; ++index)
+			{
+				n.m_children[index] = m_pool.create(child_boundary(n.m_boundary, center, index));
+			}
+
+			node_pointer overflow = n.m_overflow;
+
+			const int number_of_points = n.m_number_of_points;
+
+			n.m_number_of_points = 0;
+			n.m_overflow = node_pointer();
+			n.m_coincident = false;
+
+			for (int index = 0; index < number_of_points; ++index)
+			{
+				append(*n.m_children[orthant(center, n.position(index))], n.m_points[index], n.position(index));
+			}
+
+			while (overflow)
+			{
+				const node_pointer chunk = overflow;
+
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					append(*n.m_children[orthant(center, chunk->position(index))], chunk->m_points[index], chunk->position(index));
+				}
+
+				overflow = chunk->m_overflow;
+
+				chunk->m_overflow = node_pointer();
+
+				m_pool.release(chunk);
+			}
+		}
+
+		/**
+			Removes point_it from the tree. The point has to be where it was
+			when it was added. Children left with few enough points are
+			merged back into their parent.
+
+			Returns false if the point is not in the tree.
+		*/
+		inline bool remove(PointIterator point_it)
+		{
+			const Point &position = *point_it;
+
+			if (false == point_intersects_boundary(position, m_root->m_boundary))
+			{
+				return false;
+			}
+
+			node *path[maximum_depth_limit + 1];
+
+			int depth = 0;
+
+			node *n = &*m_root;
+
+			for (; true == n->has_children(); n = &child(*n, position))
+			{
+				path[depth++] = n;
+			}
+
+			for (node *chunk = n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					if (chunk->m_points[index] == point_it)
+					{
+						erase(*n, *chunk, index);
+
+						while (0 < depth)
+						{
+							merge(*path[--depth]);
+						}
+
+						return true;
+					}
+				}
+			}
+
+			return false;
+		}
+
+		/**
+			See point_quad_tree::erase()
+		*/
+		inline void erase(node &n, node &chunk, int index)
+		{
+			node &last = n.m_overflow ? *n.m_overflow : n;
+
+			chunk.assign(index, last, last.m_number_of_points - 1);
+
+			--last.m_number_of_points;
+
+			if (&last != &n && 0 == last.m_number_of_points)
+			{
+				const node_pointer empty = n.m_overflow;
+
+				n.m_overflow = empty->m_overflow;
+
+				empty->m_overflow = node_pointer();
+
+				m_pool.release(empty);
+
+				if (!n.m_overflow)
+				{
+					n.m_coincident = false;
+				}
+			}
+		}
+
+		/**
+			See point_quad_tree::merge()
+		*/
+		void merge(node &n)
+		{
+			int number_of_points = 0;
+
+			for (int index = 0; index < number_of_children; ++index)
+			{
+				const node &c = *n.m_children[index];
+
+				if (true == c.has_children() || c.m_overflow)
+				{
+					return;
+				}
+
+				number_of_points += c.m_number_of_points;
+			}
+
+			if (number_of_points > NodeCapacity)
+			{
+				return;
+			}
+
+			for (int index = 0; index < number_of_children; ++index)
+			{
+				const node_pointer c = n.m_children[index];
+
+				n.m_children[index] = node_pointer();
+
+				for (int point = 0; point < c->m_number_of_points; ++point)
+				{
+					n.push_back(c->m_points[point], c->position(point));
+				}
+
+				m_pool.release(c);
+			}
+		}
+
+		/**
+			Calls visitor(point_it) for every point within range (the
+			boundary is inclusive)
+		*/
+		template<class Visitor>
+		inline void visit_range(const Boundary &range, Visitor &visitor) const
+		{
+			visit_range(*m_root, range, visitor);
+		}
+
+		template<class Visitor>
+		void visit_range(const node &start, const Boundary &range, Visitor &visitor) const
+		{
+			fixed_stack<const node*, traversal_stack_size> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				if (false == boundaries_intersect(n.m_boundary, range))
+				{
+					continue;
+				}
+
+				if (true == boundary_is_inside(n.m_boundary, range))
+				{
+					visit_all(n, visitor);
+					continue;
+				}
+
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+					continue;
+				}
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					/*
+						A mask covers 64 lanes, so larger capacities are
+						filtered in blocks of 64 points
+					*/
+					for (int base = 0; base < chunk->m_number_of_points; base += 64)
+					{
+						const int count = std::min(64, chunk->m_number_of_points - base);
+
+						uint64_t mask = lane_mask(count);
+
+						for (int dimension = 0; dimension < dimensions && 0 != mask; ++dimension)
+						{
+							mask &= interval_filter<coordinate_type>::mask(chunk->lane(dimension) + base, count, range.first[dimension], range.second[dimension]);
+						}
+
+						while (0 != mask)
+						{
+							visitor(chunk->m_points[base + lowest_bit(mask)]);
+
+							mask &= mask - 1;
+						}
+					}
+				}
+			}
+		}
+
+		template<class Visitor>
+		void visit_all(const node &start, Visitor &visitor) const
+		{
+			fixed_stack<const node*, traversal_stack_size> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+					continue;
+				}
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					for (int index = 0; index < chunk->m_number_of_points; ++index)
+					{
+						visitor(chunk->m_points[index]);
+					}
+				}
+			}
+		}
+
+		/**
+			Pushes the children of n so that they are popped in orthant
+			order
+		*/
+		static inline void push_children(const node &n, fixed_stack<const node*, traversal_stack_size> &stack)
+		{
+			for (int index = number_of_children - 1; index >= 0; --index)
+			{
+				stack.push(&*n.m_children[index]);
+			}
+		}
+
+		template<class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_range(range, visitor);
+
+			return visitor.m_out;
+		}
+
+		static inline double squared_distance(const Point &point, const Boundary &boundary)
+		{
+			double distance = 0;
+
+			for (int dimension = 0; dimension < dimensions; ++dimension)
+			{
+				const double coordinate = static_cast<double>(point[dimension]);
+
+				double delta = 0;
+
+				if (coordinate < static_cast<double>(boundary.first[dimension]))
+				{
+					delta = static_cast<double>(boundary.first[dimension]) - coordinate;
+				}
+				else if (coordinate > static_cast<double>(boundary.second[dimension]))
+				{
+					delta = coordinate - static_cast<double>(boundary.second[dimension]);
+				}
+
+				distance += delta * delta;
+			}
+
+			return distance;
+		}
+
+		typedef distance_entry<const node*> node_entry;
+
+		typedef distance_entry<PointIterator> point_entry;
+
+		/**
+			Writes the iterators of the (up to) k points closest to point to
+			out, closest first, and returns the advanced output iterator.
+			Works like point_quad_tree::nearest().
+		*/
+		template<class OutputIterator>
+		OutputIterator nearest(const Point &point, size_t k, OutputIterator out) const
+		{
+			typedef quad_tree::farther<node_entry> farther;
+			typedef quad_tree::closer<point_entry> closer;
+
+			std::vector<node_entry> nodes;
+			std::vector<point_entry> points;
+
+			if (0 == k)
+			{
+				return out;
+			}
+
+			nodes.push_back(node_entry(squared_distance(point, m_root->m_boundary), &*m_root));
+
+			while (false == nodes.empty())
+			{
+				std::pop_heap(nodes.begin(), nodes.end(), farther());
+
+				const node_entry entry = nodes.back();
+
+				nodes.pop_back();
+
+				if (points.size() == k && entry.m_distance >= points.front().m_distance)
+				{
+					break;
+				}
+
+				const node &n = *entry.m_target;
+
+				if (true == n.has_children())
+				{
+					for (int index = 0; index < number_of_children; ++index)
+					{
+						const node *c = &*n.m_children[index];
+
+						const double distance = squared_distance(point, c->m_boundary);
+
+						if (points.size() == k && distance >= points.front().m_distance)
+						{
+							continue;
+						}
+
+						nodes.push_back(node_entry(distance, c));
+						std::push_heap(nodes.begin(), nodes.end(), farther());
+					}
+
+					continue;
+				}
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					for (int index = 0; index < chunk->m_number_of_points; ++index)
+					{
+						double distance = 0;
+
+						for (int dimension = 0; dimension < dimensions; ++dimension)
+						{
+							const double delta = static_cast<double>(point[dimension]) - static_cast<double>(chunk->lane(dimension)[index]);
+
+							distance += delta * delta;
+						}
+
+						if (points.size() < k)
+						{
+							points.push_back(point_entry(distance, chunk->m_points[index]));
+							std::push_heap(points.begin(), points.end(), closer());
+						}
+						else if (distance < points.front().m_distance)
+						{
+							std::pop_heap(points.begin(), points.end(), closer());
+							points.back() = point_entry(distance, chunk->m_points[index]);
+							std::push_heap(points.begin(), points.end(), closer());
+						}
+					}
+				}
+			}
+
+			std::sort_heap(points.begin(), points.end(), closer());
+
+			for (typename std::vector<point_entry>::const_iterator it = points.begin(); it != points.end(); ++it)
+			{
+				*out = it->m_target;
+				++out;
+			}
+
+			return out;
+		}
+
+		size_t number_of_points() const
+		{
+			return number_of_points(*m_root);
+		}
+
+		size_t number_of_points(const node &start) const
+		{
+			fixed_stack<const node*, traversal_stack_size> stack;
+
+			size_t number = 0;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					number += chunk->m_number_of_points;
+				}
+
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+				}
+			}
+
+			return number;
+		}
+
+	private:
+		point_octree(const point_octree&);
+
+		point_octree &operator=(const point_octree&);
+	};
+
+} // namespace
+
+#endif
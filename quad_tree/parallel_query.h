@@ -0,0 +1,594 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_QUAD_TREE_PARALLEL_QUERY_HH
+#define FPS_QUAD_TREE_PARALLEL_QUERY_HH
+
+#include <quad_tree/quad_tree.h>
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+
+namespace quad_tree
+{
+	/**
+		@brief Answers range queries on a point_quad_tree with several threads.
+
+		A query is split into tasks, one per subtree, on a pool of worker
+		threads. Each worker takes tasks from the back of its own queue and
+		steals from the front of the others' when it runs dry. Subtrees
+		holding more than m_grain points are split into their children,
+		smaller ones are walked by the worker that took them, writing into
+		an output buffer of its own. The buffers are merged when all tasks
+		are done. The calling thread works along as worker 0.
+
+		Before going parallel the number of points a query may report is
+		estimated from the subtree counts of the nodes near the root. Queries
+		estimated below m_minimum_parallel_points are answered on the
+		calling thread without involving the pool at all.
+
+		The threads are started once by the constructor and sleep between
+		queries. The pool answers one query at a time: A parallel_queries
+		object must not be used by two threads at the same time.
+
+		NOTE: The workers only read the tree. It must not have dirty leaves
+		(call refine() on lazily splitting trees first) and must not be
+		changed during a query.
+
+		NOTE: query_range() reports the points in no particular order.
+		query_ranges() reports exactly what point_quad_tree::query_ranges()
+		does.
+	*/
+	template<class QuadTree>
+	class parallel_queries
+	{
+	public:
+		typedef typename QuadTree::node node;
+
+		typedef typename QuadTree::Boundary Boundary;
+
+		typedef typename QuadTree::point_iterator PointIterator;
+
+		/*
+			Queries expected to report fewer points stay on the calling
+			thread
+		*/
+		size_t m_minimum_parallel_points;
+
+		/*
+			Subtrees with at most this many points are walked by a single
+			task
+		*/
+		size_t m_grain;
+
+		explicit parallel_queries
+		(
+			unsigned number_of_threads = std::thread::hardware_concurrency(),
+			size_t minimum_parallel_points = static_cast<size_t>(1) << 16,
+			size_t grain = static_cast<size_t>(1) << 12
+		)
+		:
+			m_minimum_parallel_points(minimum_parallel_points),
+			m_grain(grain),
+			m_pending(0),
+			m_busy(0),
+			m_generation(0),
+			m_stop(false),
+			m_tree(0),
+			m_ranges(0),
+			m_chunk_size(0)
+		{
+			number_of_threads = std::max(1u, number_of_threads);
+
+			for (unsigned worker = 0; worker < number_of_threads; ++worker)
+			{
+				m_workers.push_back(boost::shared_ptr<worker_state>(new worker_state));
+			}
+
+			m_threads.reserve(number_of_threads - 1);
+
+			try
+			{
+				for (unsigned worker = 1; worker < number_of_threads; ++worker)
+				{
+					m_threads.push_back(std::thread(thread_main(*this, worker)));
+				}
+			}
+			catch (...)
+			{
+				/*
+					The destructor does not run for a half constructed
+					object
+				*/
+				stop();
+				throw;
+			}
+		}
+
+		~parallel_queries()
+		{
+			stop();
+		}
+
+		inline unsigned number_of_threads() const
+		{
+			return static_cast<unsigned>(m_workers.size());
+		}
+
+		/**
+			Writes the iterators of all points of tree within range (the
+			boundary is inclusive) to out and returns the advanced output
+			iterator
+		*/
+		template<class OutputIterator>
+		OutputIterator query_range(const QuadTree &tree, const Boundary &range, OutputIterator out)
+		{
+			if (1 == number_of_threads() || estimate(tree, range, m_minimum_parallel_points) < m_minimum_parallel_points)
+			{
+				return tree.query_range(range, out);
+			}
+
+			m_tree = &tree;
+			m_range = range;
+			m_ranges = 0;
+
+			for (size_t worker = 0; worker < m_workers.size(); ++worker)
+			{
+				m_workers[worker]->m_results.clear();
+			}
+
+			const task root = { &*tree.m_root, 0 };
+
+			run_job(&root, 1);
+
+			for (size_t worker = 0; worker < m_workers.size(); ++worker)
+			{
+				out = std::copy(m_workers[worker]->m_results.begin(), m_workers[worker]->m_results.end(), out);
+			}
+
+			return out;
+		}
+
+		/**
+			Answers number_of_ranges range queries like
+			point_quad_tree::query_ranges(). The batch is cut into chunks of
+			consecutive queries which the workers answer with one traversal
+			each.
+		*/
+		void query_ranges
+		(
+			const QuadTree &tree,
+			const Boundary *ranges,
+			size_t number_of_ranges,
+			std::vector<size_t> &offsets,
+			std::vector<PointIterator> &results
+		)
+		{
+			size_t expected = 0;
+
+			for (size_t query = 0; query < number_of_ranges && expected < m_minimum_parallel_points; ++query)
+			{
+				expected += estimate(tree, ranges[query], m_minimum_parallel_points - expected);
+			}
+
+			if (1 == number_of_threads() || number_of_ranges < 2 || expected < m_minimum_parallel_points)
+			{
+				tree.query_ranges(ranges, number_of_ranges, offsets, results, m_workers[0]->m_scratch);
+				return;
+			}
+
+			const size_t number_of_chunks = std::min(number_of_ranges, static_cast<size_t>(4) * number_of_threads());
+
+			m_tree = &tree;
+			m_ranges = ranges;
+			m_chunk_size = (number_of_ranges + number_of_chunks - 1) / number_of_chunks;
+
+			m_chunk_offsets.resize(number_of_chunks);
+			m_chunk_results.resize(number_of_chunks);
+
+			std::vector<task> chunks;
+
+			for (size_t chunk = 0; chunk * m_chunk_size < number_of_ranges; ++chunk)
+			{
+				const task t = { 0, chunk };
+
+				chunks.push_back(t);
+			}
+
+			m_number_of_ranges = number_of_ranges;
+
+			run_job(&chunks[0], chunks.size());
+
+			offsets.assign(1, 0);
+
+			results.clear();
+
+			for (size_t chunk = 0; chunk < chunks.size(); ++chunk)
+			{
+				const std::vector<size_t> &chunk_offsets = m_chunk_offsets[chunk];
+
+				for (size_t query = 1; query < chunk_offsets.size(); ++query)
+				{
+					offsets.push_back(results.size() + chunk_offsets[query]);
+				}
+
+				results.insert(results.end(), m_chunk_results[chunk].begin(), m_chunk_results[chunk].end());
+			}
+		}
+
+		/**
+			Returns the number of points in the nodes intersecting range
+			within the top levels below the root of tree, an upper bound of
+			what a query for range reports. Stops counting at limit.
+		*/
+		static size_t estimate(const QuadTree &tree, const Boundary &range, size_t limit)
+		{
+			fixed_stack<const node*> stack;
+
+			size_t number = 0;
+
+			stack.push(&*tree.m_root);
+
+			while (false == stack.empty() && number < limit)
+			{
+				const node &n = *stack.pop();
+
+				if (false == n.boundary_intersects(range))
+				{
+					continue;
+				}
+
+				if (false == n.has_children() || true == n.boundary_is_inside(range) || n.m_depth >= estimate_depth)
+				{
+					number += n.m_subtree_points;
+					continue;
+				}
+
+				QuadTree::push_children(n, stack);
+			}
+
+			return number;
+		}
+
+	private:
+		/*
+			How deep estimate() looks
+		*/
+		static const int estimate_depth = 3;
+
+		/*
+			A subtree to query for m_range or, with m_node being 0, the
+			chunk of queries with index m_chunk
+		*/
+		struct task
+		{
+			const node *m_node;
+
+			size_t m_chunk;
+		};
+
+		struct worker_state
+		{
+			std::mutex m_mutex;
+
+			std::deque<task> m_tasks;
+
+			std::vector<PointIterator> m_results;
+
+			typename QuadTree::batch_scratch m_scratch;
+		};
+
+		struct thread_main
+		{
+			parallel_queries &m_queries;
+
+			unsigned m_worker;
+
+			thread_main(parallel_queries &queries, unsigned worker)
+			:
+				m_queries(queries),
+				m_worker(worker)
+			{
+
+			}
+
+			void operator()()
+			{
+				m_queries.wait_for_jobs(m_worker);
+			}
+		};
+
+		std::vector<boost::shared_ptr<worker_state> > m_workers;
+
+		std::vector<std::thread> m_threads;
+
+		/*
+			Tasks queued or running. A task adds its children before it
+			retires, so this only drops to 0 once the whole job is done.
+		*/
+		std::atomic<size_t> m_pending;
+
+		/*
+			Pool threads working on a job, guarded by m_mutex
+		*/
+		unsigned m_busy;
+
+		/*
+			Counts the jobs started, guarded by m_mutex
+		*/
+		unsigned long m_generation;
+
+		bool m_stop;
+
+		std::mutex m_mutex;
+
+		std::condition_variable m_wake;
+
+		std::condition_variable m_idle;
+
+		std::exception_ptr m_error;
+
+		/*
+			The job
+		*/
+		const QuadTree *m_tree;
+
+		Boundary m_range;
+
+		const Boundary *m_ranges;
+
+		size_t m_number_of_ranges;
+
+		size_t m_chunk_size;
+
+		std::vector<std::vector<size_t> > m_chunk_offsets;
+
+		std::vector<std::vector<PointIterator> > m_chunk_results;
+
+		/**
+			Hands the tasks out round robin, works along until all of them
+			are done, waits for the pool threads to let go of the job and
+			rethrows the first exception a task threw
+		*/
+		void run_job(const task *tasks, size_t number_of_tasks)
+		{
+			m_error = std::exception_ptr();
+
+			m_pending = number_of_tasks;
+
+			for (size_t index = 0; index < number_of_tasks; ++index)
+			{
+				worker_state &worker = *m_workers[index % m_workers.size()];
+
+				std::lock_guard<std::mutex> lock(worker.m_mutex);
+
+				worker.m_tasks.push_back(tasks[index]);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				++m_generation;
+			}
+
+			m_wake.notify_all();
+
+			work(0);
+
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+
+				while (0 != m_busy)
+				{
+					m_idle.wait(lock);
+				}
+			}
+
+			if (m_error)
+			{
+				std::rethrow_exception(m_error);
+			}
+		}
+
+		/**
+			Wakes the pool threads to exit and joins them
+		*/
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				m_stop = true;
+			}
+
+			m_wake.notify_all();
+
+			for (size_t thread = 0; thread < m_threads.size(); ++thread)
+			{
+				m_threads[thread].join();
+			}
+		}
+
+		/**
+			The loop of the pool threads
+		*/
+		void wait_for_jobs(unsigned worker)
+		{
+			unsigned long generation = 0;
+
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+
+					while (false == m_stop && generation == m_generation)
+					{
+						m_wake.wait(lock);
+					}
+
+					if (true == m_stop)
+					{
+						return;
+					}
+
+					generation = m_generation;
+
+					++m_busy;
+				}
+
+				work(worker);
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+
+					--m_busy;
+				}
+
+				m_idle.notify_all();
+			}
+		}
+
+		/**
+			Runs and steals tasks until the job is done
+		*/
+		void work(unsigned worker)
+		{
+			while (0 != m_pending)
+			{
+				task t;
+
+				if (false == take(worker, t) && false == steal(worker, t))
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				try
+				{
+					run(worker, t);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+
+					if (!m_error)
+					{
+						m_error = std::current_exception();
+					}
+				}
+
+				--m_pending;
+			}
+		}
+
+		inline bool take(unsigned worker, task &t)
+		{
+			worker_state &state = *m_workers[worker];
+
+			std::lock_guard<std::mutex> lock(state.m_mutex);
+
+			if (true == state.m_tasks.empty())
+			{
+				return false;
+			}
+
+			t = state.m_tasks.back();
+
+			state.m_tasks.pop_back();
+
+			return true;
+		}
+
+		inline bool steal(unsigned worker, task &t)
+		{
+			for (size_t offset = 1; offset < m_workers.size(); ++offset)
+			{
+				worker_state &victim = *m_workers[(worker + offset) % m_workers.size()];
+
+				std::lock_guard<std::mutex> lock(victim.m_mutex);
+
+				if (false == victim.m_tasks.empty())
+				{
+					t = victim.m_tasks.front();
+
+					victim.m_tasks.pop_front();
+
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void run(unsigned worker, const task &t)
+		{
+			worker_state &state = *m_workers[worker];
+
+			if (0 == t.m_node)
+			{
+				const size_t first = t.m_chunk * m_chunk_size;
+
+				const size_t number = std::min(m_chunk_size, m_number_of_ranges - first);
+
+				m_tree->query_ranges(m_ranges + first, number, m_chunk_offsets[t.m_chunk], m_chunk_results[t.m_chunk], state.m_scratch);
+
+				return;
+			}
+
+			const node &n = *t.m_node;
+
+			if (false == n.boundary_intersects(m_range))
+			{
+				return;
+			}
+
+			if (false == n.has_children() || n.m_subtree_points <= m_grain)
+			{
+				output_visitor<std::back_insert_iterator<std::vector<PointIterator> > > visitor(std::back_inserter(state.m_results));
+
+				m_tree->visit_range(n, m_range, visitor);
+
+				return;
+			}
+
+			const node *children[] = { &*n.m_north_west, &*n.m_north_east, &*n.m_south_west, &*n.m_south_east };
+
+			m_pending += 4;
+
+			std::lock_guard<std::mutex> lock(state.m_mutex);
+
+			for (int index = 0; index < 4; ++index)
+			{
+				const task child = { children[index], 0 };
+
+				state.m_tasks.push_back(child);
+			}
+		}
+
+		parallel_queries(const parallel_queries&);
+
+		parallel_queries &operator=(const parallel_queries&);
+	};
+
+} // namespace
+
+#endif
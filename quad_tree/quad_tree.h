@@ -14,385 +14,3905 @@
 #ifndef FPS_QUAD_TREE_HH
 #define FPS_QUAD_TREE_HH
 
+#include <quad_tree/simd.h>
+
 #include <boost/shared_ptr.hpp>
-#include <set>
+#include <boost/array.hpp>
+#include <array>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <new>
 #include <stdexcept>
 #include <cassert>
+#include <cstddef>
+#include <stdint.h>
 #include <ostream>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <exception>
 
 namespace quad_tree
 {
 	/**
-		@brief A class representing a quad tree used for spatial indexing. 
-		
-		NOTE: The requirements for class Point are such that there's an operator[] that can be used 
-		to get the components (2) of the point.
-		
-		NOTE: This data structure is non intrusive. I.e. it keeps around only iterators to 
-		an original data set. That also means that if you add any points they must be alive for 
-		the whole life time of the quad_tree object otherwise its operations become undefined (all 
-		except the destructor).
+		@brief Allocation policy that gives every node its own reference counted
+		heap block.
 
-		NOTE: If CheckUniqueness is false then adding two points with identical coordinates
-		will lead to undefined behaviour. If it is true, then additional bookkeeping is 
-		performed increasing the cost of adding a point.
+		This is how the nodes used to be managed. Each split costs four heap
+		allocations plus four control blocks. It is kept around to compare
+		against arena_allocation.
 	*/
-	template<class Point, class PointIterator, int NodeCapacity, bool CheckUniqueness = false>
-	struct point_quad_tree
+	struct shared_ptr_allocation
 	{
-		typedef point_quad_tree<Point, PointIterator, NodeCapacity> quad_tree_t;
-		
-		typedef boost::shared_ptr<quad_tree_t> quad_tree_ptr;
-		
-		quad_tree_ptr m_north_west;
-		
-		quad_tree_ptr m_north_east;
-		
-		quad_tree_ptr m_south_west;
-		
-		quad_tree_ptr m_south_east;
-		
-		/*
-			Represents the upper left and lower right corners
-		*/
-		typedef std::pair<Point, Point> Boundary;
-		
-		Boundary m_boundary;
+		template<class Node>
+		struct pool
+		{
+			typedef boost::shared_ptr<Node> pointer;
 
-		/*
-			The points at this node
+			template<class Argument>
+			inline pointer create(const Argument &argument)
+			{
+				return pointer(new Node(argument));
+			}
+
+			/**
+				Nodes own each other, so there is nothing to take over
+			*/
+			inline void splice(pool &)
+			{
+
+			}
+
+			inline void swap(pool &)
+			{
+
+			}
+
+			/**
+				The node goes away with its last reference
+			*/
+			inline void release(const pointer &)
+			{
+
+			}
+		};
+	};
+
+	/**
+		@brief Allocation policy that carves nodes out of contiguous blocks of
+		BlockSize nodes each.
+
+		Nodes are plain pointers into the blocks, so there is no reference count to
+		maintain. A released node is only recycled by later create() calls. All nodes are
+		destroyed in one go when the pool (i.e. the tree owning it) is destroyed.
+	*/
+	template<size_t BlockSize = 1024>
+	struct arena_allocation
+	{
+		template<class Node>
+		struct pool
+		{
+			typedef Node *pointer;
+
+			/*
+				Raw storage for BlockSize nodes of which the first m_used
+				are constructed
+			*/
+			struct block
+			{
+				void *m_memory;
+
+				size_t m_used;
+			};
+
+			/*
+				New nodes are always taken from the last block
+			*/
+			std::vector<block> m_blocks;
+
+			/*
+				Released nodes. They stay constructed until the pool is
+				destroyed and are assigned a fresh node when reused.
+			*/
+			std::vector<Node*> m_free;
+
+			pool()
+			{
+
+			}
+
+			~pool()
+			{
+				for (size_t index = m_blocks.size(); index > 0; --index)
+				{
+					const block &b = m_blocks[index - 1];
+
+					Node *nodes = static_cast<Node*>(b.m_memory);
+
+					for (size_t node = b.m_used; node > 0; --node)
+					{
+						nodes[node - 1].~Node();
+					}
+
+					::operator delete(b.m_memory);
+				}
+			}
+
+			template<class Argument>
+			inline pointer create(const Argument &argument)
+			{
+				if (false == m_free.empty())
+				{
+					Node *node = m_free.back();
+
+					m_free.pop_back();
+
+					*node = Node(argument);
+
+					return node;
+				}
+
+				if (true == m_blocks.empty() || BlockSize == m_blocks.back().m_used)
+				{
+					block b;
+
+					m_blocks.reserve(m_blocks.size() + 1);
+
+					b.m_memory = ::operator new(BlockSize * sizeof(Node));
+					b.m_used = 0;
+
+					m_blocks.push_back(b);
+				}
+
+				block &b = m_blocks.back();
+
+				Node *node = static_cast<Node*>(b.m_memory) + b.m_used;
+
+				new (node) Node(argument);
+
+				++b.m_used;
+
+				return node;
+			}
+
+			/**
+				Takes over all nodes of other, which is left empty. This
+				allows building parts of a tree with separate pools (e.g. on
+				separate threads) and collecting them in one afterwards.
+			*/
+			inline void splice(pool &other)
+			{
+				typename std::vector<block>::iterator position = m_blocks.end();
+
+				if (false == m_blocks.empty())
+				{
+					--position;
+				}
+
+				m_blocks.insert(position, other.m_blocks.begin(), other.m_blocks.end());
+
+				other.m_blocks.clear();
+
+				m_free.insert(m_free.end(), other.m_free.begin(), other.m_free.end());
+
+				other.m_free.clear();
+			}
+
+			/**
+				Exchanges all nodes with other
+			*/
+			inline void swap(pool &other)
+			{
+				m_blocks.swap(other.m_blocks);
+				m_free.swap(other.m_free);
+			}
+
+			/**
+				Makes node available to create() again
+			*/
+			inline void release(pointer node)
+			{
+				m_free.push_back(node);
+			}
+
+		private:
+			pool(const pool&);
+
+			pool &operator=(const pool&);
+		};
+	};
+
+	/**
+		@brief Describes a Point type to the trees.
+
+		Specialize this for point types that do not provide a value_type or
+		have more than two components. boost::array and std::array get their
+		number of components from their size.
+	*/
+	template<class Point>
+	struct point_traits
+	{
+		typedef typename Point::value_type coordinate_type;
+
+		static const int dimensions = 2;
+	};
+
+	template<class Coordinate, size_t Dimensions>
+	struct point_traits<boost::array<Coordinate, Dimensions> >
+	{
+		typedef Coordinate coordinate_type;
+
+		static const int dimensions = static_cast<int>(Dimensions);
+	};
+
+	template<class Coordinate, size_t Dimensions>
+	struct point_traits<std::array<Coordinate, Dimensions> >
+	{
+		typedef Coordinate coordinate_type;
+
+		static const int dimensions = static_cast<int>(Dimensions);
+	};
+
+	/**
+		@brief The arithmetic the trees do on coordinates.
+
+		This version is for floating point coordinates. Integer coordinates get
+		the specialization below which only shifts, so no float math is done on
+		them while descending or sorting.
+	*/
+	template<class Coordinate, bool IsInteger = std::numeric_limits<Coordinate>::is_integer>
+	struct coordinate_traits
+	{
+		/**
+			Returns the coordinate half way between low and high
 		*/
-		typedef std::set<PointIterator> PointsSet;
-		
-		PointsSet m_points;
-		
-		
+		static inline Coordinate midpoint(Coordinate low, Coordinate high)
+		{
+			return (high + low) / 2;
+		}
+
 		/**
-			This constructor determines the total bounding box by iterating over all points.
-			
-			NOTE: The iterator must be bidirectional.
-			
-			NOTE: The range of points must not be empty;
-		*/	
-		point_quad_tree
-		(
-			PointIterator points_begin,
-			PointIterator points_end
-		) 
-		:
-			m_level(0)
+			Maps coordinate within [low, high] to a 16 bit cell index,
+			clamping coordinates outside
+		*/
+		static inline uint32_t cell(Coordinate coordinate, Coordinate low, Coordinate high)
 		{
-			// std::cout << "quad_tree(it, it)" << std::endl;
-			
-			if (points_begin == points_end)
+			const double cell = (static_cast<double>(coordinate) - low) / (static_cast<double>(high) - low) * 65536.0;
+
+			if (cell < 0)
 			{
-				throw std::runtime_error("Empty range not permitted for this quad_tree constructor");
+				return 0;
 			}
-			
-			Boundary boundary(*points_begin, *points_begin);
-			
-			for(PointIterator it = points_begin; it != points_end; ++it)
+
+			if (cell >= 65535.0)
 			{
-				const Point &p = *it;
-				
-				if (p[0] < boundary.first[0])
+				return 65535;
+			}
+
+			return static_cast<uint32_t>(cell);
+		}
+	};
+
+	/**
+		Integer coordinates. Differences are taken unsigned so that they can
+		not overflow. The cell of a coordinate are the 16 bits of its offset
+		from low starting at the highest bit the offset of high - 1 can have,
+		so for boundaries spanning a power of two the cells line up with the
+		nodes exactly.
+	*/
+	template<class Coordinate>
+	struct coordinate_traits<Coordinate, true>
+	{
+		typedef typename std::make_unsigned<Coordinate>::type unsigned_type;
+
+		static inline Coordinate midpoint(Coordinate low, Coordinate high)
+		{
+			const unsigned_type span = static_cast<unsigned_type>(static_cast<unsigned_type>(high) - static_cast<unsigned_type>(low));
+
+			return static_cast<Coordinate>(static_cast<unsigned_type>(low) + static_cast<unsigned_type>(span >> 1));
+		}
+
+		static inline uint32_t cell(Coordinate coordinate, Coordinate low, Coordinate high)
+		{
+			if (coordinate <= low || high <= low)
+			{
+				return 0;
+			}
+
+			if (coordinate >= high)
+			{
+				return 65535;
+			}
+
+			const uint64_t span = static_cast<unsigned_type>(static_cast<unsigned_type>(high) - static_cast<unsigned_type>(low));
+
+			const uint64_t offset = static_cast<unsigned_type>(static_cast<unsigned_type>(coordinate) - static_cast<unsigned_type>(low));
+
+			const int bits = (1 == span) ? 0 : highest_bit(span - 1) + 1;
+
+			if (bits > 16)
+			{
+				return static_cast<uint32_t>(offset >> (bits - 16));
+			}
+
+			return static_cast<uint32_t>(offset << (16 - bits));
+		}
+	};
+
+	inline void feed_spaces(int number_of_spaces, std::ostream &o)
+	{
+		for (int index = 0; index < number_of_spaces; ++index)
+		{
+			o << "  ";
+		}
+	}
+
+	/**
+		The deepest level any tree splits to. The root is at depth 0.
+	*/
+	const int maximum_depth_limit = 64;
+
+	/**
+		The number of entries a depth first traversal pushing all four
+		children of every node it pops needs at most: three siblings waiting
+		on each level above the deepest one plus the four children of that.
+	*/
+	const int traversal_stack_size = 3 * maximum_depth_limit + 4;
+
+	/**
+		@brief A stack of at most Capacity elements kept in place.
+
+		The traversals of the trees use it instead of recursing, so walking a
+		tree of any depth allowed by split_limits takes a known, small amount
+		of stack, also in threads with small stacks.
+	*/
+	template<class T, int Capacity = traversal_stack_size>
+	struct fixed_stack
+	{
+		T m_elements[Capacity];
+
+		int m_size;
+
+		fixed_stack()
+		:
+			m_size(0)
+		{
+
+		}
+
+		inline bool empty() const
+		{
+			return 0 == m_size;
+		}
+
+		inline void push(const T &element)
+		{
+			assert(m_size < Capacity);
+
+			m_elements[m_size++] = element;
+		}
+
+		inline T pop()
+		{
+			assert(0 < m_size);
+
+			return m_elements[--m_size];
+		}
+	};
+
+	/**
+		Where point_quad_tree divides a node it splits. midpoint_split halves
+		the node in both dimensions. median_split and mean_split divide it at
+		the median or the mean of the coordinates of the points it holds, so
+		that clustered points end up in children of similar size instead of
+		in long chains of nodes around mostly empty space.
+
+		The adaptive policies fall back to the midpoint in a dimension where
+		the points all have the same coordinate or splitting at the median
+		or mean would violate the split_limits.
+	*/
+	enum split_policy
+	{
+		midpoint_split,
+		median_split,
+		mean_split
+	};
+
+	/**
+		@brief Limits on how far point_quad_tree splits its nodes.
+
+		A full leaf that may not be split any further keeps additional points in
+		an overflow bucket instead (see point_quad_tree::node).
+	*/
+	struct split_limits
+	{
+		/*
+			Nodes at this depth are never split. At most maximum_depth_limit.
+		*/
+		int m_maximum_depth;
+
+		/*
+			Nodes are not split if that would make their children smaller than
+			this in any dimension
+		*/
+		double m_minimum_cell_size;
+
+		/*
+			Where nodes are split. Only point_quad_tree supports other
+			policies than midpoint_split.
+		*/
+		split_policy m_policy;
+
+		/*
+			Leaves above m_bottom_depth are split when they hold more than
+			m_capacity points, leaves at m_bottom_depth and below when they
+			hold more than m_bottom_capacity. 0 stands for the NodeCapacity
+			of the tree, which is also the largest capacity allowed, and
+			for m_capacity in case of m_bottom_capacity. Only
+			point_quad_tree supports capacities other than its NodeCapacity
+			(see tune_capacity()).
+		*/
+		int m_capacity;
+
+		int m_bottom_capacity;
+
+		int m_bottom_depth;
+
+		split_limits(int maximum_depth = maximum_depth_limit, double minimum_cell_size = 0, split_policy policy = midpoint_split)
+		:
+			m_maximum_depth(maximum_depth),
+			m_minimum_cell_size(minimum_cell_size),
+			m_policy(policy),
+			m_capacity(0),
+			m_bottom_capacity(0),
+			m_bottom_depth(maximum_depth_limit)
+		{
+
+		}
+	};
+
+	inline void check_split_limits(const split_limits &limits)
+	{
+		if (limits.m_maximum_depth < 0 || limits.m_maximum_depth > maximum_depth_limit)
+		{
+			throw std::runtime_error("Maximum depth out of range");
+		}
+
+		if (limits.m_policy < midpoint_split || limits.m_policy > mean_split)
+		{
+			throw std::runtime_error("Unknown split policy");
+		}
+
+		if (limits.m_capacity < 0 || limits.m_bottom_capacity < 0 || limits.m_bottom_depth < 0)
+		{
+			throw std::runtime_error("Negative capacity or bottom depth");
+		}
+	}
+
+	/**
+		For the trees which derive the boundaries of children from the
+		boundary of their parent
+	*/
+	inline void check_midpoint_split(const split_limits &limits)
+	{
+		check_split_limits(limits);
+
+		if (midpoint_split != limits.m_policy)
+		{
+			throw std::runtime_error("Only midpoint_split is supported");
+		}
+	}
+
+	/**
+		For the trees which split nodes by their compile time capacity only
+	*/
+	inline void check_default_capacity(const split_limits &limits)
+	{
+		if (0 != limits.m_capacity || 0 != limits.m_bottom_capacity)
+		{
+			throw std::runtime_error("Only the NodeCapacity of the tree is supported");
+		}
+	}
+
+	/**
+		@brief Counts of the work done on the hot paths of point_quad_tree.
+
+		The counters are only maintained when FPS_QUAD_TREE_COUNTERS is defined
+		before including this header. Otherwise counting compiles to nothing.
+		Each thread counts into its own instance returned by counters(), so
+		concurrent queries count without synchronizing. Assign a default
+		constructed instance to reset them.
+	*/
+	struct operation_counters
+	{
+		/*
+			Nodes add() descended through and nodes queries looked at
+		*/
+		uint64_t m_nodes_visited;
+
+		/*
+			Points compared against a query range or query point
+		*/
+		uint64_t m_points_tested;
+
+		uint64_t m_splits;
+
+		operation_counters()
+		:
+			m_nodes_visited(0),
+			m_points_tested(0),
+			m_splits(0)
+		{
+
+		}
+	};
+
+	/**
+		Returns the counters of the calling thread
+	*/
+	inline operation_counters &counters()
+	{
+		static thread_local operation_counters thread_counters;
+
+		return thread_counters;
+	}
+
+#if defined(FPS_QUAD_TREE_COUNTERS)
+	#define FPS_QUAD_TREE_COUNT(counter, amount) (::quad_tree::counters().counter += (amount))
+#else
+	#define FPS_QUAD_TREE_COUNT(counter, amount) ((void)0)
+#endif
+
+	/**
+		@brief The shape of a tree as returned by point_quad_tree::statistics().
+	*/
+	struct tree_statistics
+	{
+		/*
+			Nodes of the tree proper, i.e. not counting overflow chunks
+		*/
+		size_t m_nodes;
+
+		size_t m_leaves;
+
+		size_t m_overflow_chunks;
+
+		size_t m_dirty_leaves;
+
+		size_t m_points;
+
+		int m_depth;
+
+		/*
+			Element d is the number of leaves at depth d
+		*/
+		std::vector<size_t> m_depth_histogram;
+
+		/*
+			Element i is the number of leaves holding i points for i up to
+			the node capacity. The last element counts the leaves with an
+			overflow chain.
+		*/
+		std::vector<size_t> m_fill_histogram;
+
+		/*
+			Memory taken by nodes and overflow chunks
+		*/
+		size_t m_bytes;
+
+		tree_statistics()
+		:
+			m_nodes(0),
+			m_leaves(0),
+			m_overflow_chunks(0),
+			m_dirty_leaves(0),
+			m_points(0),
+			m_depth(0),
+			m_bytes(0)
+		{
+
+		}
+
+		/**
+			Returns the fraction of the room for points in leaves and
+			overflow chunks that is taken. It does not exceed 1.
+		*/
+		inline double fill_factor() const
+		{
+			if (0 == m_leaves || m_fill_histogram.size() < 2)
+			{
+				return 0;
+			}
+
+			return static_cast<double>(m_points) / ((m_leaves + m_overflow_chunks) * (m_fill_histogram.size() - 2));
+		}
+	};
+
+	/**
+		@brief What point_quad_tree::refit() did to the tree.
+	*/
+	struct refit_statistics
+	{
+		/*
+			The points looked at, i.e. all points in the tree before
+		*/
+		size_t m_points;
+
+		/*
+			Points that left their leaf and were removed and added again,
+			including the lost ones
+		*/
+		size_t m_moved;
+
+		/*
+			Points that left the root boundary or, with CheckUniqueness,
+			ended up on another point. They are not in the tree anymore.
+		*/
+		size_t m_lost;
+
+		size_t m_leaves;
+
+		/*
+			Leaves that kept all their points but had some of the stored
+			coordinates rewritten
+		*/
+		size_t m_rewritten_leaves;
+
+		/*
+			Leaves that points left, i.e. the leaves the m_moved points
+			came from
+		*/
+		size_t m_shrunk_leaves;
+
+		/*
+			Interior nodes that became leaves again as points moved away
+		*/
+		size_t m_merged_nodes;
+
+		refit_statistics()
+		:
+			m_points(0),
+			m_moved(0),
+			m_lost(0),
+			m_leaves(0),
+			m_rewritten_leaves(0),
+			m_shrunk_leaves(0),
+			m_merged_nodes(0)
+		{
+
+		}
+
+		/**
+			Returns the fraction of the points that left their leaf, i.e.
+			m_moved over m_points. Points only rewritten in place do not
+			count. Past some fraction building a new tree is faster than
+			refitting.
+		*/
+		inline double churn() const
+		{
+			if (0 == m_points)
+			{
+				return 0;
+			}
+
+			return static_cast<double>(m_moved) / m_points;
+		}
+	};
+
+	/**
+		@brief A visitor writing the point iterators it is called with to an
+		output iterator
+	*/
+	template<class OutputIterator>
+	struct output_visitor
+	{
+		OutputIterator m_out;
+
+		output_visitor(OutputIterator out)
+		:
+			m_out(out)
+		{
+
+		}
+
+		template<class PointIterator>
+		inline void operator()(PointIterator point_it)
+		{
+			*m_out = point_it;
+			++m_out;
+		}
+	};
+
+	/**
+		@brief A visitor only counting the points it is called with
+	*/
+	struct counting_visitor
+	{
+		size_t m_count;
+
+		counting_visitor()
+		:
+			m_count(0)
+		{
+
+		}
+
+		template<class PointIterator>
+		inline void operator()(PointIterator)
+		{
+			++m_count;
+		}
+	};
+
+	/**
+		@brief A visitor for trees storing indices which hands
+		points_begin + index on to another visitor
+	*/
+	template<class RandomAccessIterator, class Visitor>
+	struct resolving_visitor
+	{
+		RandomAccessIterator m_points_begin;
+
+		Visitor &m_visitor;
+
+		resolving_visitor(RandomAccessIterator points_begin, Visitor &visitor)
+		:
+			m_points_begin(points_begin),
+			m_visitor(visitor)
+		{
+
+		}
+
+		template<class Index>
+		inline void operator()(Index index)
+		{
+			m_visitor(m_points_begin + index);
+		}
+	};
+
+	/*
+		A squared distance together with what it is the distance to. Used by
+		the nearest neighbour searches.
+	*/
+	template<class Target>
+	struct distance_entry
+	{
+		double m_distance;
+
+		Target m_target;
+
+		distance_entry(double distance, Target target)
+		:
+			m_distance(distance),
+			m_target(target)
+		{
+
+		}
+	};
+
+	template<class Entry>
+	struct farther
+	{
+		inline bool operator()(const Entry &a, const Entry &b) const
+		{
+			return a.m_distance > b.m_distance;
+		}
+	};
+
+	template<class Entry>
+	struct closer
+	{
+		inline bool operator()(const Entry &a, const Entry &b) const
+		{
+			return a.m_distance < b.m_distance;
+		}
+	};
+
+	/**
+		@brief A class representing a quad tree used for spatial indexing. 
+		
+		NOTE: The requirements for class Point are such that there's an operator[] that can be used 
+		to get the components (2) of the point.
+		
+		NOTE: This data structure is non intrusive. I.e. it keeps around only iterators to 
+		an original data set. That also means that if you add any points they must be alive for 
+		the whole life time of the quad_tree object otherwise its operations become undefined (all 
+		except the destructor).
+
+		NOTE: PointIterator may also be an unsigned integer type like uint32_t. The tree then
+		stores indices into a range of points the caller keeps, which makes leaves smaller
+		and the tree independent of where the points live. Since leaves keep copies of the
+		coordinates, indices are never dereferenced: Build with bulk_load_indices() or the
+		add(), remove() and update() overloads taking positions, and resolve the indices
+		reported by queries against the range (see query_range() and resolving_visitor).
+
+		NOTE: Nodes are not split beyond the split_limits given to the constructor, nor
+		when their center can not be represented between their corners anymore. Points with
+		identical coordinates are never split apart either. Leaves that hit one of
+		these limits collect any number of points in an overflow bucket instead.
+
+		NOTE: NodeCapacity is the number of points a node has room for. Leaves are split
+		once they hold more than the capacity given in the split_limits, which may be
+		smaller and differ between the upper and the bottom levels of the tree. It
+		defaults to NodeCapacity, so trees tuned at compile time pay nothing for this.
+		tune_capacity() (capacity_tuning.h) picks a capacity by timing queries on a
+		sample of the data.
+
+		NOTE: If CheckUniqueness is true, then add() scans the leaf a point ends up in and
+		rejects the point if the leaf already holds one with the same coordinates. That
+		costs a scan of the leaf per add() and nothing if it is false. It is not needed
+		for the tree to work with duplicates.
+
+		NOTE: The tree owns all its nodes through a pool created from the Allocation policy.
+		It can not be copied. Moving it hands over the pool and the root in constant time
+		and leaves the source an empty tree with the same boundary and limits. merge()
+		takes over the nodes of another tree with the same boundary.
+
+		NOTE: The coordinates of a point are copied into its leaf (structure of arrays) when
+		it is added so that queries can test whole leaves with SIMD instructions (see
+		simd.h) without dereferencing the iterators.
+
+		NOTE: Thread safety: Any number of threads may call const methods at the same
+		time as long as no thread modifies the tree and the tree has no dirty leaves
+		(i.e. lazy splitting is off or refine() was called after the last add()). Queries
+		taking a scratch object need one per thread. Nothing else is shared between
+		queries. To replace a tree while others read it see tree_snapshots in snapshot.h.
+	*/
+	template
+	<
+		class Point,
+		class PointIterator,
+		int NodeCapacity,
+		bool CheckUniqueness = false,
+		class Allocation = arena_allocation<>
+	>
+	struct point_quad_tree
+	{
+		typedef point_quad_tree<Point, PointIterator, NodeCapacity, CheckUniqueness, Allocation> quad_tree_t;
+		
+		/*
+			Represents the upper left and lower right corners
+		*/
+		typedef std::pair<Point, Point> Boundary;
+
+		typedef Point point_type;
+
+		typedef PointIterator point_iterator;
+
+		typedef typename point_traits<Point>::coordinate_type coordinate_type;
+
+		static const int node_capacity = NodeCapacity;
+
+		/**
+			The nodes count the points below them in 32 bits. add() and
+			bulk_load() throw rather than exceed this.
+		*/
+		static const size_t maximum_number_of_points = 0xffffffffu;
+
+		static_assert(2 == point_traits<Point>::dimensions, "point_quad_tree needs two dimensional points (see point_octree)");
+
+		struct node;
+		
+		typedef typename Allocation::template pool<node> pool_type;
+
+		typedef typename pool_type::pointer node_pointer;
+
+		struct node
+		{
+			node_pointer m_north_west;
+
+			node_pointer m_north_east;
+
+			node_pointer m_south_west;
+
+			node_pointer m_south_east;
+
+			Boundary m_boundary;
+
+			/*
+				Where the children of an interior node meet (see
+				split_policy). The midpoint of m_boundary unless the tree
+				splits adaptively.
+			*/
+			Point m_center;
+
+			/*
+				The points at this node. Only the first m_number_of_points
+				entries are valid. Interior nodes hold no points.
+			*/
+			int m_number_of_points;
+
+			/*
+				The number of points in the subtree at this node including
+				its own overflow chain. Not kept for overflow nodes.
+			*/
+			uint32_t m_subtree_points;
+
+			PointIterator m_points[NodeCapacity];
+
+			/*
+				A full leaf that may not be split keeps further points in a
+				chain of overflow nodes hanging off m_overflow. Overflow
+				nodes only use their points and m_overflow. All chained
+				nodes but the first are full, and the leaf itself is full
+				while it has a chain.
+
+				A leaf holding more points than its leaf_capacity() is
+				overflowing. m_coincident is true if it overflows because
+				all its points have the same coordinates. m_dirty is true if
+				the leaf could be split but that was deferred (see
+				set_lazy_splitting()).
+			*/
+			node_pointer m_overflow;
+
+			bool m_coincident;
+
+			bool m_dirty;
+
+			/*
+				The root is at depth 0
+			*/
+			unsigned char m_depth;
+
+			/*
+				The x coordinates of the points followed by their y
+				coordinates, padded for the SIMD filters. The padding is zeroed
+				so the filters never read indeterminate values.
+			*/
+			coordinate_type m_coordinates[2 * NodeCapacity + simd_lane_padding - 1];
+
+			inline const coordinate_type *x() const
+			{
+				return m_coordinates;
+			}
+
+			inline const coordinate_type *y() const
+			{
+				return m_coordinates + NodeCapacity;
+			}
+
+			/**
+				Appends point_it at position to the points of this leaf
+			*/
+			inline void push_back(PointIterator point_it, const Point &position)
+			{
+				m_points[m_number_of_points] = point_it;
+				m_coordinates[m_number_of_points] = position[0];
+				m_coordinates[NodeCapacity + m_number_of_points] = position[1];
+
+				++m_number_of_points;
+			}
+
+			/**
+				Returns the position the point at index was stored with
+			*/
+			inline Point position(int index) const
+			{
+				Point position;
+
+				position[0] = x()[index];
+				position[1] = y()[index];
+
+				return position;
+			}
+
+			/**
+				Overwrites the point at index with the point at from_index of
+				from
+			*/
+			inline void assign(int index, const node &from, int from_index)
+			{
+				m_points[index] = from.m_points[from_index];
+				m_coordinates[index] = from.m_coordinates[from_index];
+				m_coordinates[NodeCapacity + index] = from.m_coordinates[NodeCapacity + from_index];
+			}
+
+			/**
+				Returns the next node of the overflow chain this node is part
+				of (or the first if this is the leaf) or 0
+			*/
+			inline const node *next_chunk() const
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+
+			inline node *next_chunk()
+			{
+				return m_overflow ? &*m_overflow : 0;
+			}
+
+			/**
+				Returns the number of points of this leaf including its
+				overflow chain
+			*/
+			inline size_t leaf_size() const
+			{
+				size_t size = 0;
+
+				for (const node *chunk = this; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					size += chunk->m_number_of_points;
+				}
+
+				return size;
+			}
+
+			node(const Boundary &boundary)
+			:
+				m_north_west(),
+				m_north_east(),
+				m_south_west(),
+				m_south_east(),
+				m_boundary(boundary),
+				m_center(),
+				m_number_of_points(0),
+				m_subtree_points(0),
+				m_overflow(),
+				m_coincident(false),
+				m_dirty(false),
+				m_depth(0)
+			{
+				std::fill(m_coordinates, m_coordinates + 2 * NodeCapacity + simd_lane_padding - 1, coordinate_type());
+			}
+
+			inline bool has_children() const
+			{
+				assert
+				(
+					(m_north_west && m_north_east && m_south_west && m_south_east) ||
+					(!m_north_west && !m_north_east && !m_south_west && !m_south_east)
+				);
+
+				return static_cast<bool>(m_north_west);
+			}
+
+			inline bool point_intersects_boundary(const Point &point) const
+			{
+				return quad_tree_t::point_intersects_boundary(point, m_boundary);
+			}
+
+			/**
+				Returns true if this node's boundary and the given one
+				have at least one point in common
+			*/
+			inline bool boundary_intersects(const Boundary &boundary) const
+			{
+				return quad_tree_t::boundaries_intersect(m_boundary, boundary);
+			}
+
+			/**
+				Returns true if this node's boundary lies completely
+				within the given one
+			*/
+			inline bool boundary_is_inside(const Boundary &boundary) const
+			{
+				return quad_tree_t::boundary_is_inside(m_boundary, boundary);
+			}
+		};
+
+		static inline bool boundaries_intersect(const Boundary &a, const Boundary &b)
+		{
+			return
+			(
+				a.first[0] <= b.second[0] &&
+				a.first[1] <= b.second[1] &&
+				a.second[0] >= b.first[0] &&
+				a.second[1] >= b.first[1]
+			);
+		}
+
+		/**
+			Returns true if inner lies completely within outer
+		*/
+		static inline bool boundary_is_inside(const Boundary &inner, const Boundary &outer)
+		{
+			return
+			(
+				inner.first[0] >= outer.first[0] &&
+				inner.first[1] >= outer.first[1] &&
+				inner.second[0] <= outer.second[0] &&
+				inner.second[1] <= outer.second[1]
+			);
+		}
+
+		static inline bool point_intersects_boundary(const Point &point, const Boundary &boundary)
+		{
+			const bool does_intersect =
+			(
+				point[0] >= boundary.first[0] &&
+				point[1] >= boundary.first[1] &&
+				point[0] <= boundary.second[0] &&
+				point[1] <= boundary.second[1]
+			);
+
+			// std::cout << "point_intersects_boundary: " << does_intersect << std::endl;
+
+			return does_intersect;
+		}
+
+		/*
+			Declared before m_root so that the root is gone before the pool
+			releasing the nodes.
+		*/
+		pool_type m_pool;
+
+		node_pointer m_root;
+		
+		split_limits m_limits;
+
+		bool m_lazy_splitting;
+
+		/*
+			The positions of the points of a leaf being split by the median
+			or mean split policy (see split_center()). Kept so splitting
+			does not allocate once it has grown to the node capacity.
+		*/
+		std::vector<Point> m_split_positions;
+
+		/**
+			This constructor determines the total bounding box by iterating over all points.
+			
+			NOTE: The iterator must be bidirectional.
+			
+			NOTE: The range of points must not be empty;
+
+			NOTE: The points are added with bulk_load() using number_of_threads
+			threads.
+		*/	
+		point_quad_tree
+		(
+			PointIterator points_begin,
+			PointIterator points_end,
+			unsigned number_of_threads = 1,
+			const split_limits &limits = split_limits()
+		) 
+		:
+			m_limits(limits),
+			m_lazy_splitting(false)
+		{
+			// std::cout << "quad_tree(it, it)" << std::endl;
+			
+			if (points_begin == points_end)
+			{
+				throw std::runtime_error("Empty range not permitted for this quad_tree constructor");
+			}
+			
+			Boundary boundary(*points_begin, *points_begin);
+			
+			for(PointIterator it = points_begin; it != points_end; ++it)
+			{
+				const Point &p = *it;
+				
+				if (p[0] < boundary.first[0])
+				{
+					boundary.first[0] = p[0];
+				}
+				
+				if (p[1] < boundary.first[1])
+				{
+					boundary.first[1] = p[1];
+				}
+
+				if (p[0] > boundary.second[0])
+				{
+					boundary.second[0] = p[0];
+				}
+				
+				if (p[1] > boundary.second[1])
+				{
+					boundary.second[1] = p[1];
+				}
+			}
+			
+			check_boundary(boundary);
+			check_capacities();
+			
+			m_root = m_pool.create(boundary);
+			
+			bulk_load(points_begin, points_end, number_of_threads);
+		}
+		
+		/**
+			Adds all points in the range within boundary with bulk_load()
+			using number_of_threads threads. Points outside are ignored.
+
+			NOTE: This constructor used to only take the boundary and leave
+			the tree empty. Code relying on that must use the constructor
+			taking only a boundary now.
+		*/
+		point_quad_tree
+		(
+			const Boundary &boundary,
+			PointIterator points_begin,
+			PointIterator points_end,
+			unsigned number_of_threads = 1,
+			const split_limits &limits = split_limits()
+		) 
+		:
+			m_limits(limits),
+			m_lazy_splitting(false)
+		{
+			// std::cout << "quad_tree(boundary, it, it) with boundary: " << boundary.first[0] << " " << boundary.first[1] << " " << boundary.second[0] << " " << boundary.second[1] << std::endl;
+			
+			check_boundary(boundary);
+			check_capacities();
+
+			m_root = m_pool.create(boundary);
+
+			bulk_load(points_begin, points_end, number_of_threads);
+		}
+		
+		point_quad_tree
+		(
+			const Boundary &boundary,
+			const split_limits &limits = split_limits()
+		) 
+		:
+			m_limits(limits),
+			m_lazy_splitting(false)
+		{
+			// std::cout << "quad_tree(boundary) with boundary: " << boundary.first[0] << " " << boundary.first[1] << " " << boundary.second[0] << " " << boundary.second[1] << std::endl;
+			
+			check_boundary(boundary);
+			check_capacities();
+
+			m_root = m_pool.create(boundary);
+		}
+		
+		/**
+			Takes over the nodes of other in constant time apart from
+			allocating a new root for other, which is left an empty tree
+			with the same boundary and limits. If that allocation throws
+			both trees are left as they were.
+		*/
+		point_quad_tree(point_quad_tree &&other)
+		:
+			m_limits(other.m_limits),
+			m_lazy_splitting(other.m_lazy_splitting)
+		{
+			pool_type pool;
+
+			const node_pointer root = pool.create(other.m_root->m_boundary);
+
+			m_pool.swap(other.m_pool);
+			other.m_pool.swap(pool);
+
+			m_root = other.m_root;
+
+			other.m_root = root;
+		}
+
+		/**
+			Releases the nodes of this tree and takes over those of other,
+			which is left an empty tree with its boundary and limits
+		*/
+		point_quad_tree &operator=(point_quad_tree &&other)
+		{
+			if (this != &other)
+			{
+				point_quad_tree moved(std::move(other));
+
+				swap(moved);
+			}
+
+			return *this;
+		}
+
+		/**
+			Exchanges the nodes, limits and lazy splitting setting with
+			other in constant time
+		*/
+		inline void swap(point_quad_tree &other)
+		{
+			m_pool.swap(other.m_pool);
+
+			std::swap(m_root, other.m_root);
+			std::swap(m_limits, other.m_limits);
+			std::swap(m_lazy_splitting, other.m_lazy_splitting);
+		}
+
+		/**
+			Checks m_limits and resolves the capacities given as 0
+		*/
+		inline void check_capacities()
+		{
+			check_split_limits(m_limits);
+
+			if (m_limits.m_capacity > NodeCapacity || m_limits.m_bottom_capacity > NodeCapacity)
+			{
+				throw std::runtime_error("Capacity exceeds NodeCapacity");
+			}
+
+			if (0 == m_limits.m_capacity)
+			{
+				m_limits.m_capacity = NodeCapacity;
+			}
+
+			if (0 == m_limits.m_bottom_capacity)
+			{
+				m_limits.m_bottom_capacity = m_limits.m_capacity;
+			}
+		}
+
+		/**
+			Returns the number of points a leaf at depth holds before it is
+			split. Storage is always NodeCapacity points per node, points
+			beyond that go to the overflow chain until the leaf is split.
+		*/
+		inline int leaf_capacity(int depth) const
+		{
+			return depth < m_limits.m_bottom_depth ? m_limits.m_capacity : m_limits.m_bottom_capacity;
+		}
+
+		static inline void check_boundary(const Boundary &boundary)
+		{
+			if 
+			(
+				boundary.first[0] == boundary.second[0] ||
+				boundary.first[1] == boundary.second[1]
+			)
+			{
+				throw std::runtime_error("Degenerate boundary");
+			}
+
+			if 
+			(
+				boundary.first[0] > boundary.second[0] ||
+				boundary.first[1] > boundary.second[1]
+			)
+			{
+				throw std::runtime_error("Order of boundary points not preserved");
+			}
+		}
+		
+		inline void add(PointIterator points_begin, PointIterator points_end)
+		{
+			for (PointIterator it = points_begin; it != points_end; ++it)
+			{
+				add(it);
+			}
+		}
+		
+		/**
+			Returns true if the point was added to the tree
+		*/
+		inline bool add(PointIterator point_it)
+		{
+			return add(*m_root, point_it, *point_it, 0);
+		}
+
+		/**
+			Adds point_it at position without dereferencing it. This is how
+			points are added to trees storing indices.
+		*/
+		inline bool add(PointIterator point_it, const Point &position)
+		{
+			return add(*m_root, point_it, position, 0);
+		}
+
+		/**
+			Returns true if the point was added to the subtree at root
+			(which is at the given depth) at position.
+
+			The leaf is found by picking the child with quadrant() on every
+			level instead of testing the boundaries of the children, so a
+			point on an edge shared by two children is handed to the west
+			or north one only, and a point rejected as a duplicate is never
+			retried elsewhere.
+		*/
+		inline bool add(node &root, PointIterator point_it, const Point &position, int depth)
+		{
+			if (false == root.point_intersects_boundary(position))
+			{
+				return false;
+			}
+			
+			check_room(root.m_subtree_points, 1);
+
+			node *leaf = &root;
+				
+			for (; true == leaf->has_children(); ++depth)
+			{
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				++leaf->m_subtree_points;
+
+				leaf = &child(*leaf, position);
+			}
+			
+			FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+			node &n = *leaf;
+
+			if (true == CheckUniqueness && true == contains_coordinates(n, position))
+			{
+				for (node *inner = &root; inner != &n; inner = &child(*inner, position))
+				{
+					--inner->m_subtree_points;
+				}
+
+				return false;
+			}
+
+			/*
+				Buckets which can not be split are only looked at again if
+				the new point breaks their coincidence
+			*/
+			const uint32_t capacity = leaf_capacity(depth);
+
+			const bool bucket = n.m_subtree_points > capacity && false == n.m_dirty;
+
+			const bool coincident = bucket && true == n.m_coincident && true == coincides(n, position);
+
+			append(n, point_it, position, m_pool);
+
+			if (n.m_subtree_points <= capacity || true == coincident || (true == bucket && false == n.m_coincident))
+			{
+				return true;
+			}
+
+			if (true == n.m_dirty)
+			{
+				if (false == m_lazy_splitting)
+				{
+					split(n, depth);
+				}
+
+				return true;
+			}
+
+			settle(n, depth);
+
+			return true;
+		}
+
+		/**
+			Throws if a subtree of size points can not take number more as
+			the subtree counts would overflow
+		*/
+		static inline void check_room(size_t size, size_t number)
+		{
+			if (number > maximum_number_of_points - size)
+			{
+				throw std::runtime_error("Too many points for one tree");
+			}
+		}
+
+		/**
+			Decides what becomes of the leaf n at depth which just grew an
+			overflow chain: Points all at the same coordinates stay where
+			they are, as do points in leaves that may not be split. Other
+			leaves are split now or, with lazy splitting, marked dirty.
+		*/
+		inline void settle(node &n, int depth)
+		{
+			if (true == should_split(n, depth))
+			{
+				split(n, depth);
+			}
+		}
+
+		/**
+			Returns true if settling the overflowing leaf n at depth means
+			splitting it now (see settle())
+		*/
+		inline bool should_split(node &n, int depth)
+		{
+			n.m_coincident = false;
+			n.m_coincident = coincides(n, n.position(0));
+
+			if (true == n.m_coincident || false == can_split(n, depth))
+			{
+				return false;
+			}
+
+			if (true == m_lazy_splitting)
+			{
+				n.m_dirty = true;
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+			With lazy splitting add() does not split full leaves. It appends
+			to their overflow chain instead and marks them dirty. A dirty
+			leaf is split the first time a range or nearest neighbour query
+			needs to look at its points individually, or by refine(). This
+			saves the splitting work during write heavy phases for all the
+			parts of the tree no query ever gets to.
+
+			Switching lazy splitting off does not split any leaves either,
+			but add() splits dirty leaves again as soon as it reaches them.
+
+			NOTE: Queries split dirty leaves although the queries are const.
+			Of a tree with dirty leaves no two queries must run at the same
+			time. Call refine() before sharing the tree between threads.
+		*/
+		inline void set_lazy_splitting(bool lazy_splitting)
+		{
+			m_lazy_splitting = lazy_splitting;
+		}
+
+		/**
+			Splits all dirty leaves
+		*/
+		inline void refine()
+		{
+			fixed_stack<node*> stack;
+
+			stack.push(&*m_root);
+
+			while (false == stack.empty())
+			{
+				node &n = *stack.pop();
+
+				if (true == n.m_dirty)
+				{
+					split(n, n.m_depth);
+				}
+
+				if (true == n.has_children())
+				{
+					stack.push(&*n.m_south_east);
+					stack.push(&*n.m_south_west);
+					stack.push(&*n.m_north_east);
+					stack.push(&*n.m_north_west);
+				}
+			}
+		}
+
+		/**
+			Splits the dirty leaf n reached by a const query, as if refine()
+			was called on it but without refining its children below
+		*/
+		inline void refine_touched(const node &n) const
+		{
+			quad_tree_t &tree = const_cast<quad_tree_t&>(*this);
+
+			const bool lazy_splitting = tree.m_lazy_splitting;
+
+			tree.m_lazy_splitting = true;
+
+			tree.split(const_cast<node&>(n), n.m_depth);
+
+			tree.m_lazy_splitting = lazy_splitting;
+		}
+
+		/**
+			Returns true if all points of the leaf n including its overflow
+			chain are at position. Only the first point is looked at if n
+			is known to be coincident.
+		*/
+		inline bool coincides(const node &n, const Point &position) const
+		{
+			if (true == n.m_coincident)
+			{
+				return n.x()[0] == position[0] && n.y()[0] == position[1];
+			}
+
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					if (chunk->x()[index] != position[0] || chunk->y()[index] != position[1])
+					{
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		/**
+			Returns true if the split_limits allow splitting n at the given
+			depth and its center lies strictly between its corners
+		*/
+		inline bool can_split(const node &n, int depth) const
+		{
+			return can_split(n.m_boundary, depth, m_limits);
+		}
+
+		static inline bool can_split(const Boundary &boundary, int depth, const split_limits &limits)
+		{
+			if (depth >= limits.m_maximum_depth)
+			{
+				return false;
+			}
+
+			const Point center = quad_tree_t::center(boundary);
+
+			for (int dimension = 0; dimension < 2; ++dimension)
+			{
+				const coordinate_type low = boundary.first[dimension];
+				const coordinate_type high = boundary.second[dimension];
+
+				if (false == (low < center[dimension] && center[dimension] < high))
+				{
+					return false;
+				}
+
+				if
+				(
+					static_cast<double>(center[dimension]) - static_cast<double>(low) < limits.m_minimum_cell_size ||
+					static_cast<double>(high) - static_cast<double>(center[dimension]) < limits.m_minimum_cell_size
+				)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+			Adds a point to the leaf n, starting or extending its overflow
+			chain if it is full. Chain nodes are allocated from pool.
+		*/
+		inline void append(node &n, PointIterator point_it, const Point &position, pool_type &pool)
+		{
+			++n.m_subtree_points;
+
+			if (n.m_number_of_points < NodeCapacity)
+			{
+				n.push_back(point_it, position);
+				return;
+			}
+
+			if (!n.m_overflow || NodeCapacity == n.m_overflow->m_number_of_points)
+			{
+				node_pointer chunk = pool.create(n.m_boundary);
+
+				chunk->m_overflow = n.m_overflow;
+
+				n.m_overflow = chunk;
+			}
+
+			n.m_overflow->push_back(point_it, position);
+		}
+		
+		/**
+			Splits the leaf n at the given depth and distributes its points
+			including its overflow chain over the new children in one pass
+			using the positions stored in the leaf. Children overflowing
+			in turn are settled, those to be split are split in the same
+			loop.
+		*/
+		inline void split(node &n, int depth)
+		{
+			fixed_stack<node*> stack;
+
+			split(n);
+
+			push_splits(n, depth + 1, stack);
+
+			while (false == stack.empty())
+			{
+				node &overflowing = *stack.pop();
+
+				split(overflowing);
+
+				push_splits(overflowing, overflowing.m_depth + 1, stack);
+			}
+		}
+
+		/**
+			Pushes the children of n at depth which settle() would split
+		*/
+		inline void push_splits(node &n, int depth, fixed_stack<node*> &stack)
+		{
+			node *children[] = { &*n.m_north_west, &*n.m_north_east, &*n.m_south_west, &*n.m_south_east };
+
+			for (int index = 0; index < 4; ++index)
+			{
+				if (children[index]->m_subtree_points > static_cast<uint32_t>(leaf_capacity(depth)) && true == should_split(*children[index], depth))
+				{
+					stack.push(children[index]);
+				}
+			}
+		}
+
+		/**
+			Splits the leaf n once, leaving overflowing children as they are
+		*/
+		inline void split(node &n)
+		{
+			FPS_QUAD_TREE_COUNT(m_splits, 1);
+			
+			create_children(n, split_center(n));
+
+			node_pointer overflow = n.m_overflow;
+
+			const int number_of_points = n.m_number_of_points;
+
+			n.m_number_of_points = 0;
+			n.m_overflow = node_pointer();
+			n.m_coincident = false;
+			n.m_dirty = false;
+
+			for (int index = 0; index < number_of_points; ++index)
+			{
+				append(child(n, n.position(index)), n.m_points[index], n.position(index), m_pool);
+			}
+
+			while (overflow)
+			{
+				const node_pointer chunk = overflow;
+
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					append(child(n, chunk->position(index)), chunk->m_points[index], chunk->position(index), m_pool);
+				}
+
+				overflow = chunk->m_overflow;
+
+				chunk->m_overflow = node_pointer();
+
+				m_pool.release(chunk);
+			}
+		}
+
+		/**
+			Removes point_it from the tree. The point has to be where it was
+			when it was added (or last updated). Leaves left with few enough
+			points are merged with their siblings back into their parent
+			(see merge()).
+
+			Returns false if the point is not in the tree.
+		*/
+		inline bool remove(PointIterator point_it)
+		{
+			return remove(point_it, *point_it);
+		}
+
+		/**
+			Removes point_it, which was added at position. The inner nodes
+			passed on the way down are remembered and merged bottom up.
+		*/
+		inline bool remove(PointIterator point_it, const Point &position)
+		{
+			node *path[maximum_depth_limit + 1];
+
+			int depth = 0;
+
+			node *n = &*m_root;
+
+			for (;;)
+			{
+				if (false == n->point_intersects_boundary(position))
+				{
+					return false;
+				}
+
+				if (false == n->has_children())
+				{
+					break;
+				}
+
+				path[depth++] = n;
+
+				n = &child(*n, position);
+			}
+
+			node *chunk = 0;
+
+			const int index = find(*n, point_it, chunk);
+
+			if (-1 == index)
+			{
+				return false;
+			}
+
+			erase(*n, *chunk, index);
+
+			while (0 < depth)
+			{
+				node &inner = *path[--depth];
+
+				--inner.m_subtree_points;
+
+				merge(inner);
+			}
+
+			return true;
+		}
+
+		/**
+			Returns the index of point_it within the leaf n or its overflow
+			chain and sets chunk to the node holding it. Returns -1 if
+			point_it is not there.
+		*/
+		static inline int find(node &n, PointIterator point_it, node *&chunk)
+		{
+			for (chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					if (chunk->m_points[index] == point_it)
+					{
+						return index;
+					}
+				}
+			}
+
+			return -1;
+		}
+
+		/**
+			Removes the point at index in chunk, which is the leaf n or part
+			of its chain, by moving the most recently appended point there.
+			Chain nodes running empty are released.
+		*/
+		inline void erase(node &n, node &chunk, int index)
+		{
+			node &last = n.m_overflow ? *n.m_overflow : n;
+
+			--n.m_subtree_points;
+
+			chunk.assign(index, last, last.m_number_of_points - 1);
+
+			--last.m_number_of_points;
+
+			if (&last != &n && 0 == last.m_number_of_points)
+			{
+				const node_pointer empty = n.m_overflow;
+
+				n.m_overflow = empty->m_overflow;
+
+				empty->m_overflow = node_pointer();
+
+				m_pool.release(empty);
+			}
+
+			if (n.m_subtree_points <= static_cast<uint32_t>(leaf_capacity(n.m_depth)))
+			{
+				n.m_coincident = false;
+				n.m_dirty = false;
+			}
+		}
+
+		/**
+			Moves point_it to new_position. This must be called while the
+			point itself still is at its old position, i.e. before assigning
+			new_position to it. From then on the tree uses new_position.
+
+			If new_position is still within the leaf holding the point (the
+			common case for small motions) only the stored position is
+			changed. Otherwise the point is removed and added again. The
+			same happens to points in buckets of coincident points.
+
+			Returns false if the point is not in the tree or could not be
+			added at new_position (outside the root boundary or, with
+			CheckUniqueness, a duplicate), in which case it is not in the
+			tree afterwards.
+		*/
+		inline bool update(PointIterator point_it, const Point &new_position)
+		{
+			return update(point_it, *point_it, new_position);
+		}
+
+		/**
+			Moves point_it from old_position, where it was added or last
+			updated to, to new_position without dereferencing it
+		*/
+		bool update(PointIterator point_it, const Point &old_position, const Point &new_position)
+		{
+			node *n = &*m_root;
+
+			bool stays = point_intersects_boundary(new_position, n->m_boundary);
+
+			while (true == n->has_children())
+			{
+				stays = stays && (quadrant(n->m_center, old_position) == quadrant(n->m_center, new_position));
+
+				n = &child(*n, old_position);
+			}
+
+			node *chunk = 0;
+
+			const int index = find(*n, point_it, chunk);
+
+			if (-1 == index)
+			{
+				return false;
+			}
+
+			if
+			(
+				true == stays &&
+				false == n->m_coincident &&
+				(false == CheckUniqueness || false == contains_coordinates(*n, new_position))
+			)
+			{
+				chunk->m_coordinates[index] = new_position[0];
+				chunk->m_coordinates[NodeCapacity + index] = new_position[1];
+
+				return true;
+			}
+
+			remove(point_it, old_position);
+
+			return add(*m_root, point_it, new_position, 0);
+		}
+
+		/**
+			Moves all points of other into this tree and leaves other an
+			empty tree. Both trees must have the same boundary.
+
+			The nodes of other are taken over, not copied: Subtrees of
+			other falling onto empty leaves of this tree are grafted there
+			as they are. Where both trees have children meeting at the same
+			center the children are merged in turn. Only the points of the
+			remaining subtrees of other are added one by one. Trees built
+			with the midpoint split policy and the same limits line up all
+			the way down, so merging trees built from disjoint regions of
+			the boundary (e.g. shards of a data set) mostly grafts.
+
+			With different limits all points of other are added one by one
+			so the tree keeps to its own limits. With CheckUniqueness only
+			the added points are checked, grafted subtrees end up in empty
+			leaves and can not hold duplicates of points of this tree.
+		*/
+		void merge(point_quad_tree &other)
+		{
+			if (this == &other)
+			{
+				throw std::logic_error("A tree can not be merged into itself");
+			}
+
+			if (false == same_boundary(m_root->m_boundary, other.m_root->m_boundary))
+			{
+				throw std::runtime_error("Only trees with the same boundary can be merged");
+			}
+
+			check_room(m_root->m_subtree_points, other.m_root->m_subtree_points);
+
+			pool_type pool;
+
+			const node_pointer empty = pool.create(other.m_root->m_boundary);
+
+			m_pool.splice(other.m_pool);
+			other.m_pool.swap(pool);
+
+			const node_pointer root = other.m_root;
+
+			other.m_root = empty;
+
+			std::vector<node_pointer> leftovers;
+
+			if (true == same_limits(m_limits, other.m_limits))
+			{
+				graft(*m_root, root, leftovers);
+			}
+			else
+			{
+				leftovers.push_back(root);
+			}
+
+			for (size_t index = 0; index < leftovers.size(); ++index)
+			{
+				fixed_stack<const node*> stack;
+
+				stack.push(&*leftovers[index]);
+
+				while (false == stack.empty())
+				{
+					const node &n = *stack.pop();
+
+					if (true == n.has_children())
+					{
+						push_children(n, stack);
+						continue;
+					}
+
+					for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+					{
+						for (int point = 0; point < chunk->m_number_of_points; ++point)
+						{
+							add(*m_root, chunk->m_points[point], chunk->position(point), 0);
+						}
+					}
+				}
+
+				release_subtree(leftovers[index]);
+			}
+		}
+
+		/**
+			Moves the subtree at other, having the same boundary and depth
+			as start, into the subtree at start as far as it lines up with
+			it. The subtrees of other which do not line up are appended to
+			leftovers. The points grafted onto an empty leaf are added to
+			the counts of the lined up nodes above it, which path holds by
+			their depth below start.
+		*/
+		void graft(node &start, const node_pointer &start_other, std::vector<node_pointer> &leftovers)
+		{
+			node *path[maximum_depth_limit + 1];
+
+			fixed_stack<std::pair<node*, node_pointer> > stack;
+
+			stack.push(std::make_pair(&start, start_other));
+
+			while (false == stack.empty())
+			{
+				const std::pair<node*, node_pointer> entry = stack.pop();
+
+				node &n = *entry.first;
+
+				const node_pointer &other = entry.second;
+
+				const int level = n.m_depth - start.m_depth;
+
+				if (0 == other->m_subtree_points)
+				{
+					release_subtree(other);
+					continue;
+				}
+
+				if (false == n.has_children() && 0 == n.m_number_of_points)
+				{
+					n = *other;
+
+					m_pool.release(other);
+
+					for (int ancestor = 0; ancestor < level; ++ancestor)
+					{
+						path[ancestor]->m_subtree_points += n.m_subtree_points;
+					}
+
+					continue;
+				}
+
+				if
+				(
+					false == n.has_children() ||
+					false == other->has_children() ||
+					n.m_center[0] != other->m_center[0] ||
+					n.m_center[1] != other->m_center[1]
+				)
+				{
+					leftovers.push_back(other);
+					continue;
+				}
+
+				path[level] = &n;
+
+				stack.push(std::make_pair(&*n.m_south_east, other->m_south_east));
+				stack.push(std::make_pair(&*n.m_south_west, other->m_south_west));
+				stack.push(std::make_pair(&*n.m_north_east, other->m_north_east));
+				stack.push(std::make_pair(&*n.m_north_west, other->m_north_west));
+
+				m_pool.release(other);
+			}
+		}
+
+		inline void release_subtree(const node_pointer &n)
+		{
+			fixed_stack<node_pointer> stack;
+
+			stack.push(n);
+
+			while (false == stack.empty())
+			{
+				const node_pointer top = stack.pop();
+
+				if (true == top->has_children())
+				{
+					stack.push(top->m_south_east);
+					stack.push(top->m_south_west);
+					stack.push(top->m_north_east);
+					stack.push(top->m_north_west);
+				}
+
+				for (node_pointer chunk = top->m_overflow; chunk; chunk = chunk->m_overflow)
+				{
+					m_pool.release(chunk);
+				}
+
+				m_pool.release(top);
+			}
+		}
+
+		static inline bool same_boundary(const Boundary &a, const Boundary &b)
+		{
+			return
+			(
+				a.first[0] == b.first[0] &&
+				a.first[1] == b.first[1] &&
+				a.second[0] == b.second[0] &&
+				a.second[1] == b.second[1]
+			);
+		}
+
+		static inline bool same_limits(const split_limits &a, const split_limits &b)
+		{
+			return
+			(
+				a.m_maximum_depth == b.m_maximum_depth &&
+				a.m_minimum_cell_size == b.m_minimum_cell_size &&
+				a.m_policy == b.m_policy &&
+				a.m_capacity == b.m_capacity &&
+				a.m_bottom_capacity == b.m_bottom_capacity &&
+				a.m_bottom_depth == b.m_bottom_depth
+			);
+		}
+
+		/**
+			Returns *point_it, for refit() of trees with dereferenceable
+			point iterators
+		*/
+		struct dereferencing_position
+		{
+			inline const Point &operator()(PointIterator point_it) const
+			{
+				return *point_it;
+			}
+		};
+
+		/**
+			Brings the tree up to date after points moved, reading their
+			new positions through their iterators. This is meant for points
+			moving a short distance at a time: Points still within their
+			leaf only have their stored coordinates overwritten, points
+			that left it are removed and added again. Nodes are split when
+			added points overflow their leaves and merged when points moved
+			away, everything else is left as it is.
+
+			The result says how much of the tree changed. When most points
+			move far, building a new tree is faster.
+		*/
+		inline refit_statistics refit()
+		{
+			return refit(dereferencing_position());
+		}
+
+		/**
+			Like refit() with position(point_it) returning the new position
+			of point_it. This is how trees storing indices are refitted.
+		*/
+		template<class Position>
+		refit_statistics refit(Position position)
+		{
+			refit_statistics statistics;
+
+			std::vector<std::pair<PointIterator, Point> > moved;
+
+			std::vector<node*> interior;
+
+			node *path[maximum_depth_limit + 1];
+
+			fixed_stack<node*> stack;
+
+			stack.push(&*m_root);
+
+			while (false == stack.empty())
+			{
+				node &n = *stack.pop();
+
+				path[n.m_depth] = &n;
+
+				if (true == n.has_children())
+				{
+					interior.push_back(&n);
+
+					stack.push(&*n.m_south_east);
+					stack.push(&*n.m_south_west);
+					stack.push(&*n.m_north_east);
+					stack.push(&*n.m_north_west);
+					continue;
+				}
+
+				++statistics.m_leaves;
+				statistics.m_points += n.m_subtree_points;
+
+				bool rewritten = false;
+
+				bool shrunk = false;
+
+				node *chunk = &n;
+
+				int index = 0;
+
+				while (0 != chunk)
+				{
+					if (index == chunk->m_number_of_points)
+					{
+						chunk = chunk->next_chunk();
+						index = 0;
+						continue;
+					}
+
+					const Point new_position = position(chunk->m_points[index]);
+
+					if (chunk->x()[index] == new_position[0] && chunk->y()[index] == new_position[1])
+					{
+						++index;
+						continue;
+					}
+
+					/*
+						Like update() this moves all points of a bucket of
+						coincident points out and adds them again
+					*/
+					if
+					(
+						false == n.m_coincident &&
+						true == stays(path, n.m_depth, new_position) &&
+						(false == CheckUniqueness || false == contains_coordinates(n, new_position))
+					)
+					{
+						chunk->m_coordinates[index] = new_position[0];
+						chunk->m_coordinates[NodeCapacity + index] = new_position[1];
+
+						rewritten = true;
+
+						++index;
+						continue;
+					}
+
+					moved.push_back(std::make_pair(chunk->m_points[index], new_position));
+
+					shrunk = true;
+
+					/*
+						erase() moves the last point of the head chunk
+						n.m_overflow to index and releases the head chunk if
+						that empties it. The head comes right after n, so if
+						it is released it is the chunk being scanned, which
+						then has no points left, and the scan goes on with
+						the new head.
+					*/
+					const bool releases = chunk != &n && chunk == &*n.m_overflow && 1 == chunk->m_number_of_points;
+
+					erase(n, *chunk, index);
+
+					if (true == releases)
+					{
+						chunk = n.next_chunk();
+						index = 0;
+					}
+				}
+
+				statistics.m_shrunk_leaves += shrunk;
+				statistics.m_rewritten_leaves += (true == rewritten && false == shrunk);
+			}
+
+			for (size_t index = interior.size(); index > 0; --index)
+			{
+				node &n = *interior[index - 1];
+
+				n.m_subtree_points = n.m_north_west->m_subtree_points + n.m_north_east->m_subtree_points + n.m_south_west->m_subtree_points + n.m_south_east->m_subtree_points;
+
+				if (n.m_subtree_points <= static_cast<uint32_t>(leaf_capacity(n.m_depth)))
+				{
+					merge(n);
+
+					statistics.m_merged_nodes += (false == n.has_children());
+				}
+			}
+
+			statistics.m_moved = moved.size();
+
+			for (size_t index = 0; index < moved.size(); ++index)
+			{
+				statistics.m_lost += (false == add(*m_root, moved[index].first, moved[index].second, 0));
+			}
+
+			return statistics;
+		}
+
+		/**
+			Returns true if position is in the leaf path[depth], i.e. add()
+			would descend from the root path[0] through path to it
+		*/
+		static inline bool stays(node *const *path, int depth, const Point &position)
+		{
+			const Boundary &boundary = path[depth]->m_boundary;
+
+			if (false == point_intersects_boundary(position, boundary))
+			{
+				return false;
+			}
+
+			if
+			(
+				position[0] > boundary.first[0] && position[0] < boundary.second[0] &&
+				position[1] > boundary.first[1] && position[1] < boundary.second[1]
+			)
+			{
+				return true;
+			}
+
+			/*
+				Points on an edge shared with a neighbour may belong to it
+			*/
+			for (int level = 0; level < depth; ++level)
+			{
+				if (&child(*path[level], position) != path[level + 1])
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+			Returns the child of n that holds points at position. This
+			indexes the children by quadrant() without testing their
+			boundaries and without copying node pointers.
+		*/
+		static inline node &child(const node &n, const Point &position)
+		{
+			static node_pointer node::* const children[] = { &node::m_north_west, &node::m_north_east, &node::m_south_west, &node::m_south_east };
+
+			return *(n.*children[quadrant(n.m_center, position)]);
+		}
+
+		/**
+			The inverse of split(): If all children of n are leaves holding
+			no more than the leaf_capacity() of n together they are moved
+			into n and the children are released.
+		*/
+		inline void merge(node &n)
+		{
+			const node_pointer children[] = { n.m_north_west, n.m_north_east, n.m_south_west, n.m_south_east };
+
+			int number_of_points = 0;
+
+			for (int index = 0; index < 4; ++index)
+			{
+				if (true == children[index]->has_children() || children[index]->m_overflow)
+				{
+					return;
+				}
+
+				number_of_points += children[index]->m_number_of_points;
+			}
+
+			if (number_of_points > leaf_capacity(n.m_depth))
+			{
+				return;
+			}
+
+			n.m_north_west = n.m_north_east = n.m_south_west = n.m_south_east = node_pointer();
+
+			for (int index = 0; index < 4; ++index)
+			{
+				const node &c = *children[index];
+
+				for (int point = 0; point < c.m_number_of_points; ++point)
+				{
+					n.push_back(c.m_points[point], c.position(point));
+				}
+
+				m_pool.release(children[index]);
+			}
+		}
+
+		static inline Point center(const Boundary &boundary)
+		{
+			Point center;
+
+			center[0] = coordinate_traits<coordinate_type>::midpoint(boundary.first[0], boundary.second[0]);
+			center[1] = coordinate_traits<coordinate_type>::midpoint(boundary.first[1], boundary.second[1]);
+
+			return center;
+		}
+
+		/**
+			Returns the index of the child of a node with the given center
+			that add() hands point to: 0 for north west, 1 for north east,
+			2 for south west and 3 for south east. Points on an edge
+			belong to the west/north side.
+		*/
+		static inline int quadrant(const Point &center, const Point &point)
+		{
+			return (point[0] > center[0] ? 1 : 0) | (point[1] > center[1] ? 2 : 0);
+		}
+
+		/**
+			Returns where the leaf n is to be split according to the split
+			policy of the tree
+		*/
+		inline Point split_center(const node &n)
+		{
+			if (midpoint_split == m_limits.m_policy)
+			{
+				return quad_tree_t::center(n.m_boundary);
+			}
+
+			m_split_positions.clear();
+
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					m_split_positions.push_back(chunk->position(index));
+				}
+			}
+
+			return split_center(n.m_boundary, m_split_positions.begin(), m_split_positions.end(), m_limits);
+		}
+
+		static inline coordinate_type coordinate(const Point &position, int dimension)
+		{
+			return position[dimension];
+		}
+
+		/**
+			Orders points or morton entries by one of their coordinates
+		*/
+		struct coordinate_less
+		{
+			int m_dimension;
+
+			coordinate_less(int dimension)
+			:
+				m_dimension(dimension)
+			{
+
+			}
+
+			template<class Element>
+			inline bool operator()(const Element &a, const Element &b) const
+			{
+				return coordinate(a, m_dimension) < coordinate(b, m_dimension);
+			}
+		};
+
+		/**
+			Returns the point to split boundary at for the points or morton
+			entries in [begin, end) (which are reordered) under limits. In
+			every dimension the split separates the smallest of the
+			coordinates from the largest, as points at the split belong to
+			the west/north side.
+		*/
+		template<class RandomAccessIterator>
+		static inline Point split_center(const Boundary &boundary, RandomAccessIterator begin, RandomAccessIterator end, const split_limits &limits)
+		{
+			Point center = quad_tree_t::center(boundary);
+
+			const size_t count = end - begin;
+
+			for (int dimension = 0; dimension < 2 && 0 != count; ++dimension)
+			{
+				const coordinate_less less(dimension);
+
+				const std::pair<RandomAccessIterator, RandomAccessIterator> extremes = std::minmax_element(begin, end, less);
+
+				const coordinate_type low = coordinate(*extremes.first, dimension);
+				const coordinate_type high = coordinate(*extremes.second, dimension);
+
+				if (low == high)
+				{
+					continue;
+				}
+
+				coordinate_type split;
+
+				if (median_split == limits.m_policy)
+				{
+					std::nth_element(begin, begin + (count - 1) / 2, end, less);
+
+					split = coordinate(begin[(count - 1) / 2], dimension);
+				}
+				else
+				{
+					double sum = 0;
+
+					for (RandomAccessIterator it = begin; it != end; ++it)
+					{
+						sum += coordinate(*it, dimension);
+					}
+
+					split = std::max(low, static_cast<coordinate_type>(sum / count));
+				}
+
+				if (false == (split < high))
+				{
+					split = coordinate_traits<coordinate_type>::midpoint(low, high);
+				}
+
+				const double first = boundary.first[dimension];
+				const double second = boundary.second[dimension];
+
+				if
+				(
+					boundary.first[dimension] < split && split < boundary.second[dimension] &&
+					static_cast<double>(split) - first >= limits.m_minimum_cell_size &&
+					second - static_cast<double>(split) >= limits.m_minimum_cell_size
+				)
+				{
+					center[dimension] = split;
+				}
+			}
+
+			return center;
+		}
+
+		/**
+			Turns the leaf n into an interior node with four empty children
+			without touching its points
+		*/
+		inline void create_children(node &n, const Point &center)
+		{
+			create_children(n, center, m_pool);
+		}
+
+		inline void create_children(node &n, const Point &center, pool_type &pool)
+		{
+			n.m_center = center;
+			
+			n.m_north_west = pool.create(child_boundary(n.m_boundary, center, 0));
+			n.m_north_east = pool.create(child_boundary(n.m_boundary, center, 1));
+			n.m_south_west = pool.create(child_boundary(n.m_boundary, center, 2));
+			n.m_south_east = pool.create(child_boundary(n.m_boundary, center, 3));
+
+			n.m_north_west->m_depth = n.m_north_east->m_depth = n.m_south_west->m_depth = n.m_south_east->m_depth = n.m_depth + 1;
+		}
+			
+		/**
+			Returns the boundary of the child with the given index (see
+			quadrant()) of a node with the given boundary and center
+		*/
+		static inline Boundary child_boundary(const Boundary &boundary, const Point &center, int quadrant)
+		{
+			Boundary child(boundary.first, center);
+
+			if (0 != (quadrant & 1))
+			{
+				child.first[0] = center[0];
+				child.second[0] = boundary.second[0];
+			}
+
+			if (0 != (quadrant & 2))
+			{
+				child.first[1] = center[1];
+				child.second[1] = boundary.second[1];
+			}
+
+			return child;
+		}
+			
+		/*
+			A point together with its position along the Z-order curve
+			through the root boundary. The coordinates are copied so that
+			building never dereferences m_point.
+		*/
+		struct morton_entry
+		{
+			uint32_t m_key;
+
+			PointIterator m_point;
+
+			Point m_position;
+		};
+
+		/**
+			Interleaves the bits of the 16 bit cell coordinates x and y with
+			x in the even bits. Sorting by the result orders points north
+			west, north east, south west and south east at every level,
+			just like the children.
+		*/
+		static inline uint32_t morton_key(uint32_t x, uint32_t y)
+		{
+			x = (x | (x << 8)) & 0x00ff00ff;
+			x = (x | (x << 4)) & 0x0f0f0f0f;
+			x = (x | (x << 2)) & 0x33333333;
+			x = (x | (x << 1)) & 0x55555555;
+
+			y = (y | (y << 8)) & 0x00ff00ff;
+			y = (y | (y << 4)) & 0x0f0f0f0f;
+			y = (y | (y << 2)) & 0x33333333;
+			y = (y | (y << 1)) & 0x55555555;
+
+			return x | (y << 1);
+		}
+
+		/**
+			Maps coordinate within [low, high] to a 16 bit cell index
+		*/
+		static inline uint32_t morton_cell(coordinate_type coordinate, coordinate_type low, coordinate_type high)
+		{
+			return coordinate_traits<coordinate_type>::cell(coordinate, low, high);
+		}
+
+		/**
+			Sorts entries by key with a stable LSD radix sort using
+			temporary as a buffer of the same size. Passes over bytes in
+			which all keys agree are skipped.
+		*/
+		static void radix_sort(std::vector<morton_entry> &entries, std::vector<morton_entry> &temporary)
+		{
+			temporary.resize(entries.size());
+
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				size_t counts[257] = { 0 };
+
+				for (size_t index = 0; index < entries.size(); ++index)
+				{
+					++counts[((entries[index].m_key >> shift) & 0xff) + 1];
+				}
+
+				if (counts[((entries[0].m_key >> shift) & 0xff) + 1] == entries.size())
+				{
+					continue;
+				}
+
+				for (int bucket = 0; bucket < 256; ++bucket)
+				{
+					counts[bucket + 1] += counts[bucket];
+				}
+
+				for (size_t index = 0; index < entries.size(); ++index)
+				{
+					temporary[counts[(entries[index].m_key >> shift) & 0xff]++] = entries[index];
+				}
+
+				entries.swap(temporary);
+			}
+		}
+
+		struct coordinates_less
+		{
+			inline bool operator()(const morton_entry &a, const morton_entry &b) const
+			{
+				return a.m_position[0] < b.m_position[0] || (a.m_position[0] == b.m_position[0] && a.m_position[1] < b.m_position[1]);
+			}
+		};
+
+		struct coordinates_equal
+		{
+			inline bool operator()(const morton_entry &a, const morton_entry &b) const
+			{
+				return a.m_position[0] == b.m_position[0] && a.m_position[1] == b.m_position[1];
+			}
+		};
+
+		/**
+			Removes all but the first of each group of points with identical
+			coordinates from entries sorted by key. Identical points have
+			identical keys, so only runs of equal keys need looking at.
+		*/
+		static void remove_duplicates(std::vector<morton_entry> &entries)
+		{
+			typename std::vector<morton_entry>::iterator out = entries.begin();
+
+			for (typename std::vector<morton_entry>::iterator run = entries.begin(); run != entries.end();)
+			{
+				typename std::vector<morton_entry>::iterator run_end = run + 1;
+
+				while (run_end != entries.end() && run_end->m_key == run->m_key)
+				{
+					++run_end;
+				}
+
+				std::stable_sort(run, run_end, coordinates_less());
+
+				out = std::copy(run, std::unique(run, run_end, coordinates_equal()), out);
+
+				run = run_end;
+			}
+
+			entries.erase(out, entries.end());
+		}
+
+		/**
+			Adds all points in the range to the empty tree in one pass
+			instead of descending from the root once per point.
+
+			The points are sorted along the Z-order curve through the root
+			boundary, so that the points of every node end up in one
+			contiguous range. Nodes are then created top down directly from
+			these ranges. Keys are only an approximation of the quadrant
+			a point belongs to near the edges of the cells, so every range
+			is checked against quadrant() and fixed up if needed. The
+			resulting tree has the same nodes as the one add() would build.
+
+			With number_of_threads > 1 the nodes down to parallel_depth are
+			created on the calling thread and the subtrees below them are
+			then built concurrently, each thread allocating from its own
+			pool. A parallel_depth of 0 picks a depth giving every thread a
+			handful of subtrees.
+		*/
+		void bulk_load
+		(
+			PointIterator points_begin,
+			PointIterator points_end,
+			unsigned number_of_threads = 1,
+			int parallel_depth = 0
+		)
+		{
+			std::vector<morton_entry> entries;
+
+			for (PointIterator it = points_begin; it != points_end; ++it)
+			{
+				add_entry(entries, it, *it);
+			}
+
+			load_entries(entries, number_of_threads, parallel_depth);
+		}
+
+		/**
+			Like bulk_load() but for trees storing indices instead of
+			iterators (see the note on PointIterator): The point at
+			points_begin + i is stored as PointIterator(i).
+		*/
+		template<class RandomAccessIterator>
+		void bulk_load_indices
+		(
+			RandomAccessIterator points_begin,
+			RandomAccessIterator points_end,
+			unsigned number_of_threads = 1,
+			int parallel_depth = 0
+		)
+		{
+			std::vector<morton_entry> entries;
+
+			for (RandomAccessIterator it = points_begin; it != points_end; ++it)
+			{
+				add_entry(entries, static_cast<PointIterator>(it - points_begin), *it);
+			}
+
+			load_entries(entries, number_of_threads, parallel_depth);
+		}
+
+		/**
+			Appends the entry for the point at position to entries unless
+			it lies outside the root boundary
+		*/
+		inline void add_entry(std::vector<morton_entry> &entries, PointIterator point_it, const Point &position) const
+		{
+			const Boundary &boundary = m_root->m_boundary;
+
+			if (false == point_intersects_boundary(position, boundary))
+			{
+				return;
+			}
+
+			morton_entry entry;
+
+			entry.m_key = morton_key
+			(
+				morton_cell(position[0], boundary.first[0], boundary.second[0]),
+				morton_cell(position[1], boundary.first[1], boundary.second[1])
+			);
+
+			entry.m_point = point_it;
+			entry.m_position = position;
+
+			entries.push_back(entry);
+		}
+
+		/**
+			The part of bulk_load() after collecting the entries
+		*/
+		void load_entries(std::vector<morton_entry> &entries, unsigned number_of_threads, int parallel_depth)
+		{
+			if (true == m_root->has_children() || 0 != m_root->m_number_of_points)
+			{
+				throw std::logic_error("bulk_load() requires an empty tree");
+			}
+
+			if (true == entries.empty())
+			{
+				return;
+			}
+
+			check_room(0, entries.size());
+
+			std::vector<morton_entry> temporary;
+
+			radix_sort(entries, temporary);
+
+			if (true == CheckUniqueness)
+			{
+				remove_duplicates(entries);
+			}
+
+			morton_entry *begin = &entries[0];
+			morton_entry *end = begin + entries.size();
+
+			if (number_of_threads <= 1)
+			{
+				build(*m_root, begin, end, &temporary[0], m_pool, 0);
+				return;
+			}
+
+			if (parallel_depth <= 0)
+			{
+				for (parallel_depth = 1; (1u << (2 * parallel_depth)) < 8 * number_of_threads; ++parallel_depth)
+				{
+
+				}
+			}
+
+			std::vector<build_task> tasks;
+
+			prepare_build(*m_root, begin, end, &temporary[0], 0, parallel_depth, tasks);
+
+			std::sort(tasks.begin(), tasks.end(), larger_task());
+
+			std::atomic<size_t> next_task(0);
+
+			std::vector<boost::shared_ptr<pool_type> > pools;
+
+			std::vector<std::exception_ptr> errors(number_of_threads);
+
+			std::vector<std::thread> threads;
+
+			for (unsigned thread = 0; thread < number_of_threads; ++thread)
+			{
+				pools.push_back(boost::shared_ptr<pool_type>(new pool_type));
+			}
+
+			threads.reserve(number_of_threads - 1);
+
+			try
+			{
+				for (unsigned thread = 1; thread < number_of_threads; ++thread)
+				{
+					threads.push_back(std::thread(build_worker(*this, tasks, next_task, *pools[thread], errors[thread])));
+				}
+			}
+			catch (...)
+			{
+				/*
+					The workers already started may have built subtrees
+					from their pools into the tree
+				*/
+				join_and_splice(threads, pools);
+				throw;
+			}
+
+			build_worker(*this, tasks, next_task, *pools[0], errors[0])();
+
+			join_and_splice(threads, pools);
+
+			for (unsigned thread = 0; thread < number_of_threads; ++thread)
+			{
+				if (errors[thread])
+				{
+					std::rethrow_exception(errors[thread]);
+				}
+			}
+		}
+
+		/**
+			Waits for the build workers and takes over the nodes they
+			created
+		*/
+		inline void join_and_splice(std::vector<std::thread> &threads, std::vector<boost::shared_ptr<pool_type> > &pools)
+		{
+			for (size_t thread = 0; thread < threads.size(); ++thread)
+			{
+				threads[thread].join();
+			}
+
+			for (size_t thread = 0; thread < pools.size(); ++thread)
+			{
+				m_pool.splice(*pools[thread]);
+			}
+		}
+
+		/*
+			A leaf created by prepare_build() and the points still to be
+			built below it
+		*/
+		struct build_task
+		{
+			node *m_node;
+
+			morton_entry *m_begin;
+
+			morton_entry *m_end;
+
+			morton_entry *m_temporary;
+
+			int m_depth;
+		};
+
+		struct larger_task
+		{
+			inline bool operator()(const build_task &a, const build_task &b) const
+			{
+				return (a.m_end - a.m_begin) > (b.m_end - b.m_begin);
+			}
+		};
+
+		/*
+			Builds tasks until none are left, allocating from its own pool
+		*/
+		struct build_worker
+		{
+			quad_tree_t &m_tree;
+
+			const std::vector<build_task> &m_tasks;
+
+			std::atomic<size_t> &m_next_task;
+
+			pool_type &m_pool;
+
+			std::exception_ptr &m_error;
+
+			build_worker
+			(
+				quad_tree_t &tree,
+				const std::vector<build_task> &tasks,
+				std::atomic<size_t> &next_task,
+				pool_type &pool,
+				std::exception_ptr &error
+			)
+			:
+				m_tree(tree),
+				m_tasks(tasks),
+				m_next_task(next_task),
+				m_pool(pool),
+				m_error(error)
+			{
+
+			}
+
+			void operator()()
+			{
+				try
+				{
+					for (size_t task = m_next_task++; task < m_tasks.size(); task = m_next_task++)
+					{
+						const build_task &t = m_tasks[task];
+
+						m_tree.build(*t.m_node, t.m_begin, t.m_end, t.m_temporary, m_pool, t.m_depth);
+					}
+				}
+				catch (...)
+				{
+					m_error = std::current_exception();
+				}
+			}
+		};
+
+		/**
+			Like build() but stops levels levels below n (which is at depth)
+			and records the leaves there as tasks instead
+		*/
+		void prepare_build
+		(
+			node &n,
+			morton_entry *begin,
+			morton_entry *end,
+			morton_entry *temporary,
+			int depth,
+			int levels,
+			std::vector<build_task> &tasks
+		)
+		{
+			if (0 == levels || false == splits(n, begin, end, depth))
+			{
+				build_task task = { &n, begin, end, temporary, depth };
+
+				tasks.push_back(task);
+
+				return;
+			}
+
+			create_children(n, split_center(n, begin, end, temporary));
+
+			n.m_subtree_points = static_cast<uint32_t>(end - begin);
+
+			size_t counts[5];
+
+			partition(n, begin, end, temporary, counts);
+
+			prepare_build(*n.m_north_west, begin + counts[0], begin + counts[1], temporary + counts[0], depth + 1, levels - 1, tasks);
+			prepare_build(*n.m_north_east, begin + counts[1], begin + counts[2], temporary + counts[1], depth + 1, levels - 1, tasks);
+			prepare_build(*n.m_south_west, begin + counts[2], begin + counts[3], temporary + counts[2], depth + 1, levels - 1, tasks);
+			prepare_build(*n.m_south_east, begin + counts[3], begin + counts[4], temporary + counts[3], depth + 1, levels - 1, tasks);
+		}
+
+		/**
+			Fills the empty leaf n at depth with the points in [begin, end),
+			splitting it as long as they do not fit and add() would split
+			it. Nodes are allocated from pool. temporary must provide as
+			much space as the range and is not touched outside of it.
+		*/
+		void build(node &n, morton_entry *begin, morton_entry *end, morton_entry *temporary, pool_type &pool, int depth)
+		{
+			if (false == splits(n, begin, end, depth))
+			{
+				for (morton_entry *entry = begin; entry != end; ++entry)
+				{
+					append(n, entry->m_point, entry->m_position, pool);
+				}
+
+				n.m_coincident = end - begin > leaf_capacity(depth) && coincides(n, begin->m_position);
+
+				return;
+			}
+
+			create_children(n, split_center(n, begin, end, temporary), pool);
+
+			n.m_subtree_points = static_cast<uint32_t>(end - begin);
+
+			size_t counts[5];
+
+			partition(n, begin, end, temporary, counts);
+
+			build(*n.m_north_west, begin + counts[0], begin + counts[1], temporary + counts[0], pool, depth + 1);
+			build(*n.m_north_east, begin + counts[1], begin + counts[2], temporary + counts[1], pool, depth + 1);
+			build(*n.m_south_west, begin + counts[2], begin + counts[3], temporary + counts[2], pool, depth + 1);
+			build(*n.m_south_east, begin + counts[3], begin + counts[4], temporary + counts[3], pool, depth + 1);
+		}
+
+		/**
+			Returns true if the leaf n at depth has to be split to hold the
+			points in [begin, end), i.e. they do not fit, do not all have
+			the same coordinates and n may be split
+		*/
+		bool splits(const node &n, const morton_entry *begin, const morton_entry *end, int depth) const
+		{
+			if (end - begin <= leaf_capacity(depth) || false == can_split(n, depth))
+			{
+				return false;
+			}
+
+			const Point &first = begin->m_position;
+
+			for (const morton_entry *entry = begin + 1; entry != end; ++entry)
+			{
+				if (entry->m_position[0] != first[0] || entry->m_position[1] != first[1])
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		static inline coordinate_type coordinate(const morton_entry &entry, int dimension)
+		{
+			return entry.m_position[dimension];
+		}
+
+		/**
+			Returns where the bulk build splits n holding [begin, end). The
+			entries are copied to temporary, which must provide as much
+			space as the range, to be reordered there.
+		*/
+		inline Point split_center(const node &n, const morton_entry *begin, const morton_entry *end, morton_entry *temporary) const
+		{
+			if (midpoint_split == m_limits.m_policy)
+			{
+				return quad_tree_t::center(n.m_boundary);
+			}
+
+			std::copy(begin, end, temporary);
+
+			return split_center(n.m_boundary, temporary, temporary + (end - begin), m_limits);
+		}
+
+		/**
+			Orders [begin, end) by the child of n each point belongs to and
+			stores the offset of the range of child i in counts[i], with
+			counts[4] being the size of the entire range
+		*/
+		void partition(const node &n, morton_entry *begin, morton_entry *end, morton_entry *temporary, size_t counts[5]) const
+		{
+			const Point &center = n.m_center;
+
+			std::fill(counts, counts + 5, 0);
+
+			bool sorted = true;
+
+			int previous = 0;
+
+			for (morton_entry *entry = begin; entry != end; ++entry)
+			{
+				const int child = quadrant(center, entry->m_position);
+
+				sorted = sorted && (child >= previous);
+
+				previous = child;
+
+				++counts[child + 1];
+			}
+
+			for (int child = 0; child < 4; ++child)
+			{
+				counts[child + 1] += counts[child];
+			}
+
+			if (true == sorted)
+			{
+				return;
+			}
+
+			size_t positions[4] = { counts[0], counts[1], counts[2], counts[3] };
+
+			for (morton_entry *entry = begin; entry != end; ++entry)
+			{
+				temporary[positions[quadrant(center, entry->m_position)]++] = *entry;
+			}
+
+			std::copy(temporary, temporary + (end - begin), begin);
+		}
+
+		/**
+			Returns true if the leaf n or its overflow chain already holds a
+			point with the coordinates of point
+		*/
+		inline bool contains_coordinates(const node &n, const Point &point) const
+		{
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					if (chunk->x()[index] == point[0] && chunk->y()[index] == point[1])
+					{
+						return true;
+					}
+				}
+			}
+			
+			return false;
+		}
+
+		/**
+			Calls visitor(point_it) for every point within range (the
+			boundary is inclusive). Subtrees not intersecting range are
+			skipped and subtrees completely inside it are reported without
+			testing their points. Nothing is allocated.
+		*/
+		template<class Visitor>
+		inline void visit_range(const Boundary &range, Visitor &visitor) const
+		{
+			visit_range(*m_root, range, visitor);
+		}
+
+		template<class Visitor>
+		inline void visit_range(const node &start, const Boundary &range, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				if (false == n.boundary_intersects(range))
+				{
+					continue;
+				}
+
+				if (true == n.boundary_is_inside(range))
+				{
+					visit_all(n, visitor);
+					continue;
+				}
+
+				if (true == n.m_dirty)
+				{
+					refine_touched(n);
+				}
+
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+					continue;
+				}
+
+				visit_leaf_range(n, range, visitor);
+			}
+		}
+
+		/**
+			Pushes the children of n so that they are popped in the order
+			north west, north east, south west, south east
+		*/
+		static inline void push_children(const node &n, fixed_stack<const node*> &stack)
+		{
+			stack.push(&*n.m_south_east);
+			stack.push(&*n.m_south_west);
+			stack.push(&*n.m_north_east);
+			stack.push(&*n.m_north_west);
+		}
+
+		/**
+			Calls visitor(point_it) for every point of the leaf n (including
+			its overflow chain) within range. The points are tested 64 at a
+			time with interval_filter.
+		*/
+		template<class Visitor>
+		inline void visit_leaf_range(const node &n, const Boundary &range, Visitor &visitor) const
+		{
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				FPS_QUAD_TREE_COUNT(m_points_tested, chunk->m_number_of_points);
+
+				for (int base = 0; base < chunk->m_number_of_points; base += 64)
+				{
+					const int count = std::min(64, chunk->m_number_of_points - base);
+
+					uint64_t mask = boundary_mask<interval_filter>(chunk->x() + base, chunk->y() + base, count, range);
+
+					while (0 != mask)
+					{
+						visitor(chunk->m_points[base + lowest_bit(mask)]);
+
+						mask &= mask - 1;
+					}
+				}
+			}
+		}
+
+		/**
+			Calls visitor(point_it) for every point in the subtree at n
+		*/
+		template<class Visitor>
+		inline void visit_all(const node &start, Visitor &visitor) const
+		{
+			fixed_stack<const node*> stack;
+
+			stack.push(&start);
+
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
+
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+					continue;
+				}
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					for (int index = 0; index < chunk->m_number_of_points; ++index)
+					{
+						visitor(chunk->m_points[index]);
+					}
+				}
+			}
+		}
+
+		/**
+			Writes the iterators of all points within range to out and
+			returns the advanced output iterator.
+		*/
+		template<class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			visit_range(range, visitor);
+
+			return visitor.m_out;
+		}
+
+		/**
+			Like query_range() for trees storing indices: Writes
+			points_begin + index to out for every point within range
+		*/
+		template<class RandomAccessIterator, class OutputIterator>
+		inline OutputIterator query_range(const Boundary &range, RandomAccessIterator points_begin, OutputIterator out) const
+		{
+			output_visitor<OutputIterator> visitor(out);
+
+			resolving_visitor<RandomAccessIterator, output_visitor<OutputIterator> > resolver(points_begin, visitor);
+
+			visit_range(range, resolver);
+
+			return visitor.m_out;
+		}
+
+		/**
+			@brief The working memory of query_ranges().
+
+			Keep one of these around and pass it to every call to avoid
+			reallocating. A scratch object must not be used by two batches at
+			the same time.
+		*/
+		struct batch_scratch
+		{
+			/*
+				The indices of the queries still active at each node on the
+				current path. The queries of a node are appended behind those
+				of its parent.
+			*/
+			std::vector<uint32_t> m_active;
+
+			/*
+				(query index, point) for every match in traversal order
+			*/
+			std::vector<std::pair<uint32_t, PointIterator> > m_matches;
+		};
+
+		/**
+			Answers number_of_ranges range queries in a single traversal.
+
+			Each node is visited once for all queries intersecting it, so its
+			data is loaded into the cache once per batch instead of once per
+			query. Afterwards the matches of query i are
+			results[offsets[i]] to results[offsets[i + 1] - 1] in the order
+			query_range() would report them, with offsets having
+			number_of_ranges + 1 entries. Both vectors are overwritten and only
+			reallocated when they need to grow.
+		*/
+		void query_ranges
+		(
+			const Boundary *ranges,
+			size_t number_of_ranges,
+			std::vector<size_t> &offsets,
+			std::vector<PointIterator> &results,
+			batch_scratch &scratch
+		) const
+		{
+			scratch.m_active.clear();
+			scratch.m_matches.clear();
+
+			for (size_t query = 0; query < number_of_ranges; ++query)
+			{
+				scratch.m_active.push_back(static_cast<uint32_t>(query));
+			}
+
+			visit_ranges(*m_root, ranges, 0, number_of_ranges, scratch);
+
+			offsets.assign(number_of_ranges + 1, 0);
+
+			for (size_t match = 0; match < scratch.m_matches.size(); ++match)
+			{
+				++offsets[scratch.m_matches[match].first + 1];
+			}
+
+			for (size_t query = 0; query < number_of_ranges; ++query)
+			{
+				offsets[query + 1] += offsets[query];
+			}
+
+			results.resize(scratch.m_matches.size());
+
+			/*
+				Use the start offsets as insert positions and shift them back
+				afterwards
+			*/
+			for (size_t match = 0; match < scratch.m_matches.size(); ++match)
+			{
+				results[offsets[scratch.m_matches[match].first]++] = scratch.m_matches[match].second;
+			}
+
+			for (size_t query = number_of_ranges; query > 0; --query)
+			{
+				offsets[query] = offsets[query - 1];
+			}
+
+			offsets[0] = 0;
+		}
+
+		/*
+			Records every point it sees as a match of one query
+		*/
+		struct match_visitor
+		{
+			std::vector<std::pair<uint32_t, PointIterator> > &m_matches;
+
+			uint32_t m_query;
+
+			match_visitor(std::vector<std::pair<uint32_t, PointIterator> > &matches, uint32_t query)
+			:
+				m_matches(matches),
+				m_query(query)
+			{
+
+			}
+
+			inline void operator()(PointIterator point_it)
+			{
+				m_matches.push_back(std::make_pair(m_query, point_it));
+			}
+		};
+
+		/*
+			A node visit_ranges() still has to visit with the queries
+			active at it
+		*/
+		struct range_frame
+		{
+			const node *m_node;
+
+			size_t m_active_begin;
+
+			size_t m_active_end;
+
+			range_frame()
+			:
+				m_node(0),
+				m_active_begin(0),
+				m_active_end(0)
+			{
+
+			}
+
+			range_frame(const node *n, size_t active_begin, size_t active_end)
+			:
+				m_node(n),
+				m_active_begin(active_begin),
+				m_active_end(active_end)
+			{
+
+			}
+		};
+
+		/**
+			The queries active at start are scratch.m_active[active_begin] to
+			scratch.m_active[active_end - 1]. Each node appends the queries
+			intersecting it to scratch.m_active for its children. Since the
+			nodes are visited depth first, everything past the active queries
+			of a node popped from the stack belongs to subtrees already done
+			and is dropped.
+		*/
+		void visit_ranges
+		(
+			const node &start,
+			const Boundary *ranges,
+			size_t active_begin,
+			size_t active_end,
+			batch_scratch &scratch
+		) const
+		{
+			std::vector<uint32_t> &active = scratch.m_active;
+
+			fixed_stack<range_frame> stack;
+
+			stack.push(range_frame(&start, active_begin, active_end));
+
+			while (false == stack.empty())
+			{
+				const range_frame frame = stack.pop();
+
+				const node &n = *frame.m_node;
+
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				active.resize(frame.m_active_end);
+
+				const size_t intersecting_begin = active.size();
+
+				for (size_t index = frame.m_active_begin; index < frame.m_active_end; ++index)
 				{
-					boundary.first[0] = p[0];
+					const uint32_t query = active[index];
+
+					if (false == n.boundary_intersects(ranges[query]))
+					{
+						continue;
+					}
+
+					if (true == n.boundary_is_inside(ranges[query]))
+					{
+						match_visitor visitor(scratch.m_matches, query);
+
+						visit_all(n, visitor);
+
+						continue;
+					}
+
+					active.push_back(query);
 				}
-				
-				if (p[1] < boundary.first[1])
+
+				const size_t intersecting_end = active.size();
+
+				if (intersecting_begin == intersecting_end)
 				{
-					boundary.first[1] = p[1];
+					continue;
 				}
 
-				if (p[0] > boundary.second[0])
+				if (true == n.m_dirty)
 				{
-					boundary.second[0] = p[0];
+					refine_touched(n);
 				}
-				
-				if (p[1] > boundary.second[1])
+
+				if (true == n.has_children())
 				{
-					boundary.second[1] = p[1];
+					stack.push(range_frame(&*n.m_south_east, intersecting_begin, intersecting_end));
+					stack.push(range_frame(&*n.m_south_west, intersecting_begin, intersecting_end));
+					stack.push(range_frame(&*n.m_north_east, intersecting_begin, intersecting_end));
+					stack.push(range_frame(&*n.m_north_west, intersecting_begin, intersecting_end));
+
+					continue;
+				}
+
+				for (size_t index = intersecting_begin; index < intersecting_end; ++index)
+				{
+					match_visitor visitor(scratch.m_matches, active[index]);
+
+					visit_leaf_range(n, ranges[active[index]], visitor);
 				}
 			}
-			
-			m_boundary = boundary;
-			
-			check_boundary();
-			
-			add(points_begin, points_end);
-		}
-		
-		point_quad_tree
-		(
-			const Boundary &boundary,
-			PointIterator points_begin,
-			PointIterator points_end
-		) 
-		:
-			m_boundary(boundary),
-			m_level(0)
-		{
-			// std::cout << "quad_tree(boundary, it, it) with boundary: " << boundary.first[0] << " " << boundary.first[1] << " " << boundary.second[0] << " " << boundary.second[1] << std::endl;
-			
-			check_boundary();
+
+			active.resize(active_end);
 		}
-		
-		point_quad_tree
-		(
-			const Boundary &boundary
-		) 
-		:
-			m_boundary(boundary),
-			m_level(0)
+
+		typedef distance_entry<const node*> node_entry;
+
+		typedef distance_entry<PointIterator> point_entry;
+
+		/**
+			@brief The working memory of nearest().
+
+			Keep one of these around and pass it to every call to avoid
+			reallocating the heaps for each query. A scratch object must not
+			be used by two queries at the same time.
+		*/
+		struct nearest_scratch
 		{
-			// std::cout << "quad_tree(boundary) with boundary: " << boundary.first[0] << " " << boundary.first[1] << " " << boundary.second[0] << " " << boundary.second[1] << std::endl;
-			
-			check_boundary();
-		}
-		
-		inline void check_boundary() const
+			/*
+				Min heap of nodes still to visit ordered by their minimum
+				distance to the query point
+			*/
+			std::vector<node_entry> m_nodes;
+
+			/*
+				Max heap of the best points found so far
+			*/
+			std::vector<point_entry> m_points;
+		};
+
+		static inline double squared_distance(const Point &a, const Point &b)
 		{
-			if 
-			(
-				m_boundary.first[0] == m_boundary.second[0] ||
-				m_boundary.first[1] == m_boundary.second[1]
-			)
-			{
-				throw std::runtime_error("Degenerate boundary");
-			}
+			const double dx = static_cast<double>(a[0]) - static_cast<double>(b[0]);
+			const double dy = static_cast<double>(a[1]) - static_cast<double>(b[1]);
 
-			if 
-			(
-				m_boundary.first[0] > m_boundary.second[0] ||
-				m_boundary.first[1] > m_boundary.second[1] 
-			)
-			{
-				throw std::runtime_error("Order of boundary points not preserved");
-			}
+			return dx * dx + dy * dy;
 		}
-		
-		inline void add(PointIterator points_begin, PointIterator points_end)
+
+		/**
+			Returns the squared distance from point to the closest point
+			of the boundary (0 if point lies within)
+		*/
+		static inline double squared_distance(const Point &point, const Boundary &boundary)
 		{
-			for (PointIterator it = points_begin; it != points_end; ++it)
+			double distance = 0;
+
+			for (int dimension = 0; dimension < 2; ++dimension)
 			{
-				add(it);
+				const double coordinate = static_cast<double>(point[dimension]);
+
+				double delta = 0;
+
+				if (coordinate < static_cast<double>(boundary.first[dimension]))
+				{
+					delta = static_cast<double>(boundary.first[dimension]) - coordinate;
+				}
+				else if (coordinate > static_cast<double>(boundary.second[dimension]))
+				{
+					delta = coordinate - static_cast<double>(boundary.second[dimension]);
+				}
+
+				distance += delta * delta;
 			}
+
+			return distance;
 		}
-		
+
 		/**
-			Returns true if the point was added to this node
-			or one of its children
+			Writes the iterators of the (up to) k points closest to point to
+			out, closest first, and returns the advanced output iterator.
+
+			Nodes are visited best first in order of their minimum distance
+			to point. The search stops as soon as no remaining node can hold
+			a point closer than the k-th best found so far. Ties are broken
+			arbitrarily.
 		*/
-		inline bool add(PointIterator point_it)
+		template<class OutputIterator>
+		OutputIterator nearest(const Point &point, size_t k, OutputIterator out, nearest_scratch &scratch) const
 		{
-			if (false == point_intersects_boundary(*point_it))
+			std::vector<node_entry> &nodes = scratch.m_nodes;
+			std::vector<point_entry> &points = scratch.m_points;
+
+			nodes.clear();
+			points.clear();
+
+			if (0 == k)
 			{
-				return false;
+				return out;
 			}
-			
-			if (true == has_children())
+
+			nodes.push_back(node_entry(squared_distance(point, m_root->m_boundary), &*m_root));
+
+			while (false == nodes.empty())
 			{
-				if (true == m_north_west->add(point_it))
+				std::pop_heap(nodes.begin(), nodes.end(), farther<node_entry>());
+
+				const node_entry entry = nodes.back();
+
+				nodes.pop_back();
+
+				if (points.size() == k && entry.m_distance >= points.front().m_distance)
 				{
-					return true;
+					break;
 				}
-				
-				if (true == m_north_east->add(point_it))
+
+				const node &n = *entry.m_target;
+
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
+
+				if (true == n.m_dirty)
 				{
-					return true;
+					refine_touched(n);
 				}
-				
-				if (true == m_south_west->add(point_it))
+
+				if (true == n.has_children())
 				{
-					return true;
+					const node *children[] = { &*n.m_north_west, &*n.m_north_east, &*n.m_south_west, &*n.m_south_east };
+
+					for (int child = 0; child < 4; ++child)
+					{
+						const double distance = squared_distance(point, children[child]->m_boundary);
+
+						if (points.size() == k && distance >= points.front().m_distance)
+						{
+							continue;
+						}
+
+						nodes.push_back(node_entry(distance, children[child]));
+						std::push_heap(nodes.begin(), nodes.end(), farther<node_entry>());
+					}
+
+					continue;
 				}
-				
-				if (true == m_south_east->add(point_it))
+
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
 				{
-					return true;
+					FPS_QUAD_TREE_COUNT(m_points_tested, chunk->m_number_of_points);
+
+					for (int index = 0; index < chunk->m_number_of_points; ++index)
+					{
+						const double dx = static_cast<double>(point[0]) - static_cast<double>(chunk->x()[index]);
+						const double dy = static_cast<double>(point[1]) - static_cast<double>(chunk->y()[index]);
+
+						const double distance = dx * dx + dy * dy;
+
+						if (points.size() < k)
+						{
+							points.push_back(point_entry(distance, chunk->m_points[index]));
+							std::push_heap(points.begin(), points.end(), closer<point_entry>());
+						}
+						else if (distance < points.front().m_distance)
+						{
+							std::pop_heap(points.begin(), points.end(), closer<point_entry>());
+							points.back() = point_entry(distance, chunk->m_points[index]);
+							std::push_heap(points.begin(), points.end(), closer<point_entry>());
+						}
+					}
 				}
-				
-				throw std::logic_error("This should not happen");
 			}
-			
-			if (m_points.size() < NodeCapacity)
+
+			std::sort_heap(points.begin(), points.end(), closer<point_entry>());
+
+			for (typename std::vector<point_entry>::const_iterator it = points.begin(); it != points.end(); ++it)
 			{
-				m_points.insert(point_it);
-				return true;
+				*out = it->m_target;
+				++out;
 			}
-			
-			split();
 
-			return add(point_it);
+			return out;
 		}
-		
-		inline bool has_children() const
+
+		/**
+			Convenience version of nearest() which allocates its own scratch
+		*/
+		template<class OutputIterator>
+		inline OutputIterator nearest(const Point &point, size_t k, OutputIterator out) const
 		{
-			assert
-			(
-				(m_north_west && m_north_east && m_south_west && m_south_east) ||
-				(!m_north_west && !m_north_east && !m_south_west && !m_south_east)
-			);
-			
-			// std::cout << "has_children: " << (bool)m_north_west << std::endl;
-			
-			return m_north_west;
+			nearest_scratch scratch;
+
+			return nearest(point, k, out, scratch);
 		}
-		
-		inline bool point_intersects_boundary(const Point &point) const
+
+		size_t number_of_points() const
 		{
-			const bool does_intersect = 
-			(
-				point[0] >= m_boundary.first[0] &&
-				point[1] >= m_boundary.first[1] &&
-				point[0] <= m_boundary.second[0] &&
-				point[1] <= m_boundary.second[1]
-			);	
-			
-			// std::cout << "point_intersects_boundary: " << does_intersect << std::endl;
-			
-			return does_intersect;
+			return m_root->m_subtree_points;
 		}
-		
-		inline void split()
+
+		size_t number_of_points(const node &n) const
 		{
-			// std::cout << "split" << std::endl;
-			
-			Point center;
+			return n.m_subtree_points;
+		}
 
-			center[0] = (m_boundary.second[0] + m_boundary.first[0]) / 2;
-			center[1] = (m_boundary.second[1] + m_boundary.first[1]) / 2;
-			
-			const Point &upper_left = m_boundary.first;
-			const Point &lower_right = m_boundary.second;
-			
-			/*
-				North west
-			*/
-			m_north_west = quad_tree_ptr(new quad_tree_t(Boundary(upper_left, center)));
+		/**
+			Returns the number of points within range (the boundary is
+			inclusive) like visit_range() would report them. Subtrees
+			completely inside range contribute their stored count without
+			being descended into, so coarse windows over large trees touch
+			only the nodes along the edges of range. Dirty leaves are
+			counted as they are, without splitting them.
+		*/
+		size_t count_in(const Boundary &range) const
+		{
+			fixed_stack<const node*> stack;
 
-			m_north_west->m_level = m_level + 1;
-			
-			/*
-				North east
-			*/
-			Point north_east_border_upper_left;
+			size_t number = 0;
 
-			north_east_border_upper_left[0] = center[0];
-			north_east_border_upper_left[1] = upper_left[1];
-			
-			Point north_east_border_lower_right;
+			stack.push(&*m_root);
 
-			north_east_border_lower_right[0] = lower_right[0];
-			north_east_border_lower_right[1] = center[1];
+			while (false == stack.empty())
+			{
+				const node &n = *stack.pop();
 
-			m_north_east = quad_tree_ptr
-			(
-				new quad_tree_t
-				(
-					Boundary(north_east_border_upper_left, north_east_border_lower_right)
-				)
-			);
+				FPS_QUAD_TREE_COUNT(m_nodes_visited, 1);
 
-			m_north_east->m_level = m_level + 1;
+				if (false == n.boundary_intersects(range))
+				{
+					continue;
+				}
 
-			/*
-				South east
-			*/
-			m_south_east = quad_tree_ptr(new quad_tree_t(Boundary(center, lower_right)));
+				if (true == n.boundary_is_inside(range))
+				{
+					number += n.m_subtree_points;
+					continue;
+				}
 
-			m_south_east->m_level = m_level + 1;
-			
-			/*
-				South west
-			*/
-			Point south_west_border_upper_left;
+				if (true == n.has_children())
+				{
+					push_children(n, stack);
+					continue;
+				}
 
-			south_west_border_upper_left[0] = upper_left[0];
-			south_west_border_upper_left[1] = center[1];
-			
-			Point south_west_border_lower_right;
+				for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+				{
+					FPS_QUAD_TREE_COUNT(m_points_tested, chunk->m_number_of_points);
 
-			south_west_border_lower_right[0] = center[0];
-			south_west_border_lower_right[1] = lower_right[1];
+					for (int base = 0; base < chunk->m_number_of_points; base += 64)
+					{
+						const int count = std::min(64, chunk->m_number_of_points - base);
 
-					
-			m_south_west = quad_tree_ptr
-			(
-				new quad_tree_t
-				(
-					Boundary(south_west_border_upper_left, south_west_border_lower_right)
-				)
-			);
+						number += number_of_bits(boundary_mask<interval_filter>(chunk->x() + base, chunk->y() + base, count, range));
+					}
+				}
+			}
+	
+			return number;
+		}
+		
+		/**
+			Walks the whole tree and returns its shape. Unlike operator<< this
+			is fine for large trees.
+		*/
+		tree_statistics statistics() const
+		{
+			tree_statistics statistics;
 
-			m_south_west->m_level = m_level + 1;
-			
-			/*
-				Distribute points
-			*/
-			for (typename std::set<PointIterator>::iterator it = m_points.begin(); it != m_points.end(); ++it)
+			statistics.m_fill_histogram.resize(NodeCapacity + 2);
+
+			fixed_stack<const node*> stack;
+
+			stack.push(&*m_root);
+
+			while (false == stack.empty())
 			{
-				add(*it);
+				const node &n = *stack.pop();
+
+				if (true == n.has_children())
+				{
+					++statistics.m_nodes;
+
+					statistics.m_depth = std::max(statistics.m_depth, static_cast<int>(n.m_depth));
+
+					push_children(n, stack);
+					continue;
+				}
+
+				gather_statistics(n, n.m_depth, statistics);
 			}
-			
-			m_points.clear();
+
+			statistics.m_bytes = (statistics.m_nodes + statistics.m_overflow_chunks) * sizeof(node);
+
+			return statistics;
 		}
 
-		size_t number_of_points()
+		/**
+			Adds the leaf n at depth to statistics
+		*/
+		void gather_statistics(const node &n, int depth, tree_statistics &statistics) const
 		{
-			size_t own_number = m_points.size();
+			++statistics.m_nodes;
+
+			statistics.m_depth = std::max(statistics.m_depth, depth);
+
+			++statistics.m_leaves;
 
-			if (true == has_children())
+			if (statistics.m_depth_histogram.size() <= static_cast<size_t>(depth))
 			{
-				own_number += 
-					m_north_west->number_of_points() + 
-					m_north_east->number_of_points() + 
-					m_south_east->number_of_points() + 
-					m_south_west->number_of_points();
+				statistics.m_depth_histogram.resize(depth + 1);
 			}
-	
-			return own_number;
+
+			++statistics.m_depth_histogram[depth];
+
+			if (true == n.m_dirty)
+			{
+				++statistics.m_dirty_leaves;
+			}
+
+			for (const node *chunk = n.next_chunk(); 0 != chunk; chunk = chunk->next_chunk())
+			{
+				++statistics.m_overflow_chunks;
+			}
+
+			const size_t size = n.leaf_size();
+
+			statistics.m_points += size;
+
+			++statistics.m_fill_histogram[std::min(size, static_cast<size_t>(NodeCapacity + 1))];
 		}
-		
+
 		/**
 			Used only by operator<< for formatting purposes
 		*/
-		int m_level;
-	};
-
-	void feed_spaces(int number_of_spaces, std::ostream &o)
-	{
-		for (int index = 0; index < number_of_spaces; ++index)
-		{
-			o << "  ";
-		}
-	}
-	
-	template<class Point, class PointIterator, int NodeCapacity>
-	std::ostream &operator<<(std::ostream &o, const point_quad_tree<Point, PointIterator, NodeCapacity> &tree)
-	{
-		feed_spaces(tree.m_level, o);
-		o << "Node [" << tree.m_boundary.first[0] << " " << tree.m_boundary.first[1] << "] [" << tree.m_boundary.second[0] << " " << tree.m_boundary.second[1] << "] => ( ";
-		
-		typedef point_quad_tree<Point, PointIterator, NodeCapacity> quad_tree_t;
-		
-		for (typename quad_tree_t::PointsSet::iterator it = tree.m_points.begin(); it != tree.m_points.end(); ++it)
+		void print(std::ostream &o, const node &start, int start_level) const
 		{
-			o << "[" << (*(*it))[0] << " " << (*(*it))[1] << "] "; 
+			fixed_stack<std::pair<const node*, int> > stack;
+
+			stack.push(std::make_pair(&start, start_level));
+
+			while (false == stack.empty())
+			{
+				const std::pair<const node*, int> entry = stack.pop();
+
+				print_node(o, *entry.first, entry.second);
+
+				if (true == entry.first->has_children())
+				{
+					const node &n = *entry.first;
+
+					stack.push(std::make_pair(&*n.m_south_west, entry.second + 1));
+					stack.push(std::make_pair(&*n.m_south_east, entry.second + 1));
+					stack.push(std::make_pair(&*n.m_north_east, entry.second + 1));
+					stack.push(std::make_pair(&*n.m_north_west, entry.second + 1));
+				}
+			}
 		}
 
-		o << ")" << std::endl;
-		
-		if (true == tree.has_children())
+		void print_node(std::ostream &o, const node &n, int level) const
 		{
-			o << *tree.m_north_west;
-			o << *tree.m_north_east;
-			o << *tree.m_south_east;
-			o << *tree.m_south_west;
+			feed_spaces(level, o);
+			o << "Node [" << n.m_boundary.first[0] << " " << n.m_boundary.first[1] << "] [" << n.m_boundary.second[0] << " " << n.m_boundary.second[1] << "] => ( ";
+
+			for (const node *chunk = &n; 0 != chunk; chunk = chunk->next_chunk())
+			{
+				for (int index = 0; index < chunk->m_number_of_points; ++index)
+				{
+					o << "[" << chunk->x()[index] << " " << chunk->y()[index] << "] ";
+				}
+			}
+
+			o << ")" << std::endl;
 		}
-		
+
+	private:
+		point_quad_tree(const point_quad_tree&);
+
+		point_quad_tree &operator=(const point_quad_tree&);
+	};
+
+	template<class Point, class PointIterator, int NodeCapacity, bool CheckUniqueness, class Allocation>
+	std::ostream &operator<<
+	(
+		std::ostream &o,
+		const point_quad_tree<Point, PointIterator, NodeCapacity, CheckUniqueness, Allocation> &tree
+	)
+	{
+		tree.print(o, *tree.m_root, 0);
+
 		return o;
 	}
 
@@ -0,0 +1,375 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_QUAD_TREE_SIMD_HH
+#define FPS_QUAD_TREE_SIMD_HH
+
+#include <stdint.h>
+
+/*
+	Define FPS_QUAD_TREE_NO_SIMD to always use the scalar code
+*/
+#if !defined(FPS_QUAD_TREE_NO_SIMD)
+	#if defined(__AVX__)
+		#include <immintrin.h>
+	#elif defined(__SSE2__)
+		#include <emmintrin.h>
+	#elif defined(__ARM_NEON) && defined(__aarch64__)
+		#include <arm_neon.h>
+	#endif
+#endif
+
+namespace quad_tree
+{
+	/**
+		The number of lanes every lane array handed to interval_filter must be
+		readable for beyond its count, rounded up. Trees pad their lane
+		arrays to multiples of this.
+	*/
+	const int simd_lane_padding = 8;
+
+	/**
+		@brief Tests one array of coordinates (a lane) against an interval.
+
+		mask() returns a bit mask with bit i set if low <= lane[i] <= high for
+		0 <= i < count <= 64. Combining the masks of all dimensions with & tests
+		points stored structure of arrays against a boundary.
+
+		This generic version compares one coordinate at a time. There are
+		SSE2/AVX and NEON versions for float and double, and SSE2 versions for
+		32 bit integers, which are picked automatically when the compiler
+		targets them. They read up to
+		simd_lane_padding - 1 lanes beyond count, which is why lanes must be
+		padded.
+	*/
+	template<class Coordinate>
+	struct scalar_interval_filter
+	{
+		static inline uint64_t mask(const Coordinate *lane, int count, Coordinate low, Coordinate high)
+		{
+			uint64_t mask = 0;
+
+			for (int index = 0; index < count; ++index)
+			{
+				mask |= static_cast<uint64_t>(lane[index] >= low && lane[index] <= high) << index;
+			}
+
+			return mask;
+		}
+	};
+
+	template<class Coordinate>
+	struct interval_filter : scalar_interval_filter<Coordinate>
+	{
+
+	};
+
+	/**
+		Returns a mask with the lowest count bits set
+	*/
+	inline uint64_t lane_mask(int count)
+	{
+		return (count >= 64) ? ~static_cast<uint64_t>(0) : ((static_cast<uint64_t>(1) << count) - 1);
+	}
+
+#if !defined(FPS_QUAD_TREE_NO_SIMD)
+	#if defined(__AVX__)
+		template<>
+		struct interval_filter<float>
+		{
+			static inline uint64_t mask(const float *lane, int count, float low, float high)
+			{
+				const __m256 lows = _mm256_set1_ps(low);
+				const __m256 highs = _mm256_set1_ps(high);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 8)
+				{
+					const __m256 values = _mm256_loadu_ps(lane + index);
+
+					const __m256 inside = _mm256_and_ps
+					(
+						_mm256_cmp_ps(values, lows, _CMP_GE_OQ),
+						_mm256_cmp_ps(values, highs, _CMP_LE_OQ)
+					);
+
+					mask |= static_cast<uint64_t>(_mm256_movemask_ps(inside)) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+
+		template<>
+		struct interval_filter<double>
+		{
+			static inline uint64_t mask(const double *lane, int count, double low, double high)
+			{
+				const __m256d lows = _mm256_set1_pd(low);
+				const __m256d highs = _mm256_set1_pd(high);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 4)
+				{
+					const __m256d values = _mm256_loadu_pd(lane + index);
+
+					const __m256d inside = _mm256_and_pd
+					(
+						_mm256_cmp_pd(values, lows, _CMP_GE_OQ),
+						_mm256_cmp_pd(values, highs, _CMP_LE_OQ)
+					);
+
+					mask |= static_cast<uint64_t>(_mm256_movemask_pd(inside)) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+	#elif defined(__SSE2__)
+		template<>
+		struct interval_filter<float>
+		{
+			static inline uint64_t mask(const float *lane, int count, float low, float high)
+			{
+				const __m128 lows = _mm_set1_ps(low);
+				const __m128 highs = _mm_set1_ps(high);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 4)
+				{
+					const __m128 values = _mm_loadu_ps(lane + index);
+
+					const __m128 inside = _mm_and_ps(_mm_cmpge_ps(values, lows), _mm_cmple_ps(values, highs));
+
+					mask |= static_cast<uint64_t>(_mm_movemask_ps(inside)) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+
+		template<>
+		struct interval_filter<double>
+		{
+			static inline uint64_t mask(const double *lane, int count, double low, double high)
+			{
+				const __m128d lows = _mm_set1_pd(low);
+				const __m128d highs = _mm_set1_pd(high);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 2)
+				{
+					const __m128d values = _mm_loadu_pd(lane + index);
+
+					const __m128d inside = _mm_and_pd(_mm_cmpge_pd(values, lows), _mm_cmple_pd(values, highs));
+
+					mask |= static_cast<uint64_t>(_mm_movemask_pd(inside)) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+	#elif defined(__ARM_NEON) && defined(__aarch64__)
+		template<>
+		struct interval_filter<float>
+		{
+			static inline uint64_t mask(const float *lane, int count, float low, float high)
+			{
+				const float32x4_t lows = vdupq_n_f32(low);
+				const float32x4_t highs = vdupq_n_f32(high);
+
+				const uint32_t bits_data[4] = { 1, 2, 4, 8 };
+
+				const uint32x4_t bits = vld1q_u32(bits_data);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 4)
+				{
+					const float32x4_t values = vld1q_f32(lane + index);
+
+					const uint32x4_t inside = vandq_u32(vcgeq_f32(values, lows), vcleq_f32(values, highs));
+
+					mask |= static_cast<uint64_t>(vaddvq_u32(vandq_u32(inside, bits))) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+
+		template<>
+		struct interval_filter<double>
+		{
+			static inline uint64_t mask(const double *lane, int count, double low, double high)
+			{
+				const float64x2_t lows = vdupq_n_f64(low);
+				const float64x2_t highs = vdupq_n_f64(high);
+
+				const uint64_t bits_data[2] = { 1, 2 };
+
+				const uint64x2_t bits = vld1q_u64(bits_data);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 2)
+				{
+					const float64x2_t values = vld1q_f64(lane + index);
+
+					const uint64x2_t inside = vandq_u64(vcgeq_f64(values, lows), vcleq_f64(values, highs));
+
+					mask |= vaddvq_u64(vandq_u64(inside, bits)) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+	#endif
+
+	#if defined(__SSE2__)
+		/*
+			32 bit integers compare four at a time on everything from SSE2
+			on. Unsigned lanes are compared as signed ones after flipping
+			their sign bits.
+		*/
+		template<>
+		struct interval_filter<int32_t>
+		{
+			static inline uint64_t mask(const int32_t *lane, int count, int32_t low, int32_t high)
+			{
+				const __m128i lows = _mm_set1_epi32(low);
+				const __m128i highs = _mm_set1_epi32(high);
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 4)
+				{
+					const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane + index));
+
+					const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(values, lows), _mm_cmpgt_epi32(values, highs));
+
+					mask |= static_cast<uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(outside)) ^ 0xf) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+
+		template<>
+		struct interval_filter<uint32_t>
+		{
+			static inline uint64_t mask(const uint32_t *lane, int count, uint32_t low, uint32_t high)
+			{
+				const __m128i sign = _mm_set1_epi32(static_cast<int32_t>(0x80000000u));
+
+				const __m128i lows = _mm_set1_epi32(static_cast<int32_t>(low ^ 0x80000000u));
+				const __m128i highs = _mm_set1_epi32(static_cast<int32_t>(high ^ 0x80000000u));
+
+				uint64_t mask = 0;
+
+				for (int index = 0; index < count; index += 4)
+				{
+					const __m128i values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lane + index)), sign);
+
+					const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(values, lows), _mm_cmpgt_epi32(values, highs));
+
+					mask |= static_cast<uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(outside)) ^ 0xf) << index;
+				}
+
+				return mask & lane_mask(count);
+			}
+		};
+	#endif
+#endif
+
+	/**
+		Returns the mask of the points given as an x and a y lane that lie
+		within boundary (inclusive). Filter is one of the interval filters.
+	*/
+	template<template<class> class Filter, class Coordinate, class Boundary>
+	inline uint64_t boundary_mask(const Coordinate *x, const Coordinate *y, int count, const Boundary &boundary)
+	{
+		const uint64_t x_mask = Filter<Coordinate>::mask(x, count, boundary.first[0], boundary.second[0]);
+
+		if (0 == x_mask)
+		{
+			return 0;
+		}
+
+		return x_mask & Filter<Coordinate>::mask(y, count, boundary.first[1], boundary.second[1]);
+	}
+
+	/**
+		Returns the index of the highest set bit of a non zero mask
+	*/
+	inline int highest_bit(uint64_t mask)
+	{
+	#if defined(__GNUC__)
+		return 63 - __builtin_clzll(mask);
+	#else
+		int bit = 0;
+
+		while (0 != (mask >>= 1))
+		{
+			++bit;
+		}
+
+		return bit;
+	#endif
+	}
+
+	/**
+		Returns the index of the lowest set bit of a non zero mask
+	*/
+	inline int lowest_bit(uint64_t mask)
+	{
+	#if defined(__GNUC__)
+		return __builtin_ctzll(mask);
+	#else
+		int bit = 0;
+
+		while (0 == (mask & 1))
+		{
+			mask >>= 1;
+			++bit;
+		}
+
+		return bit;
+	#endif
+	}
+
+	/**
+		Returns the number of set bits of mask
+	*/
+	inline int number_of_bits(uint64_t mask)
+	{
+	#if defined(__GNUC__)
+		return __builtin_popcountll(mask);
+	#else
+		int bits = 0;
+
+		for (; 0 != mask; mask &= mask - 1)
+		{
+			++bits;
+		}
+
+		return bits;
+	#endif
+	}
+
+} // namespace
+
+#endif
@@ -0,0 +1,259 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_QUAD_TREE_SNAPSHOT_HH
+#define FPS_QUAD_TREE_SNAPSHOT_HH
+
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+namespace quad_tree
+{
+	/**
+		@brief Publishes immutable versions of a tree to any number of reader
+		threads without locking them (read-copy-update).
+
+		Readers take a read_guard, which gives them the current tree for as long
+		as the guard lives. Writers build the next version of the tree on their
+		own and hand it to publish(), which replaces the current tree atomically.
+		Readers that already hold a guard keep using the old tree. Old trees are
+		deleted once no guard taken before they were replaced is left.
+
+		Readers announce themselves in one of MaximumReaders slots by storing
+		the epoch (the number of trees published so far plus one) they started
+		in. Replacing a tree advances the epoch, and a replaced tree is deleted
+		once no slot holds an epoch from before its replacement. Taking and
+		dropping a guard costs a few atomic operations on a cache line of its
+		own and never blocks on writers. More than MaximumReaders guards at
+		the same time make readers wait for a free slot.
+
+		Tree is a point_quad_tree or any tree with refine() whose const
+		methods are safe to call concurrently (see the thread safety note at
+		point_quad_tree).
+
+		NOTE: publish() and reclaim() take a mutex to serialize writers. The
+		holder must outlive all guards.
+	*/
+	template<class Tree, int MaximumReaders = 64>
+	struct tree_snapshots
+	{
+		/*
+			0 for a free slot, otherwise the epoch the reader started in
+		*/
+		struct alignas(64) reader_slot
+		{
+			std::atomic<uint64_t> m_epoch;
+		};
+
+		std::atomic<const Tree*> m_current;
+
+		std::atomic<uint64_t> m_epoch;
+
+		reader_slot m_readers[MaximumReaders];
+
+		std::mutex m_writer_mutex;
+
+		/*
+			Replaced trees together with the epoch they were replaced in.
+			Only touched with m_writer_mutex held.
+		*/
+		std::vector<std::pair<uint64_t, const Tree*> > m_retired;
+
+		/**
+			Takes ownership of tree, which may be 0
+		*/
+		explicit tree_snapshots(Tree *tree = 0)
+		:
+			m_current(prepare(tree)),
+			m_epoch(1)
+		{
+			for (int slot = 0; slot < MaximumReaders; ++slot)
+			{
+				m_readers[slot].m_epoch.store(0);
+			}
+		}
+
+		~tree_snapshots()
+		{
+			delete m_current.load();
+
+			for (size_t index = 0; index < m_retired.size(); ++index)
+			{
+				delete m_retired[index].second;
+			}
+		}
+
+		/**
+			@brief Gives a reader access to the tree current when it was
+			created.
+
+			A guard must not be shared between threads.
+		*/
+		struct read_guard
+		{
+			reader_slot *m_slot;
+
+			const Tree *m_tree;
+
+			explicit read_guard(tree_snapshots &snapshots)
+			:
+				m_slot(0),
+				m_tree(0)
+			{
+				for (int slot = 0; ; slot = (slot + 1) % MaximumReaders)
+				{
+					uint64_t free_epoch = 0;
+
+					if (true == snapshots.m_readers[slot].m_epoch.compare_exchange_strong(free_epoch, snapshots.m_epoch.load()))
+					{
+						m_slot = &snapshots.m_readers[slot];
+						break;
+					}
+
+					if (MaximumReaders - 1 == slot)
+					{
+						std::this_thread::yield();
+					}
+				}
+
+				m_tree = snapshots.m_current.load();
+			}
+
+			~read_guard()
+			{
+				m_slot->m_epoch.store(0);
+			}
+
+			/**
+				Returns the tree or 0 if none was published yet
+			*/
+			inline const Tree *get() const
+			{
+				return m_tree;
+			}
+
+			inline const Tree &operator*() const
+			{
+				return *m_tree;
+			}
+
+			inline const Tree *operator->() const
+			{
+				return m_tree;
+			}
+
+		private:
+			read_guard(const read_guard&);
+
+			read_guard &operator=(const read_guard&);
+		};
+
+		/**
+			Makes tree the current tree and takes ownership of it. Pending
+			lazy splits are done first so the tree is never modified again.
+			Returns after deleting all replaced trees no reader uses anymore.
+		*/
+		void publish(Tree *tree)
+		{
+			std::lock_guard<std::mutex> lock(m_writer_mutex);
+
+			const Tree *replaced = m_current.exchange(prepare(tree));
+
+			const uint64_t epoch = m_epoch.fetch_add(1) + 1;
+
+			if (0 != replaced)
+			{
+				m_retired.push_back(std::make_pair(epoch, replaced));
+			}
+
+			reclaim_retired();
+		}
+
+		/**
+			Deletes all replaced trees no reader uses anymore
+		*/
+		void reclaim()
+		{
+			std::lock_guard<std::mutex> lock(m_writer_mutex);
+
+			reclaim_retired();
+		}
+
+		/**
+			Returns the number of replaced trees not deleted yet
+		*/
+		size_t number_of_retired()
+		{
+			std::lock_guard<std::mutex> lock(m_writer_mutex);
+
+			return m_retired.size();
+		}
+
+	private:
+		static inline const Tree *prepare(Tree *tree)
+		{
+			if (0 != tree)
+			{
+				tree->refine();
+			}
+
+			return tree;
+		}
+
+		/*
+			A tree replaced in epoch e is unused once every active reader
+			started in epoch e or later
+		*/
+		void reclaim_retired()
+		{
+			uint64_t oldest = m_epoch.load();
+
+			for (int slot = 0; slot < MaximumReaders; ++slot)
+			{
+				const uint64_t epoch = m_readers[slot].m_epoch.load();
+
+				if (0 != epoch && epoch < oldest)
+				{
+					oldest = epoch;
+				}
+			}
+
+			size_t kept = 0;
+
+			for (size_t index = 0; index < m_retired.size(); ++index)
+			{
+				if (m_retired[index].first <= oldest)
+				{
+					delete m_retired[index].second;
+				}
+				else
+				{
+					m_retired[kept++] = m_retired[index];
+				}
+			}
+
+			m_retired.resize(kept);
+		}
+
+		tree_snapshots(const tree_snapshots&);
+
+		tree_snapshots &operator=(const tree_snapshots&);
+	};
+
+} // namespace
+
+#endif
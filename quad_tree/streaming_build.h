@@ -0,0 +1,729 @@
+/*
+	This software is provided AS IS without any guarantee about even
+	implied usefulness. It is NOT error free. It might and probably
+	will destroy all your belongings. You can NOT sue me if that happens.
+
+	You can use this software in any way you want given that you keep
+	this disclaimer and the following copyright notice intact. If you
+	change this software you are free to redistribute and ADD your own
+	copyright notice below.
+
+	copyright 2013 Florian Paul Schmidt (mista.tapas@gmx.net)
+*/
+
+#ifndef FPS_QUAD_TREE_STREAMING_BUILD_HH
+#define FPS_QUAD_TREE_STREAMING_BUILD_HH
+
+#include <quad_tree/quad_tree.h>
+#include <quad_tree/linear_quad_tree.h>
+#include <quad_tree/mapped_quad_tree.h>
+
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <unistd.h>
+
+namespace quad_tree
+{
+	/**
+		@brief The knobs of build_mapped().
+	*/
+	struct streaming_options
+	{
+		/*
+			Partitions estimated to need at most this many bytes are built
+			in memory. The estimate includes the temporary tree, so this is
+			roughly the peak memory use of the build.
+		*/
+		size_t m_memory_budget;
+
+		/*
+			The number of points read or written at a time
+		*/
+		size_t m_chunk_size;
+
+		/*
+			Where partitions are spilled to
+		*/
+		std::string m_temporary_directory;
+
+		split_limits m_limits;
+
+		streaming_options
+		(
+			size_t memory_budget = static_cast<size_t>(256) << 20,
+			const std::string &temporary_directory = "/tmp",
+			const split_limits &limits = split_limits()
+		)
+		:
+			m_memory_budget(memory_budget),
+			m_chunk_size(static_cast<size_t>(1) << 16),
+			m_temporary_directory(temporary_directory),
+			m_limits(limits)
+		{
+
+		}
+	};
+
+	/**
+		@brief An anonymous file for spilling data to.
+
+		The file is unlinked right after it was created, so it goes away when
+		it is closed, even if the process dies.
+	*/
+	struct temporary_file
+	{
+		std::FILE *m_file;
+
+		explicit temporary_file(const std::string &directory)
+		:
+			m_file(0)
+		{
+			std::vector<char> name(directory.begin(), directory.end());
+
+			const char pattern[] = "/quad_tree.XXXXXX";
+
+			name.insert(name.end(), pattern, pattern + sizeof(pattern));
+
+			const int file = ::mkstemp(&name[0]);
+
+			if (-1 == file)
+			{
+				throw std::runtime_error("Could not create a temporary file");
+			}
+
+			::unlink(&name[0]);
+
+			m_file = ::fdopen(file, "w+b");
+
+			if (0 == m_file)
+			{
+				::close(file);
+
+				throw std::runtime_error("Could not open a temporary file");
+			}
+
+			std::setvbuf(m_file, 0, _IOFBF, static_cast<size_t>(1) << 20);
+		}
+
+		~temporary_file()
+		{
+			std::fclose(m_file);
+		}
+
+		inline void write(const void *data, size_t size)
+		{
+			if (size != std::fwrite(data, 1, size, m_file))
+			{
+				throw std::runtime_error("Writing a temporary file failed");
+			}
+		}
+
+		/**
+			Writes size bytes at offset
+		*/
+		inline void write(uint64_t offset, const void *data, size_t size)
+		{
+			seek(offset);
+
+			write(data, size);
+		}
+
+		/**
+			Returns the number of bytes read, which is less than size only
+			at the end of the file
+		*/
+		inline size_t read(void *data, size_t size)
+		{
+			const size_t read = std::fread(data, 1, size, m_file);
+
+			if (read != size && 0 != std::ferror(m_file))
+			{
+				throw std::runtime_error("Reading a temporary file failed");
+			}
+
+			return read;
+		}
+
+		inline void seek(uint64_t offset)
+		{
+			if (0 != ::fseeko(m_file, static_cast<off_t>(offset), SEEK_SET))
+			{
+				throw std::runtime_error("Seeking in a temporary file failed");
+			}
+		}
+
+		/**
+			Appends the whole file to o
+		*/
+		void copy_to(std::ostream &o)
+		{
+			seek(0);
+
+			std::vector<char> buffer(static_cast<size_t>(1) << 20);
+
+			for (size_t read; 0 != (read = this->read(&buffer[0], buffer.size())); )
+			{
+				if (false == static_cast<bool>(o.write(&buffer[0], static_cast<std::streamsize>(read))))
+				{
+					throw std::runtime_error("Writing the tree failed");
+				}
+			}
+		}
+
+	private:
+		temporary_file(const temporary_file&);
+
+		temporary_file &operator=(const temporary_file&);
+	};
+
+	/**
+		@brief Builds the file format of save_mapped() from a stream of points
+		which need not fit into memory.
+
+		The points are read in chunks and numbered in the order they come in,
+		and these numbers are what the mapped_quad_tree reports. Partitions
+		too large for the memory budget are split in one pass over their
+		points into four files, one per quadrant, which are processed one
+		after the other. Partitions within the budget are loaded, bulk loaded
+		into a point_quad_tree of indices and flattened.
+
+		The resulting tree follows the splitting rules of bulk_load(): Nodes
+		with more than NodeCapacity points are split unless the split_limits
+		forbid it or all their points coincide. Its nodes are laid out in the
+		order they are produced rather than breadth first, which readers do
+		not depend on.
+
+		Every level of spilling reads and writes the points once more. Disk
+		space for about twice the points in the boundary is needed.
+
+		QuadTree is the point_quad_tree type whose geometry and NodeCapacity
+		are used, as for mapped_quad_tree.
+	*/
+	template<class QuadTree>
+	struct streaming_builder
+	{
+		typedef typename QuadTree::Boundary Boundary;
+
+		typedef typename QuadTree::point_type Point;
+
+		typedef typename QuadTree::coordinate_type coordinate_type;
+
+		/*
+			Builds the subtrees of partitions within the memory budget
+		*/
+		typedef point_quad_tree<Point, uint32_t, QuadTree::node_capacity> memory_tree;
+
+		typedef linear_quad_tree<memory_tree> linear_tree;
+
+		typedef typename linear_tree::node node;
+
+		/*
+			How points are spilled
+		*/
+		struct record
+		{
+			uint32_t m_index;
+
+			Point m_position;
+		};
+
+		/*
+			A spilled partition
+		*/
+		struct partition
+		{
+			std::unique_ptr<temporary_file> m_file;
+
+			uint64_t m_number_of_points;
+
+			/*
+				All points are at m_position
+			*/
+			bool m_coincident;
+
+			Point m_position;
+
+			partition()
+			:
+				m_number_of_points(0),
+				m_coincident(true)
+			{
+
+			}
+
+			inline void push_back(const record &r)
+			{
+				if (0 == m_number_of_points)
+				{
+					m_position = r.m_position;
+				}
+				else if (r.m_position[0] != m_position[0] || r.m_position[1] != m_position[1])
+				{
+					m_coincident = false;
+				}
+
+				m_file->write(&r, sizeof(r));
+
+				++m_number_of_points;
+			}
+		};
+
+		/*
+			Estimated peak memory per point of an in memory build: the
+			records, the positions handed to bulk_load_indices(), its
+			entries and their temporary copy, the tree nodes and the
+			flattened tree
+		*/
+		static const size_t bytes_per_point =
+			sizeof(record) + sizeof(Point) + 2 * sizeof(typename memory_tree::morton_entry) +
+			2 * sizeof(typename memory_tree::node) / QuadTree::node_capacity +
+			sizeof(uint32_t) + 2 * sizeof(coordinate_type);
+
+		Boundary m_boundary;
+
+		streaming_options m_options;
+
+		temporary_file m_nodes;
+
+		temporary_file m_indices;
+
+		temporary_file m_x;
+
+		temporary_file m_y;
+
+		uint64_t m_number_of_nodes;
+
+		uint64_t m_number_of_points;
+
+		streaming_builder(const Boundary &boundary, const streaming_options &options)
+		:
+			m_boundary(boundary),
+			m_options(options),
+			m_nodes(options.m_temporary_directory),
+			m_indices(options.m_temporary_directory),
+			m_x(options.m_temporary_directory),
+			m_y(options.m_temporary_directory),
+			m_number_of_nodes(1),
+			m_number_of_points(0)
+		{
+			QuadTree::check_boundary(boundary);
+			check_midpoint_split(options.m_limits);
+			check_default_capacity(options.m_limits);
+
+			if (0 == options.m_chunk_size)
+			{
+				throw std::runtime_error("The chunk size must not be 0");
+			}
+		}
+
+		inline bool fits(uint64_t number_of_points) const
+		{
+			return number_of_points * bytes_per_point <= m_options.m_memory_budget;
+		}
+
+		/**
+			Reads all points from i, builds the tree and writes it to o
+		*/
+		void build(std::istream &i, std::ostream &o)
+		{
+			std::vector<record> records;
+
+			partition root;
+
+			std::vector<Point> chunk(m_options.m_chunk_size);
+
+			uint64_t index = 0;
+
+			for (;;)
+			{
+				i.read(reinterpret_cast<char*>(&chunk[0]), static_cast<std::streamsize>(chunk.size() * sizeof(Point)));
+
+				const size_t number_of_points = static_cast<size_t>(i.gcount()) / sizeof(Point);
+
+				for (size_t point = 0; point < number_of_points; ++point, ++index)
+				{
+					if (index >= 0xffffffffu)
+					{
+						throw std::runtime_error("Too many points for 32 bit indices");
+					}
+
+					if (false == QuadTree::point_intersects_boundary(chunk[point], m_boundary))
+					{
+						continue;
+					}
+
+					record r;
+
+					r.m_index = static_cast<uint32_t>(index);
+					r.m_position = chunk[point];
+
+					records.push_back(r);
+				}
+
+				/*
+					Once the points do not fit anymore they all go to disk
+				*/
+				if (false == fits(records.size()) || root.m_file)
+				{
+					if (!root.m_file)
+					{
+						root.m_file.reset(new temporary_file(m_options.m_temporary_directory));
+					}
+
+					for (size_t r = 0; r < records.size(); ++r)
+					{
+						root.push_back(records[r]);
+					}
+
+					records.clear();
+				}
+
+				if (number_of_points < chunk.size())
+				{
+					break;
+				}
+			}
+
+			if (true == i.bad())
+			{
+				throw std::runtime_error("Reading the points failed");
+			}
+
+			if (root.m_file)
+			{
+				build(0, m_boundary, 0, root);
+			}
+			else
+			{
+				build_in_memory(0, m_boundary, 0, records);
+			}
+
+			write(o);
+		}
+
+		/**
+			Builds the subtree of the partition p whose root is node slot at
+			depth and whose points have not been read yet
+		*/
+		void build(uint64_t slot, const Boundary &boundary, int depth, partition &p)
+		{
+			if (true == fits(p.m_number_of_points))
+			{
+				std::vector<record> records(static_cast<size_t>(p.m_number_of_points));
+
+				p.m_file->seek(0);
+
+				if (records.size() * sizeof(record) != p.m_file->read(records.data(), records.size() * sizeof(record)))
+				{
+					throw std::runtime_error("Reading a temporary file failed");
+				}
+
+				p.m_file.reset();
+
+				build_in_memory(slot, boundary, depth, records);
+
+				return;
+			}
+
+			if (true == p.m_coincident || false == QuadTree::can_split(boundary, depth, m_options.m_limits))
+			{
+				write_leaf(slot, p);
+
+				return;
+			}
+
+			const uint64_t first_child = allocate(4);
+
+			write_node(slot, static_cast<uint32_t>(first_child), linear_tree::interior);
+
+			partition children[4];
+
+			for (int child = 0; child < 4; ++child)
+			{
+				children[child].m_file.reset(new temporary_file(m_options.m_temporary_directory));
+			}
+
+			const Point center = QuadTree::center(boundary);
+
+			std::vector<record> chunk(m_options.m_chunk_size);
+
+			p.m_file->seek(0);
+
+			for (size_t read; 0 != (read = p.m_file->read(&chunk[0], chunk.size() * sizeof(record)) / sizeof(record)); )
+			{
+				for (size_t r = 0; r < read; ++r)
+				{
+					children[QuadTree::quadrant(center, chunk[r].m_position)].push_back(chunk[r]);
+				}
+			}
+
+			p.m_file.reset();
+
+			for (int child = 0; child < 4; ++child)
+			{
+				build(first_child + child, QuadTree::child_boundary(boundary, center, child), depth + 1, children[child]);
+			}
+		}
+
+		/**
+			Bulk loads records into a tree of their own and appends its
+			nodes and points
+		*/
+		void build_in_memory(uint64_t slot, const Boundary &boundary, int depth, std::vector<record> &records)
+		{
+			std::vector<Point> positions(records.size());
+
+			for (size_t r = 0; r < records.size(); ++r)
+			{
+				positions[r] = records[r].m_position;
+			}
+
+			linear_tree *linear = 0;
+
+			{
+				memory_tree tree(boundary, split_limits(m_options.m_limits.m_maximum_depth - depth, m_options.m_limits.m_minimum_cell_size));
+
+				tree.bulk_load_indices(positions.begin(), positions.end());
+
+				linear = new linear_tree(tree);
+			}
+
+			const std::unique_ptr<linear_tree> owner(linear);
+
+			std::vector<Point>().swap(positions);
+
+			/*
+				The root of the subtree goes to slot, the other nodes follow
+				each other in the order of the linear tree
+			*/
+			const uint64_t first = allocate(linear->number_of_nodes() - 1);
+
+			std::vector<node> nodes(linear->m_nodes);
+
+			for (size_t index = 0; index < nodes.size(); ++index)
+			{
+				nodes[index].m_index += static_cast<uint32_t>(true == nodes[index].has_children() ? first - 1 : m_number_of_points);
+			}
+
+			write_node(slot, nodes[0].m_index, nodes[0].m_number_of_points);
+
+			if (nodes.size() > 1)
+			{
+				m_nodes.write(first * sizeof(node), &nodes[1], (nodes.size() - 1) * sizeof(node));
+			}
+
+			std::vector<uint32_t> indices(linear->number_of_points());
+
+			for (size_t index = 0; index < indices.size(); ++index)
+			{
+				indices[index] = records[linear->m_points[index]].m_index;
+			}
+
+			append_points(indices.data(), &linear->m_x[0], &linear->m_y[0], indices.size());
+		}
+
+		/**
+			Streams all points of p into one leaf
+		*/
+		void write_leaf(uint64_t slot, partition &p)
+		{
+			write_node(slot, static_cast<uint32_t>(m_number_of_points), static_cast<uint32_t>(p.m_number_of_points));
+
+			std::vector<record> chunk(m_options.m_chunk_size);
+
+			std::vector<uint32_t> indices(chunk.size());
+			std::vector<coordinate_type> x(chunk.size());
+			std::vector<coordinate_type> y(chunk.size());
+
+			p.m_file->seek(0);
+
+			for (size_t read; 0 != (read = p.m_file->read(&chunk[0], chunk.size() * sizeof(record)) / sizeof(record)); )
+			{
+				for (size_t r = 0; r < read; ++r)
+				{
+					indices[r] = chunk[r].m_index;
+					x[r] = chunk[r].m_position[0];
+					y[r] = chunk[r].m_position[1];
+				}
+
+				append_points(&indices[0], &x[0], &y[0], read);
+			}
+
+			p.m_file.reset();
+		}
+
+		inline void append_points(const uint32_t *indices, const coordinate_type *x, const coordinate_type *y, size_t number_of_points)
+		{
+			m_indices.write(indices, number_of_points * sizeof(uint32_t));
+			m_x.write(x, number_of_points * sizeof(coordinate_type));
+			m_y.write(y, number_of_points * sizeof(coordinate_type));
+
+			m_number_of_points += number_of_points;
+		}
+
+		/**
+			Reserves number_of_nodes consecutive node slots and returns the
+			first
+		*/
+		inline uint64_t allocate(uint64_t number_of_nodes)
+		{
+			const uint64_t first = m_number_of_nodes;
+
+			m_number_of_nodes += number_of_nodes;
+
+			if (m_number_of_nodes > 0xffffffffu)
+			{
+				throw std::runtime_error("Too many nodes for 32 bit indices");
+			}
+
+			return first;
+		}
+
+		inline void write_node(uint64_t slot, uint32_t index, uint32_t number_of_points)
+		{
+			node n;
+
+			n.m_index = index;
+			n.m_number_of_points = number_of_points;
+
+			m_nodes.write(slot * sizeof(node), &n, sizeof(n));
+		}
+
+		/**
+			Assembles the file from the header and the temporary files
+		*/
+		void write(std::ostream &o)
+		{
+			const mapped_header header = mapped_header::layout<coordinate_type>(m_number_of_nodes, m_number_of_points, sizeof(node));
+
+			const coordinate_type boundary[4] =
+			{
+				m_boundary.first[0],
+				m_boundary.first[1],
+				m_boundary.second[0],
+				m_boundary.second[1]
+			};
+
+			uint64_t offset = 0;
+
+			pad(o, offset, 0);
+			write(o, offset, &header, sizeof(header));
+
+			pad(o, offset, header.m_boundary_offset);
+			write(o, offset, boundary, sizeof(boundary));
+
+			pad(o, offset, header.m_nodes_offset);
+			m_nodes.copy_to(o);
+			offset += m_number_of_nodes * sizeof(node);
+
+			pad(o, offset, header.m_indices_offset);
+			m_indices.copy_to(o);
+			offset += m_number_of_points * sizeof(uint32_t);
+
+			pad(o, offset, header.m_x_offset);
+			m_x.copy_to(o);
+			offset += m_number_of_points * sizeof(coordinate_type);
+
+			pad(o, offset, header.m_y_offset);
+			m_y.copy_to(o);
+			offset += m_number_of_points * sizeof(coordinate_type);
+
+			/*
+				The padding of the y coordinates
+			*/
+			pad(o, offset, header.m_size);
+
+			if (false == static_cast<bool>(o.flush()))
+			{
+				throw std::runtime_error("Writing the tree failed");
+			}
+		}
+
+		static inline void write(std::ostream &o, uint64_t &offset, const void *data, size_t size)
+		{
+			if (false == static_cast<bool>(o.write(static_cast<const char*>(data), static_cast<std::streamsize>(size))))
+			{
+				throw std::runtime_error("Writing the tree failed");
+			}
+
+			offset += size;
+		}
+
+		/**
+			Writes zeros up to target
+		*/
+		static inline void pad(std::ostream &o, uint64_t &offset, uint64_t target)
+		{
+			const char zeros[64] = { 0 };
+
+			while (offset < target)
+			{
+				write(o, offset, zeros, static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), target - offset)));
+			}
+		}
+
+	private:
+		streaming_builder(const streaming_builder&);
+
+		streaming_builder &operator=(const streaming_builder&);
+	};
+
+	/**
+		Reads raw Points (as written by std::ostream::write()) from i until it
+		ends and writes the tree of those within boundary to o in the format
+		of save_mapped(). See streaming_builder.
+	*/
+	template<class QuadTree>
+	void build_mapped
+	(
+		std::istream &i,
+		const typename QuadTree::Boundary &boundary,
+		std::ostream &o,
+		const streaming_options &options = streaming_options()
+	)
+	{
+		streaming_builder<QuadTree> builder(boundary, options);
+
+		builder.build(i, o);
+	}
+
+	template<class QuadTree>
+	void build_mapped
+	(
+		const char *points_filename,
+		const typename QuadTree::Boundary &boundary,
+		const char *filename,
+		const streaming_options &options = streaming_options()
+	)
+	{
+		std::ifstream i(points_filename, std::ios::binary);
+
+		if (false == i.is_open())
+		{
+			throw std::runtime_error("Could not open file for reading");
+		}
+
+		std::ofstream o(filename, std::ios::binary | std::ios::trunc);
+
+		if (false == o.is_open())
+		{
+			throw std::runtime_error("Could not open file for writing");
+		}
+
+		build_mapped<QuadTree>(i, boundary, o, options);
+	}
+
+} // namespace
+
+#endif
@@ -1,53 +1,3404 @@
+/*
+	Check the operation counters too
+*/
+#define FPS_QUAD_TREE_COUNTERS
+
 #include <quad_tree/quad_tree.h>
+#include <quad_tree/linear_quad_tree.h>
+#include <quad_tree/octree.h>
+#include <quad_tree/snapshot.h>
+#include <quad_tree/concurrent_quad_tree.h>
+#include <quad_tree/mapped_quad_tree.h>
+#include <quad_tree/box_quad_tree.h>
+#include <quad_tree/streaming_build.h>
+#include <quad_tree/capacity_tuning.h>
+#include <quad_tree/parallel_query.h>
+
+#include <boost/array.hpp>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <set>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+#include <unistd.h>
+
+#include <boost/timer/timer.hpp>
+
+typedef boost::array<float, 2> Point;
+typedef std::vector<Point>::iterator PointIterator;
+
+const int capacity = 4;
+
+/*
+	Builds the tree a couple of times with the given allocation policy
+	and reports the time it took.
+*/
+template<class Allocation>
+size_t benchmark_build(const char *name, std::vector<Point> &points, int repetitions)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity, false, Allocation> quad_tree;
+
+	size_t number_of_points = 0;
+
+	boost::timer::cpu_timer timer;
+
+	for (int repetition = 0; repetition < repetitions; ++repetition)
+	{
+		quad_tree tree(points.begin(), points.end());
+
+		number_of_points = tree.number_of_points();
+	}
+
+	timer.stop();
+
+	std::cout << "build (" << name << ", " << repetitions << "x): " << timer.format();
+
+	return number_of_points;
+}
+
+/*
+	Snaps points to an integer grid so that many of them coincide and checks
+	that the tree keeps exactly one point per distinct coordinate pair when
+	CheckUniqueness is enabled.
+*/
+void test_unique_points()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity, true> quad_tree;
+
+	std::vector<Point> points;
+
+	std::set<std::pair<float, float> > distinct;
+
+	for (size_t index = 0; index < 100098; ++index)
+	{
+		Point p;
+
+		p[0] = (int)(100 * (float)rand()/RAND_MAX);
+		p[1] = (int)(100 * (float)rand()/RAND_MAX);
+
+		points.push_back(p);
+
+		distinct.insert(std::make_pair(p[0], p[1]));
+	}
+
+	quad_tree tree(points.begin(), points.end());
+
+	if (tree.number_of_points() != distinct.size())
+	{
+		throw std::logic_error("Duplicate points were not rejected");
+	}
+}
+
+Point::value_type random_coordinate(float extent)
+{
+	return extent * (float)rand()/RAND_MAX;
+}
+
+/*
+	Returns a square window of the given size somewhere within [0, 100]
+*/
+std::pair<Point, Point> random_window(float size)
+{
+	std::pair<Point, Point> window;
+
+	window.first[0] = random_coordinate(100 - size);
+	window.first[1] = random_coordinate(100 - size);
+	window.second[0] = window.first[0] + size;
+	window.second[1] = window.first[1] + size;
+
+	return window;
+}
+
+/*
+	Compares range queries against a brute force scan and afterwards times
+	a large number of small window queries.
+*/
+template<class QuadTree>
+void test_range_query(const QuadTree &tree, std::vector<Point> &points)
+{
+	std::vector<PointIterator> result;
+
+	for (int query = 0; query < 100; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(50));
+
+		result.clear();
+
+		tree.query_range(window, std::back_inserter(result));
+
+		std::set<PointIterator> expected;
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (true == QuadTree::point_intersects_boundary(*it, window))
+			{
+				expected.insert(it);
+			}
+		}
+
+		if (std::set<PointIterator>(result.begin(), result.end()) != expected || result.size() != expected.size())
+		{
+			throw std::logic_error("Range query disagrees with brute force");
+		}
+	}
+
+	const int number_of_queries = 50000;
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		windows.push_back(random_window(2));
+	}
+
+	::quad_tree::counting_visitor visitor;
+
+	boost::timer::cpu_timer timer;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		tree.visit_range(windows[query], visitor);
+	}
+
+	timer.stop();
+
+	std::cout << "range query (" << number_of_queries << "x, " << visitor.m_count << " points): " << timer.format();
+}
+
+/*
+	Compares nearest() against sorting all points by distance and then
+	times a batch of queries reusing one scratch object.
+*/
+template<class QuadTree>
+void test_nearest(const QuadTree &tree, std::vector<Point> &points)
+{
+	typename QuadTree::nearest_scratch scratch;
+
+	std::vector<PointIterator> result;
+
+	std::vector<double> expected;
+
+	for (int query = 0; query < 100; ++query)
+	{
+		Point p;
+
+		p[0] = random_coordinate(120) - 10;
+		p[1] = random_coordinate(120) - 10;
+
+		const size_t k = 1 + query % 16;
+
+		result.clear();
+
+		tree.nearest(p, k, std::back_inserter(result), scratch);
+
+		expected.clear();
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			expected.push_back(QuadTree::squared_distance(p, *it));
+		}
+
+		std::sort(expected.begin(), expected.end());
+
+		if (result.size() != k)
+		{
+			throw std::logic_error("nearest() returned the wrong number of points");
+		}
+
+		for (size_t index = 0; index < k; ++index)
+		{
+			if (QuadTree::squared_distance(p, *result[index]) != expected[index])
+			{
+				throw std::logic_error("nearest() disagrees with brute force");
+			}
+		}
+	}
+
+	const int number_of_queries = 20000;
+
+	std::vector<Point> queries;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		queries.push_back(p);
+	}
+
+	boost::timer::cpu_timer timer;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		result.clear();
+
+		tree.nearest(queries[query], 8, std::back_inserter(result), scratch);
+	}
+
+	timer.stop();
+
+	std::cout << "nearest (" << number_of_queries << "x, k = 8): " << timer.format();
+}
+
+/*
+	Compares building the tree by bulk loading (what the range constructor
+	does) with adding the points one by one and checks that the trees
+	agree.
+*/
+void test_bulk_load(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	const int repetitions = 5;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	boost::timer::cpu_timer add_timer;
+
+	for (int repetition = 0; repetition < repetitions; ++repetition)
+	{
+		quad_tree tree(boundary);
+
+		tree.add(points.begin(), points.end());
+	}
+
+	add_timer.stop();
+
+	boost::timer::cpu_timer bulk_load_timer;
+
+	for (int repetition = 0; repetition < repetitions; ++repetition)
+	{
+		quad_tree tree(boundary, points.begin(), points.end());
+	}
+
+	bulk_load_timer.stop();
+
+	std::cout << "build (add(), " << repetitions << "x): " << add_timer.format();
+	std::cout << "build (bulk_load(), " << repetitions << "x): " << bulk_load_timer.format();
+
+	quad_tree added(boundary);
+
+	added.add(points.begin(), points.end());
+
+	quad_tree loaded(boundary, points.begin(), points.end());
+
+	if (added.number_of_points() != loaded.number_of_points())
+	{
+		throw std::logic_error("bulk_load() lost points");
+	}
+
+	for (int query = 0; query < 1000; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(10));
+
+		std::vector<PointIterator> added_result;
+		std::vector<PointIterator> loaded_result;
+
+		added.query_range(window, std::back_inserter(added_result));
+		loaded.query_range(window, std::back_inserter(loaded_result));
+
+		std::sort(added_result.begin(), added_result.end());
+		std::sort(loaded_result.begin(), loaded_result.end());
+
+		if (added_result != loaded_result)
+		{
+			throw std::logic_error("bulk_load() and add() disagree");
+		}
+	}
+}
+
+/*
+	Builds the tree with several threads and checks that it agrees with the
+	one built on a single thread
+*/
+void test_parallel_build(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	const unsigned number_of_threads = 4;
+
+	boost::timer::cpu_timer timer;
+
+	quad_tree parallel(points.begin(), points.end(), number_of_threads);
+
+	timer.stop();
+
+	std::cout << "build (bulk_load(), " << number_of_threads << " threads): " << timer.format();
+
+	quad_tree sequential(points.begin(), points.end());
+
+	if (parallel.number_of_points() != sequential.number_of_points())
+	{
+		throw std::logic_error("Parallel build lost points");
+	}
+
+	for (int query = 0; query < 1000; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(10));
+
+		std::vector<PointIterator> parallel_result;
+		std::vector<PointIterator> sequential_result;
+
+		parallel.query_range(window, std::back_inserter(parallel_result));
+		sequential.query_range(window, std::back_inserter(sequential_result));
+
+		if (parallel_result != sequential_result)
+		{
+			throw std::logic_error("Parallel and sequential build disagree");
+		}
+	}
+}
+
+/*
+	Checks that the linear copy of tree answers range queries like tree
+	itself, shows how much smaller it is and times the same window queries
+	as test_range_query().
+*/
+template<class QuadTree>
+void test_linear_quad_tree(const QuadTree &tree)
+{
+	typedef quad_tree::linear_quad_tree<QuadTree> linear_quad_tree;
+
+	const linear_quad_tree linear = quad_tree::freeze(tree);
+
+	const quad_tree::node_layout layouts[] = { quad_tree::breadth_first_layout, quad_tree::depth_first_layout, quad_tree::van_emde_boas_layout };
+
+	for (int layout = 0; layout < 3; ++layout)
+	{
+		const linear_quad_tree relaid = quad_tree::freeze(tree, layouts[layout]);
+
+		if (relaid.number_of_points() != tree.number_of_points() || relaid.number_of_nodes() != linear.number_of_nodes())
+		{
+			throw std::logic_error("freeze() lost points");
+		}
+
+		for (int query = 0; query < 1000; ++query)
+		{
+			const std::pair<Point, Point> window = random_window(random_coordinate(10));
+
+			std::vector<PointIterator> result;
+			std::vector<PointIterator> linear_result;
+
+			tree.query_range(window, std::back_inserter(result));
+			relaid.query_range(window, std::back_inserter(linear_result));
+
+			std::sort(result.begin(), result.end());
+			std::sort(linear_result.begin(), linear_result.end());
+
+			if (result != linear_result)
+			{
+				throw std::logic_error("Linear tree disagrees");
+			}
+		}
+	}
+
+	std::cout
+		<< "nodes: " << linear.number_of_nodes()
+		<< ", pointer tree: " << linear.number_of_nodes() * sizeof(typename QuadTree::node) << " bytes"
+		<< ", linear tree: " << linear.number_of_nodes() * sizeof(typename linear_quad_tree::node) + linear.number_of_points() * (sizeof(PointIterator) + sizeof(Point)) << " bytes"
+		<< std::endl;
+
+	const int number_of_queries = 50000;
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		windows.push_back(random_window(2));
+	}
+
+	::quad_tree::counting_visitor visitor;
+
+	boost::timer::cpu_timer timer;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		linear.visit_range(windows[query], visitor);
+	}
+
+	timer.stop();
+
+	std::cout << "range query (linear, " << number_of_queries << "x, " << visitor.m_count << " points): " << timer.format();
+}
+
+/*
+	Checks query_ranges() against query_range() one window at a time and
+	compares the time it takes for a batch of small windows.
+*/
+template<class QuadTree>
+void test_batch_query(const QuadTree &tree)
+{
+	const int number_of_queries = 50000;
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		windows.push_back(random_window(query % 100 == 0 ? random_coordinate(20) : 2));
+	}
+
+	typename QuadTree::batch_scratch scratch;
+
+	std::vector<size_t> offsets;
+
+	std::vector<PointIterator> results;
+
+	boost::timer::cpu_timer timer;
+
+	tree.query_ranges(&windows[0], windows.size(), offsets, results, scratch);
+
+	timer.stop();
+
+	std::cout << "batch range query (" << number_of_queries << " windows, " << results.size() << " points): " << timer.format();
+
+	if (offsets.size() != windows.size() + 1 || offsets.back() != results.size())
+	{
+		throw std::logic_error("Batch query offsets do not cover the queries");
+	}
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		std::vector<PointIterator> result;
+
+		tree.query_range(windows[query], std::back_inserter(result));
+
+		if (result.size() != offsets[query + 1] - offsets[query] || false == std::equal(result.begin(), result.end(), results.begin() + offsets[query]))
+		{
+			throw std::logic_error("Batch query disagrees with single query");
+		}
+	}
+}
+
+/*
+	Filters random leaves of 16 points against random windows with the
+	scalar and the SIMD interval filter, checks that they agree and compares
+	their speed.
+*/
+void test_simd_filter()
+{
+	typedef Point::value_type coordinate;
+
+	const int leaf_size = 16;
+
+	const int number_of_leaves = 4096;
+
+	std::vector<coordinate> x(leaf_size * number_of_leaves + quad_tree::simd_lane_padding);
+	std::vector<coordinate> y(leaf_size * number_of_leaves + quad_tree::simd_lane_padding);
+
+	for (size_t index = 0; index < x.size(); ++index)
+	{
+		x[index] = random_coordinate(100);
+		y[index] = random_coordinate(100);
+	}
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int window = 0; window < 64; ++window)
+	{
+		windows.push_back(random_window(random_coordinate(60)));
+	}
+
+	for (size_t window = 0; window < windows.size(); ++window)
+	{
+		for (int leaf = 0; leaf < number_of_leaves; ++leaf)
+		{
+			const int count = 1 + leaf % leaf_size;
+
+			const uint64_t scalar = quad_tree::boundary_mask<quad_tree::scalar_interval_filter>(&x[leaf * leaf_size], &y[leaf * leaf_size], count, windows[window]);
+			const uint64_t simd = quad_tree::boundary_mask<quad_tree::interval_filter>(&x[leaf * leaf_size], &y[leaf * leaf_size], count, windows[window]);
+
+			if (scalar != simd)
+			{
+				throw std::logic_error("SIMD and scalar filter disagree");
+			}
+		}
+	}
+
+	const int repetitions = 10;
+
+	uint64_t scalar_hits = 0;
+
+	boost::timer::cpu_timer scalar_timer;
+
+	for (int repetition = 0; repetition < repetitions; ++repetition)
+	{
+		for (size_t window = 0; window < windows.size(); ++window)
+		{
+			for (int leaf = 0; leaf < number_of_leaves; ++leaf)
+			{
+				scalar_hits += quad_tree::boundary_mask<quad_tree::scalar_interval_filter>(&x[leaf * leaf_size], &y[leaf * leaf_size], leaf_size, windows[window]) & 1;
+			}
+		}
+	}
+
+	scalar_timer.stop();
+
+	uint64_t simd_hits = 0;
+
+	boost::timer::cpu_timer simd_timer;
+
+	for (int repetition = 0; repetition < repetitions; ++repetition)
+	{
+		for (size_t window = 0; window < windows.size(); ++window)
+		{
+			for (int leaf = 0; leaf < number_of_leaves; ++leaf)
+			{
+				simd_hits += quad_tree::boundary_mask<quad_tree::interval_filter>(&x[leaf * leaf_size], &y[leaf * leaf_size], leaf_size, windows[window]) & 1;
+			}
+		}
+	}
+
+	simd_timer.stop();
+
+	if (scalar_hits != simd_hits)
+	{
+		throw std::logic_error("SIMD and scalar filter disagree");
+	}
+
+	std::cout << "leaf filter (scalar): " << scalar_timer.format();
+	std::cout << "leaf filter (simd): " << simd_timer.format();
+}
+
+/*
+	Checks that every window query on tree returns exactly the points in
+	[begin, end) flagged in present
+*/
+template<class QuadTree>
+void check_against_brute_force(const QuadTree &tree, PointIterator begin, PointIterator end, const std::vector<bool> &present, int number_of_queries)
+{
+	size_t number_of_present = 0;
+
+	for (PointIterator it = begin; it != end; ++it)
+	{
+		number_of_present += present[it - begin];
+	}
+
+	if (tree.number_of_points() != number_of_present)
+	{
+		throw std::logic_error("Tree holds the wrong number of points");
+	}
+
+	for (int query = 0; query < number_of_queries; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(30));
+
+		std::vector<PointIterator> result;
+
+		tree.query_range(window, std::back_inserter(result));
+
+		std::vector<PointIterator> expected;
+
+		for (PointIterator it = begin; it != end; ++it)
+		{
+			if (true == present[it - begin] && true == QuadTree::point_intersects_boundary(*it, window))
+			{
+				expected.push_back(it);
+			}
+		}
+
+		std::sort(result.begin(), result.end());
+
+		if (result != expected)
+		{
+			throw std::logic_error("Tree disagrees with brute force");
+		}
+	}
+}
+
+/*
+	Checks that every node below n counts the points in its subtree and
+	returns that number
+*/
+template<class Node>
+size_t check_subtree_points(const Node &n)
+{
+	size_t number = n.leaf_size();
+
+	if (true == n.has_children())
+	{
+		number +=
+			check_subtree_points(*n.m_north_west) +
+			check_subtree_points(*n.m_north_east) +
+			check_subtree_points(*n.m_south_west) +
+			check_subtree_points(*n.m_south_east);
+	}
+
+	if (n.m_subtree_points != number)
+	{
+		throw std::logic_error("Node miscounts the points below it");
+	}
+
+	return number;
+}
+
+/*
+	Moves points around by small and large amounts, removes some and
+	checks the tree after each round. Finally removes all points and
+	checks that the tree collapsed back into a single leaf.
+*/
+void test_remove_and_update()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 20000; ++index)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree tree(boundary, points.begin(), points.end());
+
+	std::vector<bool> present(points.size(), true);
+
+	for (int round = 0; round < 5; ++round)
+	{
+		for (size_t index = 0; index < points.size(); ++index)
+		{
+			if (false == present[index])
+			{
+				continue;
+			}
+
+			const float step = (index % 10 == 0) ? 50 : 0.1;
+
+			/*
+				Steps leaving the boundary are mirrored back in rather than
+				clamped, which would pile points up on the corners
+			*/
+			Point p = points[index];
+
+			for (int dimension = 0; dimension < 2; ++dimension)
+			{
+				p[dimension] += random_coordinate(2 * step) - step;
+
+				if (p[dimension] < 0 || p[dimension] > 100)
+				{
+					p[dimension] = (p[dimension] < 0) ? -p[dimension] : 200 - p[dimension];
+				}
+			}
+
+			if (false == tree.update(points.begin() + index, p))
+			{
+				throw std::logic_error("update() failed");
+			}
+
+			points[index] = p;
+		}
+
+		for (size_t index = round; index < points.size(); index += 7)
+		{
+			if (true == present[index] && false == tree.remove(points.begin() + index))
+			{
+				throw std::logic_error("remove() failed");
+			}
+
+			present[index] = false;
+		}
+
+		check_against_brute_force(tree, points.begin(), points.end(), present, 200);
+
+		check_subtree_points(*tree.m_root);
+	}
+
+	for (size_t index = 0; index < points.size(); ++index)
+	{
+		if (true == present[index] && false == tree.remove(points.begin() + index))
+		{
+			throw std::logic_error("remove() failed");
+		}
+	}
+
+	if (0 != tree.number_of_points() || true == tree.m_root->has_children())
+	{
+		throw std::logic_error("Empty tree did not collapse");
+	}
+}
+
+/*
+	Returns the depth of the deepest node below n
+*/
+template<class Node>
+int depth(const Node &n)
+{
+	if (false == n.has_children())
+	{
+		return 0;
+	}
+
+	return 1 + std::max
+	(
+		std::max(depth(*n.m_north_west), depth(*n.m_north_east)),
+		std::max(depth(*n.m_south_west), depth(*n.m_south_east))
+	);
+}
+
+/*
+	Builds trees from points snapped to a coarse grid, so that many points
+	share their coordinates, with and without a depth limit, both by add()
+	and by bulk_load(). Then removes all points again.
+*/
+void test_duplicates_and_depth_limit()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 20000; ++index)
+	{
+		Point p;
+
+		p[0] = (int)random_coordinate(20) * 5;
+		p[1] = (int)random_coordinate(20) * 5;
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	const std::vector<bool> present(points.size(), true);
+
+	const int maximum_depths[] = { ::quad_tree::maximum_depth_limit, 3 };
+
+	for (int limit = 0; limit < 2; ++limit)
+	{
+		const ::quad_tree::split_limits limits(maximum_depths[limit]);
+
+		quad_tree bulk_tree(boundary, points.begin(), points.end(), 1, limits);
+
+		quad_tree added_tree(boundary, limits);
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (false == added_tree.add(it))
+			{
+				throw std::logic_error("Duplicate point was rejected");
+			}
+		}
+
+		check_against_brute_force(bulk_tree, points.begin(), points.end(), present, 200);
+		check_against_brute_force(added_tree, points.begin(), points.end(), present, 200);
+
+		check_subtree_points(*bulk_tree.m_root);
+		check_subtree_points(*added_tree.m_root);
+
+		if (depth(*bulk_tree.m_root) > maximum_depths[limit] || depth(*added_tree.m_root) > maximum_depths[limit])
+		{
+			throw std::logic_error("Depth limit exceeded");
+		}
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (false == added_tree.remove(it))
+			{
+				throw std::logic_error("remove() failed");
+			}
+		}
+
+		if (0 != added_tree.number_of_points() || true == added_tree.m_root->has_children())
+		{
+			throw std::logic_error("Empty tree did not collapse");
+		}
+	}
+
+	try
+	{
+		quad_tree tree(boundary, ::quad_tree::split_limits(::quad_tree::maximum_depth_limit + 1));
+
+		throw std::logic_error("Invalid depth limit was accepted");
+	}
+	catch (std::runtime_error &)
+	{
+
+	}
+}
+
+/*
+	Checks that no leaf below n holds more than its leaf_capacity() unless
+	it may not be split
+*/
+template<class QuadTree>
+void check_leaf_capacities(const QuadTree &tree, const typename QuadTree::node &n)
+{
+	if (true == n.has_children())
+	{
+		check_leaf_capacities(tree, *n.m_north_west);
+		check_leaf_capacities(tree, *n.m_north_east);
+		check_leaf_capacities(tree, *n.m_south_west);
+		check_leaf_capacities(tree, *n.m_south_east);
+		return;
+	}
+
+	if
+	(
+		n.leaf_size() > static_cast<size_t>(tree.leaf_capacity(n.m_depth)) &&
+		false == n.m_coincident &&
+		true == tree.can_split(n, n.m_depth)
+	)
+	{
+		throw std::logic_error("Leaf holds more than its capacity");
+	}
+}
+
+/*
+	Bulk loads a bucket of coincident points, checks that it is flagged
+	like one built by add() and then spreads its points out with update()
+*/
+void test_bulk_loaded_coincident_points()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 200; ++index)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		points.push_back(p);
+	}
+
+	Point corner;
+
+	corner[0] = corner[1] = 10;
+
+	const size_t first_coincident = points.size();
+
+	points.insert(points.end(), 3 * capacity, corner);
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree bulk_tree(boundary, points.begin(), points.end());
+
+	quad_tree added_tree(boundary);
+
+	added_tree.add(points.begin(), points.end());
+
+	const quad_tree::node *bulk_leaf = &*bulk_tree.m_root;
+	const quad_tree::node *added_leaf = &*added_tree.m_root;
+
+	for (; true == bulk_leaf->has_children(); bulk_leaf = &quad_tree::child(*bulk_leaf, corner));
+	for (; true == added_leaf->has_children(); added_leaf = &quad_tree::child(*added_leaf, corner));
+
+	if (false == bulk_leaf->m_coincident || false == added_leaf->m_coincident || bulk_leaf->m_depth != added_leaf->m_depth)
+	{
+		throw std::logic_error("Bulk loaded bucket of coincident points is not flagged like an added one");
+	}
+
+	for (size_t index = first_coincident; index < points.size(); ++index)
+	{
+		Point moved = corner;
+
+		moved[0] += 0.01f * (index - first_coincident);
+		moved[1] += 0.02f * (index - first_coincident);
+
+		if (false == bulk_tree.update(points.begin() + index, moved))
+		{
+			throw std::logic_error("update() lost a point of a bulk loaded bucket");
+		}
+
+		points[index] = moved;
+	}
+
+	const std::vector<bool> present(points.size(), true);
+
+	check_against_brute_force(bulk_tree, points.begin(), points.end(), present, 200);
+
+	check_subtree_points(*bulk_tree.m_root);
+	check_leaf_capacities(bulk_tree, *bulk_tree.m_root);
+}
+
+/*
+	Returns the number of dirty leaves below n
+*/
+template<class Node>
+size_t number_of_dirty_leaves(const Node &n)
+{
+	if (false == n.has_children())
+	{
+		return n.m_dirty;
+	}
+
+	return
+		number_of_dirty_leaves(*n.m_north_west) +
+		number_of_dirty_leaves(*n.m_north_east) +
+		number_of_dirty_leaves(*n.m_south_west) +
+		number_of_dirty_leaves(*n.m_south_east);
+}
+
+/*
+	Ingests points with and without lazy splitting, queries a small part
+	of the lazy tree only and checks that refining it yields the same
+	nodes as splitting eagerly
+*/
+void test_lazy_splitting()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 100000; ++index)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree eager_tree(boundary);
+
+	quad_tree lazy_tree(boundary);
+
+	lazy_tree.set_lazy_splitting(true);
+
+	{
+		boost::timer::cpu_timer timer;
+
+		eager_tree.add(points.begin(), points.end());
+
+		std::cout << "add() (eager): " << timer.format();
+	}
+
+	{
+		boost::timer::cpu_timer timer;
+
+		lazy_tree.add(points.begin(), points.end());
+
+		std::cout << "add() (lazy): " << timer.format();
+	}
+
+	if (0 == number_of_dirty_leaves(*lazy_tree.m_root))
+	{
+		throw std::logic_error("Lazy tree has no dirty leaves");
+	}
+
+	for (int query = 0; query < 100; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(1);
+
+		std::vector<PointIterator> expected;
+		std::vector<PointIterator> result;
+
+		eager_tree.query_range(window, std::back_inserter(expected));
+		lazy_tree.query_range(window, std::back_inserter(result));
+
+		std::sort(expected.begin(), expected.end());
+		std::sort(result.begin(), result.end());
+
+		if (result != expected)
+		{
+			throw std::logic_error("Lazy tree disagrees with eager tree");
+		}
+	}
+
+	const std::vector<bool> present(points.size(), true);
+
+	check_against_brute_force(lazy_tree, points.begin(), points.end(), present, 100);
+
+	lazy_tree.refine();
+
+	if (0 != number_of_dirty_leaves(*lazy_tree.m_root))
+	{
+		throw std::logic_error("refine() left dirty leaves");
+	}
+
+	if (freeze(lazy_tree).number_of_nodes() != freeze(eager_tree).number_of_nodes())
+	{
+		throw std::logic_error("Refined tree differs from eager tree");
+	}
+}
+
+/*
+	Compares the interval filter for an integer type against the scalar one
+	on lanes spanning the whole range of the type
+*/
+template<class Integer>
+void test_integer_filter()
+{
+	std::vector<Integer> lane(64 + quad_tree::simd_lane_padding);
+
+	for (int round = 0; round < 1000; ++round)
+	{
+		for (size_t index = 0; index < lane.size(); ++index)
+		{
+			lane[index] = static_cast<Integer>(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+		}
+
+		Integer low = static_cast<Integer>(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+		Integer high = static_cast<Integer>(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+
+		if (high < low)
+		{
+			std::swap(low, high);
+		}
+
+		const int count = 1 + round % 64;
+
+		if (quad_tree::scalar_interval_filter<Integer>::mask(&lane[0], count, low, high) != quad_tree::interval_filter<Integer>::mask(&lane[0], count, low, high))
+		{
+			throw std::logic_error("SIMD and scalar integer filter disagree");
+		}
+	}
+}
+
+/*
+	Checks a tree over unsigned integer coordinates, whose centers and
+	Morton keys are computed with shifts, against brute force
+*/
+void test_integer_coordinates()
+{
+	typedef boost::array<uint32_t, 2> IntegerPoint;
+
+	typedef std::vector<IntegerPoint>::iterator IntegerPointIterator;
+
+	typedef quad_tree::point_quad_tree<IntegerPoint, IntegerPointIterator, capacity> quad_tree;
+
+	test_integer_filter<int32_t>();
+	test_integer_filter<uint32_t>();
+
+	std::vector<IntegerPoint> points;
+
+	for (size_t index = 0; index < 50000; ++index)
+	{
+		IntegerPoint p;
+
+		p[0] = rand() % (1 << 20);
+		p[1] = rand() % (1 << 20);
+
+		points.push_back(p);
+	}
+
+	std::pair<IntegerPoint, IntegerPoint> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 1 << 20;
+
+	quad_tree added(boundary);
+
+	added.add(points.begin(), points.end());
+
+	quad_tree loaded(boundary, points.begin(), points.end());
+
+	if (loaded.number_of_points() != points.size() || added.number_of_points() != points.size())
+	{
+		throw std::logic_error("Integer tree lost points");
+	}
+
+	for (int query = 0; query < 200; ++query)
+	{
+		std::pair<IntegerPoint, IntegerPoint> window;
+
+		window.first[0] = rand() % (1 << 20);
+		window.first[1] = rand() % (1 << 20);
+		window.second[0] = window.first[0] + rand() % (1 << 16);
+		window.second[1] = window.first[1] + rand() % (1 << 16);
+
+		std::vector<IntegerPointIterator> expected;
+
+		for (IntegerPointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (true == quad_tree::point_intersects_boundary(*it, window))
+			{
+				expected.push_back(it);
+			}
+		}
+
+		std::vector<IntegerPointIterator> added_result;
+		std::vector<IntegerPointIterator> loaded_result;
+
+		added.query_range(window, std::back_inserter(added_result));
+		loaded.query_range(window, std::back_inserter(loaded_result));
+
+		std::sort(added_result.begin(), added_result.end());
+		std::sort(loaded_result.begin(), loaded_result.end());
+
+		if (added_result != expected || loaded_result != expected)
+		{
+			throw std::logic_error("Integer tree disagrees with brute force");
+		}
+	}
+}
+
+/*
+	Checks range queries, nearest neighbours and removal on an octree of
+	three dimensional points against brute force
+*/
+void test_octree()
+{
+	typedef boost::array<float, 3> SpatialPoint;
+
+	typedef std::vector<SpatialPoint>::iterator SpatialPointIterator;
+
+	typedef quad_tree::point_octree<SpatialPoint, SpatialPointIterator, capacity> octree;
+
+	/*
+		Leaves of more than 64 points are filtered in several blocks
+	*/
+	typedef quad_tree::point_octree<SpatialPoint, SpatialPointIterator, 100> wide_octree;
+
+	std::vector<SpatialPoint> points;
+
+	for (size_t index = 0; index < 50000; ++index)
+	{
+		SpatialPoint p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+		p[2] = (int)random_coordinate(10);
+
+		points.push_back(p);
+	}
+
+	std::pair<SpatialPoint, SpatialPoint> boundary;
+
+	boundary.first[0] = boundary.first[1] = boundary.first[2] = 0;
+	boundary.second[0] = boundary.second[1] = boundary.second[2] = 100;
+
+	octree tree(boundary, points.begin(), points.end());
+
+	wide_octree wide_tree(boundary, points.begin(), points.end());
+
+	if (tree.number_of_points() != points.size() || wide_tree.number_of_points() != points.size())
+	{
+		throw std::logic_error("Octree lost points");
+	}
+
+	for (int query = 0; query < 200; ++query)
+	{
+		std::pair<SpatialPoint, SpatialPoint> window;
+
+		for (int dimension = 0; dimension < 3; ++dimension)
+		{
+			window.first[dimension] = random_coordinate(90);
+			window.second[dimension] = window.first[dimension] + random_coordinate(10);
+		}
+
+		std::vector<SpatialPointIterator> expected;
+
+		for (SpatialPointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (true == octree::point_intersects_boundary(*it, window))
+			{
+				expected.push_back(it);
+			}
+		}
+
+		std::vector<SpatialPointIterator> result;
+
+		tree.query_range(window, std::back_inserter(result));
+
+		std::sort(result.begin(), result.end());
+
+		std::vector<SpatialPointIterator> wide_result;
+
+		wide_tree.query_range(window, std::back_inserter(wide_result));
+
+		std::sort(wide_result.begin(), wide_result.end());
+
+		if (result != expected || wide_result != expected)
+		{
+			throw std::logic_error("Octree disagrees with brute force");
+		}
+
+		std::vector<SpatialPointIterator> nearest;
+
+		tree.nearest(window.first, 5, std::back_inserter(nearest));
+
+		std::vector<double> distances;
+
+		for (SpatialPointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			double distance = 0;
+
+			for (int dimension = 0; dimension < 3; ++dimension)
+			{
+				const double delta = (double)(*it)[dimension] - (double)window.first[dimension];
+
+				distance += delta * delta;
+			}
+
+			distances.push_back(distance);
+		}
+
+		std::sort(distances.begin(), distances.end());
+
+		const double furthest = octree::squared_distance(window.first, std::make_pair(*nearest.back(), *nearest.back()));
+
+		if (5 != nearest.size() || furthest != distances[4])
+		{
+			throw std::logic_error("Octree nearest neighbours disagree with brute force");
+		}
+	}
+
+	for (SpatialPointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		if (false == tree.remove(it))
+		{
+			throw std::logic_error("remove() failed");
+		}
+	}
+
+	if (0 != tree.number_of_points() || true == tree.m_root->has_children())
+	{
+		throw std::logic_error("Empty octree did not collapse");
+	}
+}
+
+/*
+	Reads the current tree of a tree_snapshots over and over and checks that
+	it is one complete version
+*/
+template<class Snapshots>
+struct snapshot_reader
+{
+	Snapshots &m_snapshots;
+
+	const std::pair<Point, Point> &m_boundary;
+
+	const std::atomic<bool> &m_done;
+
+	size_t &m_reads;
+
+	bool &m_failed;
+
+	snapshot_reader(Snapshots &snapshots, const std::pair<Point, Point> &boundary, const std::atomic<bool> &done, size_t &reads, bool &failed)
+	:
+		m_snapshots(snapshots),
+		m_boundary(boundary),
+		m_done(done),
+		m_reads(reads),
+		m_failed(failed)
+	{
+
+	}
+
+	void operator()()
+	{
+		while (false == m_done.load())
+		{
+			typename Snapshots::read_guard guard(m_snapshots);
+
+			::quad_tree::counting_visitor visitor;
+
+			guard->visit_range(m_boundary, visitor);
+
+			if (visitor.m_count != guard->number_of_points() || 0 != visitor.m_count % 1000)
+			{
+				m_failed = true;
+			}
+
+			++m_reads;
+		}
+	}
+};
+
+/*
+	Queries snapshots from several threads while a writer keeps publishing
+	trees with more and more points
+*/
+void test_snapshots()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	typedef ::quad_tree::tree_snapshots<quad_tree> snapshots_type;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 20000; ++index)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	snapshots_type snapshots(new quad_tree(boundary, points.begin(), points.begin() + 1000));
+
+	std::atomic<bool> done(false);
+
+	const int number_of_readers = 4;
+
+	std::vector<size_t> reads(number_of_readers, 0);
+
+	bool failed[number_of_readers] = { false };
+
+	std::vector<std::thread> readers;
+
+	for (int reader = 0; reader < number_of_readers; ++reader)
+	{
+		readers.push_back(std::thread(snapshot_reader<snapshots_type>(snapshots, boundary, done, reads[reader], failed[reader])));
+	}
+
+	for (size_t size = 2000; size <= points.size(); size += 1000)
+	{
+		quad_tree *tree = new quad_tree(boundary);
+
+		tree->set_lazy_splitting(true);
+
+		tree->add(points.begin(), points.begin() + size);
+
+		snapshots.publish(tree);
+	}
+
+	done.store(true);
+
+	for (int reader = 0; reader < number_of_readers; ++reader)
+	{
+		readers[reader].join();
+
+		if (true == failed[reader])
+		{
+			throw std::logic_error("Reader saw an incomplete tree");
+		}
+	}
+
+	snapshots.reclaim();
+
+	if (0 != snapshots.number_of_retired())
+	{
+		throw std::logic_error("Replaced trees were not reclaimed");
+	}
+
+	snapshots_type::read_guard guard(snapshots);
+
+	if (points.size() != guard->number_of_points())
+	{
+		throw std::logic_error("Last published tree is not current");
+	}
+}
+
+/*
+	Adds every number_of_threads-th point starting at first to tree
+*/
+template<class Tree>
+struct concurrent_adder
+{
+	Tree &m_tree;
+
+	PointIterator m_begin;
+
+	PointIterator m_end;
+
+	size_t m_first;
+
+	size_t m_step;
+
+	concurrent_adder(Tree &tree, PointIterator begin, PointIterator end, size_t first, size_t step)
+	:
+		m_tree(tree),
+		m_begin(begin),
+		m_end(end),
+		m_first(first),
+		m_step(step)
+	{
+
+	}
+
+	void operator()()
+	{
+		for (size_t index = m_first; index < static_cast<size_t>(m_end - m_begin); index += m_step)
+		{
+			m_tree.add(m_begin + index);
+		}
+	}
+};
+
+/*
+	Builds concurrent trees with an increasing number of writer threads
+	while another thread queries them, and checks the results against
+	brute force
+*/
+void test_concurrent_add(std::vector<Point> &points)
+{
+	typedef quad_tree::concurrent_point_quad_tree<Point, PointIterator, capacity> concurrent_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	const std::vector<bool> present(points.size(), true);
+
+	for (unsigned number_of_threads = 1; number_of_threads <= 16; number_of_threads *= 2)
+	{
+		concurrent_tree tree(boundary);
+
+		std::vector<std::thread> threads;
+
+		boost::timer::cpu_timer timer;
+
+		for (unsigned thread = 0; thread < number_of_threads; ++thread)
+		{
+			threads.push_back(std::thread(concurrent_adder<concurrent_tree>(tree, points.begin(), points.end(), thread, number_of_threads)));
+		}
+
+		size_t seen = 0;
+
+		for (int query = 0; query < 100; ++query)
+		{
+			std::vector<PointIterator> result;
+
+			tree.query_range(random_window(random_coordinate(30)), std::back_inserter(result));
+
+			seen += result.size();
+		}
+
+		for (size_t thread = 0; thread < threads.size(); ++thread)
+		{
+			threads[thread].join();
+		}
+
+		timer.stop();
+
+		std::cout << "concurrent add() (" << number_of_threads << " threads, " << seen << " points seen while adding): " << timer.format();
+
+		check_against_brute_force(tree, points.begin(), points.end(), present, 100);
+	}
+}
+
+/*
+	Saves a frozen tree, maps the file and checks that the mapped tree
+	reports the same points in the same order as the linear tree
+*/
+template<class QuadTree>
+void test_mapped_quad_tree(const QuadTree &tree, std::vector<Point> &points)
+{
+	typedef quad_tree::linear_quad_tree<QuadTree> linear_quad_tree;
+
+	typedef quad_tree::mapped_quad_tree<QuadTree> mapped_quad_tree;
+
+	const linear_quad_tree linear = quad_tree::freeze(tree);
+
+	char filename[] = "/tmp/test_quad_tree.XXXXXX";
+
+	const int file = mkstemp(filename);
+
+	if (-1 == file)
+	{
+		throw std::runtime_error("Could not create a temporary file");
+	}
+
+	close(file);
+
+	quad_tree::save_mapped(linear, points.begin(), filename);
+
+	{
+		boost::timer::cpu_timer timer;
+
+		const quad_tree::mapped_file mapped(filename);
+
+		const mapped_quad_tree mapped_tree(mapped);
+
+		timer.stop();
+
+		std::cout << "open (mapped, " << mapped.m_size << " bytes): " << timer.format();
+
+		if (mapped_tree.number_of_points() != linear.number_of_points() || mapped_tree.number_of_nodes() != linear.number_of_nodes())
+		{
+			throw std::logic_error("Mapped tree differs in size");
+		}
+
+		for (int query = 0; query < 1000; ++query)
+		{
+			const std::pair<Point, Point> window = random_window(random_coordinate(10));
+
+			std::vector<PointIterator> linear_result;
+			std::vector<uint32_t> mapped_result;
+
+			linear.query_range(window, std::back_inserter(linear_result));
+			mapped_tree.query_range(window, std::back_inserter(mapped_result));
+
+			if (linear_result.size() != mapped_result.size())
+			{
+				throw std::logic_error("Mapped tree disagrees with linear tree");
+			}
+
+			for (size_t index = 0; index < mapped_result.size(); ++index)
+			{
+				if (points.begin() + mapped_result[index] != linear_result[index])
+				{
+					throw std::logic_error("Mapped tree disagrees with linear tree");
+				}
+			}
+		}
+
+		std::vector<char> corrupt(static_cast<const char*>(mapped.m_data), static_cast<const char*>(mapped.m_data) + mapped.m_size);
+
+		corrupt[0] = 'X';
+
+		try
+		{
+			mapped_quad_tree corrupt_tree(&corrupt[0], corrupt.size());
+
+			throw std::logic_error("Corrupt file was accepted");
+		}
+		catch (std::runtime_error &)
+		{
+
+		}
+
+		try
+		{
+			mapped_quad_tree truncated_tree(mapped.m_data, mapped.m_size / 2);
+
+			throw std::logic_error("Truncated file was accepted");
+		}
+		catch (std::runtime_error &)
+		{
+
+		}
+	}
+
+	unlink(filename);
+}
+
+/*
+	Builds a tree of indices into points and checks it against a tree of
+	iterators, then moves, removes and adds points by index
+*/
+void test_index_references(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> iterator_tree;
+
+	typedef quad_tree::point_quad_tree<Point, uint32_t, capacity> index_tree;
+
+	std::cout << "node size (iterators): " << sizeof(iterator_tree::node) << " bytes, node size (indices): " << sizeof(index_tree::node) << " bytes" << std::endl;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	iterator_tree iterators(boundary);
+
+	iterators.bulk_load(points.begin(), points.end());
+
+	index_tree indices(boundary);
+
+	{
+		boost::timer::auto_cpu_timer t("bulk_load (indices): %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		indices.bulk_load_indices(points.begin(), points.end());
+	}
+
+	if (indices.number_of_points() != points.size())
+	{
+		throw std::logic_error("Not all indices made it into the tree");
+	}
+
+	for (int query = 0; query < 1000; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(30));
+
+		std::vector<PointIterator> expected;
+		std::vector<PointIterator> result;
+
+		iterators.query_range(window, std::back_inserter(expected));
+		indices.query_range(window, points.begin(), std::back_inserter(result));
+
+		std::sort(expected.begin(), expected.end());
+		std::sort(result.begin(), result.end());
+
+		if (result != expected)
+		{
+			throw std::logic_error("Index tree disagrees with iterator tree");
+		}
+	}
+
+	std::vector<Point> moved(points);
+
+	std::vector<bool> present(moved.size(), true);
+
+	for (size_t index = 0; index < moved.size(); index += 3)
+	{
+		Point p;
+
+		p[0] = random_coordinate(100);
+		p[1] = random_coordinate(100);
+
+		if (false == indices.update(index, moved[index], p))
+		{
+			throw std::logic_error("update() by index failed");
+		}
+
+		moved[index] = p;
+	}
+
+	for (size_t index = 1; index < moved.size(); index += 5)
+	{
+		if (false == indices.remove(index, moved[index]))
+		{
+			throw std::logic_error("remove() by index failed");
+		}
+
+		present[index] = false;
+	}
+
+	for (size_t index = 1; index < moved.size(); index += 10)
+	{
+		if (false == indices.add(index, moved[index]))
+		{
+			throw std::logic_error("add() by index failed");
+		}
+
+		present[index] = true;
+	}
+
+	size_t number_of_present = std::count(present.begin(), present.end(), true);
+
+	if (indices.number_of_points() != number_of_present)
+	{
+		throw std::logic_error("Index tree holds the wrong number of points");
+	}
+
+	for (int query = 0; query < 200; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(30));
+
+		std::vector<PointIterator> result;
+
+		indices.query_range(window, moved.begin(), std::back_inserter(result));
+
+		std::vector<PointIterator> expected;
+
+		for (PointIterator it = moved.begin(); it != moved.end(); ++it)
+		{
+			if (true == present[it - moved.begin()] && true == index_tree::point_intersects_boundary(*it, window))
+			{
+				expected.push_back(it);
+			}
+		}
+
+		std::sort(result.begin(), result.end());
+
+		if (result != expected)
+		{
+			throw std::logic_error("Index tree disagrees with brute force");
+		}
+	}
+}
+
+/*
+	Checks the statistics of a tree built by add() against what the tree
+	reports otherwise and the operation counters against the work done
+*/
+void test_statistics(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree tree(boundary);
+
+	::quad_tree::counters() = ::quad_tree::operation_counters();
+
+	tree.add(points.begin(), points.end());
+
+	const ::quad_tree::tree_statistics statistics = tree.statistics();
+
+	std::cout
+		<< "statistics: " << statistics.m_nodes << " nodes, " << statistics.m_leaves << " leaves, "
+		<< statistics.m_overflow_chunks << " overflow chunks, depth " << statistics.m_depth << ", "
+		<< statistics.m_bytes << " bytes, fill factor " << statistics.fill_factor() << std::endl;
+
+	if (statistics.m_points != tree.number_of_points() || statistics.m_depth != depth(*tree.m_root))
+	{
+		throw std::logic_error("Statistics disagree with the tree");
+	}
+
+	if (false == (statistics.fill_factor() > 0) || statistics.fill_factor() > 1)
+	{
+		throw std::logic_error("Fill factor out of range");
+	}
+
+	if ((statistics.m_nodes - 1) % 4 != 0 || statistics.m_leaves != 1 + 3 * (statistics.m_nodes - 1) / 4)
+	{
+		throw std::logic_error("Statistics count the wrong number of leaves");
+	}
+
+	size_t leaves_by_depth = 0;
+	size_t leaves_by_fill = 0;
+	size_t points_by_fill = 0;
+
+	for (size_t d = 0; d < statistics.m_depth_histogram.size(); ++d)
+	{
+		leaves_by_depth += statistics.m_depth_histogram[d];
+	}
+
+	for (size_t fill = 0; fill < statistics.m_fill_histogram.size(); ++fill)
+	{
+		leaves_by_fill += statistics.m_fill_histogram[fill];
+
+		if (fill <= static_cast<size_t>(capacity))
+		{
+			points_by_fill += fill * statistics.m_fill_histogram[fill];
+		}
+	}
+
+	if (leaves_by_depth != statistics.m_leaves || leaves_by_fill != statistics.m_leaves || points_by_fill > statistics.m_points)
+	{
+		throw std::logic_error("Statistics histograms are inconsistent");
+	}
+
+	if (::quad_tree::counters().m_splits != (statistics.m_nodes - 1) / 4)
+	{
+		throw std::logic_error("Counted the wrong number of splits");
+	}
+
+	for (int query = 0; query < 100; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(30));
+
+		::quad_tree::counters() = ::quad_tree::operation_counters();
+
+		std::vector<PointIterator> result;
+
+		tree.query_range(window, std::back_inserter(result));
+
+		const ::quad_tree::operation_counters &counted = ::quad_tree::counters();
+
+		if (counted.m_nodes_visited < 1 || counted.m_nodes_visited > statistics.m_nodes)
+		{
+			throw std::logic_error("Counted the wrong number of visited nodes");
+		}
+
+		if (counted.m_points_tested > statistics.m_points)
+		{
+			throw std::logic_error("Counted the wrong number of tested points");
+		}
+	}
+}
+
+/*
+	Collects the pairs reported by visit_overlapping_pairs() as sorted
+	pairs of indices
+*/
+template<class BoxIterator>
+struct pair_collector
+{
+	BoxIterator m_begin;
+
+	std::vector<std::pair<size_t, size_t> > m_pairs;
+
+	pair_collector(BoxIterator begin)
+	:
+		m_begin(begin)
+	{
+
+	}
+
+	inline void operator()(BoxIterator a, BoxIterator b)
+	{
+		const size_t first = a - m_begin;
+		const size_t second = b - m_begin;
+
+		m_pairs.push_back(std::make_pair(std::min(first, second), std::max(first, second)));
+	}
+};
+
+/*
+	Indexes boxes of very different sizes and checks overlap queries and
+	overlapping pairs against brute force, before and after moving and
+	removing some of the boxes
+*/
+void test_box_quad_tree()
+{
+	typedef std::pair<Point, Point> Box;
+
+	typedef std::vector<Box>::iterator BoxIterator;
+
+	typedef quad_tree::box_quad_tree<Point, BoxIterator, capacity> box_quad_tree;
+
+	std::vector<Box> boxes;
+
+	for (size_t index = 0; index < 3000; ++index)
+	{
+		/*
+			Mostly small boxes with the odd large one
+		*/
+		const float size = (index % 100 == 0) ? random_coordinate(30) : random_coordinate(2);
+
+		Box box;
+
+		for (int dimension = 0; dimension < 2; ++dimension)
+		{
+			box.first[dimension] = random_coordinate(100 - size);
+			box.second[dimension] = box.first[dimension] + random_coordinate(size);
+		}
+
+		boxes.push_back(box);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	box_quad_tree tree(boundary, boxes.begin(), boxes.end());
+
+	std::vector<bool> present(boxes.size(), true);
+
+	for (int round = 0; round < 2; ++round)
+	{
+		size_t number_of_present = std::count(present.begin(), present.end(), true);
+
+		if (tree.number_of_boxes() != number_of_present)
+		{
+			throw std::logic_error("Box tree holds the wrong number of boxes");
+		}
+
+		for (int query = 0; query < 500; ++query)
+		{
+			const Box window = random_window(random_coordinate(20));
+
+			std::vector<BoxIterator> result;
+
+			tree.query_overlapping(window, std::back_inserter(result));
+
+			std::vector<BoxIterator> expected;
+
+			for (BoxIterator it = boxes.begin(); it != boxes.end(); ++it)
+			{
+				if (true == present[it - boxes.begin()] && true == box_quad_tree::boxes_overlap(*it, window))
+				{
+					expected.push_back(it);
+				}
+			}
+
+			std::sort(result.begin(), result.end());
+
+			if (result != expected)
+			{
+				throw std::logic_error("Box tree disagrees with brute force");
+			}
+		}
+
+		pair_collector<BoxIterator> collector(boxes.begin());
+
+		{
+			boost::timer::auto_cpu_timer t("overlapping pairs (box tree): %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+			tree.visit_overlapping_pairs(collector);
+		}
+
+		std::vector<std::pair<size_t, size_t> > expected;
+
+		{
+			boost::timer::auto_cpu_timer t("overlapping pairs (brute force): %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+			for (size_t first = 0; first < boxes.size(); ++first)
+			{
+				for (size_t second = first + 1; second < boxes.size(); ++second)
+				{
+					if (true == present[first] && true == present[second] && true == box_quad_tree::boxes_overlap(boxes[first], boxes[second]))
+					{
+						expected.push_back(std::make_pair(first, second));
+					}
+				}
+			}
+		}
+
+		std::sort(collector.m_pairs.begin(), collector.m_pairs.end());
+
+		if (collector.m_pairs != expected)
+		{
+			throw std::logic_error("Overlapping pairs disagree with brute force");
+		}
+
+		for (size_t index = round; index < boxes.size(); index += 3)
+		{
+			if (false == present[index])
+			{
+				continue;
+			}
+
+			Box box = boxes[index];
+
+			const float shift = random_coordinate(10) - 5;
+
+			if (box.first[0] + shift >= 0 && box.second[0] + shift <= 100)
+			{
+				box.first[0] += shift;
+				box.second[0] += shift;
+			}
+
+			if (false == tree.update(boxes.begin() + index, box))
+			{
+				throw std::logic_error("update() failed");
+			}
+
+			boxes[index] = box;
+		}
+
+		for (size_t index = round; index < boxes.size(); index += 4)
+		{
+			if (true == present[index] && false == tree.remove(boxes.begin() + index))
+			{
+				throw std::logic_error("remove() failed");
+			}
+
+			present[index] = false;
+		}
+	}
+
+	for (size_t index = 0; index < boxes.size(); ++index)
+	{
+		if (true == present[index] && false == tree.remove(boxes.begin() + index))
+		{
+			throw std::logic_error("remove() failed");
+		}
+	}
+
+	if (0 != tree.number_of_boxes() || true == tree.m_root->has_children())
+	{
+		throw std::logic_error("Empty box tree did not collapse");
+	}
+}
+
+/*
+	Streams points from a file into mapped trees, once within the memory
+	budget and once spilling partitions, and checks both against brute
+	force
+*/
+void test_streaming_build(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	typedef ::quad_tree::mapped_quad_tree<quad_tree> mapped_quad_tree;
+
+	typedef ::quad_tree::streaming_builder<quad_tree> streaming_builder;
+
+	char points_filename[] = "/tmp/test_quad_tree_points.XXXXXX";
+	char spilled_filename[] = "/tmp/test_quad_tree_spilled.XXXXXX";
+	char in_memory_filename[] = "/tmp/test_quad_tree_in_memory.XXXXXX";
+
+	char *filenames[] = { points_filename, spilled_filename, in_memory_filename };
+
+	for (int file = 0; file < 3; ++file)
+	{
+		const int descriptor = mkstemp(filenames[file]);
+
+		if (-1 == descriptor)
+		{
+			throw std::runtime_error("Could not create a temporary file");
+		}
+
+		close(descriptor);
+	}
+
+	{
+		std::ofstream o(points_filename, std::ios::binary);
+
+		o.write(reinterpret_cast<const char*>(&points[0]), points.size() * sizeof(Point));
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	/*
+		About a tenth of the points at a time
+	*/
+	::quad_tree::streaming_options options(points.size() / 10 * streaming_builder::bytes_per_point);
+
+	options.m_chunk_size = 4096;
+
+	{
+		boost::timer::auto_cpu_timer t("streaming build (spilling): %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		::quad_tree::build_mapped<quad_tree>(points_filename, boundary, spilled_filename, options);
+	}
+
+	::quad_tree::build_mapped<quad_tree>(points_filename, boundary, in_memory_filename);
+
+	const ::quad_tree::mapped_file spilled_file(spilled_filename);
+	const ::quad_tree::mapped_file in_memory_file(in_memory_filename);
+
+	const mapped_quad_tree spilled(spilled_file);
+	const mapped_quad_tree in_memory(in_memory_file);
+
+	for (int file = 0; file < 3; ++file)
+	{
+		unlink(filenames[file]);
+	}
+
+	if (spilled.number_of_points() != points.size() || in_memory.number_of_points() != points.size())
+	{
+		throw std::logic_error("Not all points made it into the streamed trees");
+	}
+
+	for (int query = 0; query < 500; ++query)
+	{
+		const std::pair<Point, Point> window = random_window(random_coordinate(30));
+
+		std::vector<uint32_t> spilled_result;
+		std::vector<uint32_t> in_memory_result;
+
+		spilled.query_range(window, std::back_inserter(spilled_result));
+		in_memory.query_range(window, std::back_inserter(in_memory_result));
+
+		std::vector<uint32_t> expected;
+
+		for (size_t index = 0; index < points.size(); ++index)
+		{
+			if (true == quad_tree::point_intersects_boundary(points[index], window))
+			{
+				expected.push_back(static_cast<uint32_t>(index));
+			}
+		}
+
+		std::sort(spilled_result.begin(), spilled_result.end());
+		std::sort(in_memory_result.begin(), in_memory_result.end());
+
+		if (spilled_result != expected || in_memory_result != expected)
+		{
+			throw std::logic_error("Streamed tree disagrees with brute force");
+		}
+	}
+}
+
+/*
+	Points converging on a corner make the tree as deep as the split
+	limits allow. Adding, refining, querying, printing and removing walk
+	it without recursing.
+*/
+void test_deep_tree()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+	typedef ::quad_tree::linear_quad_tree<quad_tree> linear_quad_tree;
+	typedef ::quad_tree::concurrent_point_quad_tree<Point, PointIterator, capacity> concurrent_tree;
+
+	std::vector<Point> points;
+
+	for (int level = 0; level < 2 * ::quad_tree::maximum_depth_limit; ++level)
+	{
+		Point p;
+
+		p[0] = p[1] = std::ldexp(100.0f, -level);
+
+		points.push_back(p);
+	}
+
+	for (int index = 0; index < 2 * capacity; ++index)
+	{
+		Point p = {{ 0, 0 }};
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	const std::vector<bool> present(points.size(), true);
+
+	quad_tree eager_tree(boundary);
+
+	quad_tree lazy_tree(boundary);
+
+	lazy_tree.set_lazy_splitting(true);
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		eager_tree.add(it);
+		lazy_tree.add(it);
+	}
+
+	lazy_tree.refine();
+
+	concurrent_tree concurrent(boundary);
+
+	concurrent.add(points.begin(), points.end());
+
+	if
+	(
+		::quad_tree::maximum_depth_limit != eager_tree.statistics().m_depth ||
+		::quad_tree::maximum_depth_limit != lazy_tree.statistics().m_depth
+	)
+	{
+		throw std::logic_error("Converging points did not reach the depth limit");
+	}
+
+	check_against_brute_force(eager_tree, points.begin(), points.end(), present, 50);
+	check_against_brute_force(lazy_tree, points.begin(), points.end(), present, 50);
+
+	const linear_quad_tree linear = ::quad_tree::freeze(eager_tree);
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int level = 0; level < 2 * ::quad_tree::maximum_depth_limit; ++level)
+	{
+		std::pair<Point, Point> window = boundary;
+
+		window.second[0] = window.second[1] = std::ldexp(100.0f, -level);
+
+		windows.push_back(window);
+
+		std::vector<PointIterator> result;
+		std::vector<PointIterator> linear_result;
+		std::vector<PointIterator> concurrent_result;
+
+		eager_tree.query_range(window, std::back_inserter(result));
+		linear.query_range(window, std::back_inserter(linear_result));
+		concurrent.query_range(window, std::back_inserter(concurrent_result));
+
+		const size_t expected = points.size() - level;
+
+		if (result.size() != expected || linear_result.size() != expected || concurrent_result.size() != expected)
+		{
+			throw std::logic_error("Corner window missed points of the deep tree");
+		}
+	}
+
+	quad_tree::batch_scratch scratch;
+
+	std::vector<size_t> offsets;
+
+	std::vector<PointIterator> results;
+
+	lazy_tree.query_ranges(&windows[0], windows.size(), offsets, results, scratch);
+
+	for (size_t level = 0; level < windows.size(); ++level)
+	{
+		if (offsets[level + 1] - offsets[level] != points.size() - level)
+		{
+			throw std::logic_error("Batch query missed points of the deep tree");
+		}
+	}
+
+	std::ostringstream printed;
+
+	printed << eager_tree;
+
+	const std::string text = printed.str();
+
+	if (static_cast<size_t>(std::count(text.begin(), text.end(), '\n')) != eager_tree.statistics().m_nodes)
+	{
+		throw std::logic_error("operator<< skipped nodes of the deep tree");
+	}
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		if (false == eager_tree.remove(it))
+		{
+			throw std::logic_error("remove() failed on the deep tree");
+		}
+	}
+
+	if (0 != eager_tree.number_of_points() || true == eager_tree.m_root->has_children())
+	{
+		throw std::logic_error("Empty deep tree did not collapse");
+	}
+}
+
+/*
+	Compares count_in() with the number of points query_range() reports
+	on trees built by bulk_load(), by add() and lazily, and times both
+	on large windows
+*/
+void test_count_in(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree bulk_tree(boundary, points.begin(), points.end());
+
+	quad_tree lazy_tree(boundary);
+
+	lazy_tree.set_lazy_splitting(true);
+
+	lazy_tree.add(points.begin(), points.end());
+
+	check_subtree_points(*bulk_tree.m_root);
+	check_subtree_points(*lazy_tree.m_root);
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < 200; ++query)
+	{
+		windows.push_back(random_window(random_coordinate(100)));
+	}
+
+	for (size_t query = 0; query < windows.size(); ++query)
+	{
+		size_t expected = 0;
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			expected += quad_tree::point_intersects_boundary(*it, windows[query]);
+		}
+
+		if (bulk_tree.count_in(windows[query]) != expected || lazy_tree.count_in(windows[query]) != expected)
+		{
+			throw std::logic_error("count_in() disagrees with brute force");
+		}
+	}
+
+	if (0 == lazy_tree.statistics().m_dirty_leaves)
+	{
+		throw std::logic_error("count_in() refined dirty leaves");
+	}
+
+	size_t counted = 0;
+	size_t reported = 0;
+
+	{
+		boost::timer::auto_cpu_timer timer("count_in(): %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		for (size_t query = 0; query < windows.size(); ++query)
+		{
+			counted += bulk_tree.count_in(windows[query]);
+		}
+	}
+
+	{
+		boost::timer::auto_cpu_timer timer("query_range() for counting: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		for (size_t query = 0; query < windows.size(); ++query)
+		{
+			std::vector<PointIterator> result;
+
+			bulk_tree.query_range(windows[query], std::back_inserter(result));
+
+			reported += result.size();
+		}
+	}
+
+	if (counted != reported)
+	{
+		throw std::logic_error("count_in() disagrees with query_range()");
+	}
+}
+
+/*
+	Checks that the children of every interior node below n meet at its
+	center and that the center lies within n
+*/
+template<class QuadTree>
+void check_centers(const typename QuadTree::node &n)
+{
+	if (false == n.has_children())
+	{
+		return;
+	}
+
+	if
+	(
+		false == QuadTree::point_intersects_boundary(n.m_center, n.m_boundary) ||
+		n.m_north_west->m_boundary.second[0] != n.m_center[0] ||
+		n.m_north_west->m_boundary.second[1] != n.m_center[1] ||
+		n.m_south_east->m_boundary.first[0] != n.m_center[0] ||
+		n.m_south_east->m_boundary.first[1] != n.m_center[1]
+	)
+	{
+		throw std::logic_error("Children do not meet at the center of their parent");
+	}
+
+	check_centers<QuadTree>(*n.m_north_west);
+	check_centers<QuadTree>(*n.m_north_east);
+	check_centers<QuadTree>(*n.m_south_west);
+	check_centers<QuadTree>(*n.m_south_east);
+}
+
+/*
+	Builds trees of clustered points with every split policy by add(),
+	lazily and by bulk_load(), checks them against brute force before and
+	after moving and removing points and reports how deep they get
+*/
+void test_split_policies()
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	std::vector<Point> points;
+
+	for (size_t index = 0; index < 20000; ++index)
+	{
+		Point p;
+
+		if (0 == index % 10)
+		{
+			p[0] = random_coordinate(100);
+			p[1] = random_coordinate(100);
+		}
+		else
+		{
+			p[0] = 10 + 70 * (index % 3) / 2 + random_coordinate(0.1f);
+			p[1] = 10 + 35 * (index % 5) / 2 + random_coordinate(0.1f);
+		}
+
+		points.push_back(p);
+	}
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	const ::quad_tree::split_policy policies[] = { ::quad_tree::midpoint_split, ::quad_tree::median_split, ::quad_tree::mean_split };
+
+	const char *names[] = { "midpoint", "median", "mean" };
+
+	for (int policy = 0; policy < 3; ++policy)
+	{
+		const ::quad_tree::split_limits limits(::quad_tree::maximum_depth_limit, 0, policies[policy]);
+
+		quad_tree added_tree(boundary, limits);
+
+		added_tree.add(points.begin(), points.end());
+
+		quad_tree lazy_tree(boundary, limits);
+
+		lazy_tree.set_lazy_splitting(true);
+
+		lazy_tree.add(points.begin(), points.end());
+
+		lazy_tree.refine();
+
+		quad_tree bulk_tree(boundary, points.begin(), points.end(), 1, limits);
+
+		quad_tree parallel_tree(boundary, points.begin(), points.end(), 4, limits);
+
+		std::vector<bool> present(points.size(), true);
+
+		quad_tree *trees[] = { &added_tree, &lazy_tree, &bulk_tree, &parallel_tree };
+
+		for (int tree = 0; tree < 4; ++tree)
+		{
+			check_against_brute_force(*trees[tree], points.begin(), points.end(), present, 100);
+
+			check_subtree_points(*trees[tree]->m_root);
+
+			check_centers<quad_tree>(*trees[tree]->m_root);
+		}
+
+		const ::quad_tree::tree_statistics statistics = added_tree.statistics();
+
+		std::cout << "split policy " << names[policy] << ": depth " << statistics.m_depth << ", " << statistics.m_nodes << " nodes" << std::endl;
+
+		for (size_t index = 0; index < points.size(); index += 3)
+		{
+			Point p;
+
+			p[0] = random_coordinate(100);
+			p[1] = random_coordinate(100);
+
+			if (false == added_tree.update(points.begin() + index, p))
+			{
+				throw std::logic_error("update() failed");
+			}
+
+			points[index] = p;
+		}
+
+		for (size_t index = 1; index < points.size(); index += 3)
+		{
+			if (false == added_tree.remove(points.begin() + index))
+			{
+				throw std::logic_error("remove() failed");
+			}
+
+			present[index] = false;
+		}
+
+		check_against_brute_force(added_tree, points.begin(), points.end(), present, 100);
+
+		check_subtree_points(*added_tree.m_root);
+
+		check_centers<quad_tree>(*added_tree.m_root);
+
+		if (::quad_tree::midpoint_split != policies[policy])
+		{
+			try
+			{
+				::quad_tree::freeze(bulk_tree);
+
+				throw std::logic_error("Adaptively split tree was frozen");
+			}
+			catch (std::runtime_error &)
+			{
+
+			}
+		}
+	}
+}
+
+/*
+	Compares a tree with a runtime capacity against one with the same
+	capacity at compile time, checks a tree with a smaller capacity at its
+	bottom levels against brute force and tunes the capacity
+*/
+void test_capacities(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, 4> small_tree;
+	typedef quad_tree::point_quad_tree<Point, PointIterator, 16> large_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	::quad_tree::split_limits limits;
+
+	limits.m_capacity = 4;
+
+	{
+		small_tree compiled(boundary);
+		large_tree configured(boundary, limits);
+
+		compiled.add(points.begin(), points.end());
+		configured.add(points.begin(), points.end());
+
+		small_tree compiled_bulk(boundary, points.begin(), points.end());
+		large_tree configured_bulk(boundary, points.begin(), points.end(), 1, limits);
+
+		const ::quad_tree::tree_statistics statistics[] = { compiled.statistics(), configured.statistics(), compiled_bulk.statistics(), configured_bulk.statistics() };
+
+		for (int tree = 0; tree < 4; tree += 2)
+		{
+			if
+			(
+				statistics[tree].m_nodes != statistics[tree + 1].m_nodes ||
+				statistics[tree].m_leaves != statistics[tree + 1].m_leaves ||
+				statistics[tree].m_depth_histogram != statistics[tree + 1].m_depth_histogram
+			)
+			{
+				throw std::logic_error("Runtime capacity shapes the tree differently");
+			}
+		}
+	}
+
+	std::vector<Point> clustered;
+
+	for (size_t index = 0; index < 20000; ++index)
+	{
+		Point p;
+
+		p[0] = 50 + random_coordinate(5) * random_coordinate(5);
+		p[1] = 50 + random_coordinate(5) * random_coordinate(5);
+
+		clustered.push_back(p);
+	}
+
+	limits.m_capacity = 16;
+	limits.m_bottom_capacity = 2;
+	limits.m_bottom_depth = 4;
+
+	large_tree tree(boundary, limits);
+
+	tree.add(clustered.begin(), clustered.end());
+
+	large_tree bulk_tree(boundary, clustered.begin(), clustered.end(), 1, limits);
+
+	std::vector<bool> present(clustered.size(), true);
+
+	check_against_brute_force(tree, clustered.begin(), clustered.end(), present, 100);
+	check_against_brute_force(bulk_tree, clustered.begin(), clustered.end(), present, 100);
+
+	check_leaf_capacities(tree, *tree.m_root);
+	check_leaf_capacities(bulk_tree, *bulk_tree.m_root);
+
+	for (size_t index = 0; index < clustered.size(); index += 2)
+	{
+		if (false == tree.remove(clustered.begin() + index))
+		{
+			throw std::logic_error("remove() failed");
+		}
+
+		present[index] = false;
+	}
+
+	check_against_brute_force(tree, clustered.begin(), clustered.end(), present, 100);
+
+	check_subtree_points(*tree.m_root);
+
+	for (size_t index = 1; index < clustered.size(); index += 2)
+	{
+		tree.remove(clustered.begin() + index);
+	}
+
+	if (0 != tree.number_of_points() || true == tree.m_root->has_children())
+	{
+		throw std::logic_error("Empty tree did not collapse");
+	}
+
+	try
+	{
+		::quad_tree::split_limits too_large;
+
+		too_large.m_capacity = 17;
+
+		large_tree invalid(boundary, too_large);
+
+		throw std::logic_error("Capacity beyond NodeCapacity was accepted");
+	}
+	catch (std::runtime_error &)
+	{
+
+	}
+
+	const ::quad_tree::capacity_tuning tuning = ::quad_tree::tune_capacity<large_tree>(boundary, points.begin(), points.end(), ::quad_tree::tuning_options(20000, 500));
+
+	if (0 == tuning.m_sample_size || tuning.m_sample_size > 20000)
+	{
+		throw std::logic_error("tune_capacity() sampled more points than asked for");
+	}
+
+	const ::quad_tree::capacity_tuning quick = ::quad_tree::tune_capacity<large_tree>(boundary, points.begin(), points.end(), ::quad_tree::tuning_options(points.size() - 1, 50));
+
+	if (quick.m_sample_size > points.size() - 1)
+	{
+		throw std::logic_error("tune_capacity() sampled more points than asked for");
+	}
+
+	if (5 != tuning.m_capacities.size() || tuning.m_capacities.end() == std::find(tuning.m_capacities.begin(), tuning.m_capacities.end(), tuning.m_capacity))
+	{
+		throw std::logic_error("tune_capacity() picked an untried capacity");
+	}
+
+	std::cout << "tuned capacity: " << tuning.m_capacity << " (";
+
+	for (size_t index = 0; index < tuning.m_capacities.size(); ++index)
+	{
+		std::cout << (0 == index ? "" : ", ") << tuning.m_capacities[index] << ": " << tuning.m_nanoseconds_per_query[index] << "ns";
+	}
+
+	std::cout << ")" << std::endl;
+}
+
+/*
+	Compares queries split into tasks on a pool of threads against the
+	sequential ones, also with a grain small enough to split every query,
+	and times a query of the whole boundary both ways.
+*/
+void test_parallel_queries(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	typedef ::quad_tree::parallel_queries<quad_tree> parallel_queries;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	quad_tree tree(boundary, points.begin(), points.end());
+
+	/*
+		No threshold and a small grain, so every query is split into tasks
+	*/
+	parallel_queries eager(4, 0, 64);
+
+	parallel_queries cautious(4);
+
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < 100; ++query)
+	{
+		windows.push_back(random_window(random_coordinate(100)));
+	}
+
+	windows.push_back(boundary);
+
+	for (size_t query = 0; query < windows.size(); ++query)
+	{
+		std::vector<PointIterator> expected;
+
+		tree.query_range(windows[query], std::back_inserter(expected));
+
+		std::vector<PointIterator> found;
+
+		eager.query_range(tree, windows[query], std::back_inserter(found));
+
+		std::vector<PointIterator> small;
+
+		cautious.query_range(tree, windows[query], std::back_inserter(small));
+
+		std::sort(expected.begin(), expected.end());
+		std::sort(found.begin(), found.end());
+		std::sort(small.begin(), small.end());
+
+		if (found != expected || small != expected)
+		{
+			throw std::logic_error("parallel query_range() disagrees with query_range()");
+		}
+	}
+
+	if (parallel_queries::estimate(tree, boundary, points.size()) != points.size())
+	{
+		throw std::logic_error("the estimate of the whole boundary is not the number of points");
+	}
+
+	std::vector<size_t> offsets;
+	std::vector<PointIterator> results;
+
+	quad_tree::batch_scratch scratch;
+
+	tree.query_ranges(&windows[0], windows.size(), offsets, results, scratch);
+
+	std::vector<size_t> parallel_offsets;
+	std::vector<PointIterator> parallel_results;
+
+	eager.query_ranges(tree, &windows[0], windows.size(), parallel_offsets, parallel_results);
+
+	if (parallel_offsets != offsets || parallel_results != results)
+	{
+		throw std::logic_error("parallel query_ranges() disagrees with query_ranges()");
+	}
+
+	cautious.query_ranges(tree, &windows[0], 0, parallel_offsets, parallel_results);
+
+	if (1 != parallel_offsets.size() || false == parallel_results.empty())
+	{
+		throw std::logic_error("an empty parallel batch reported results");
+	}
+
+	size_t sequential = 0;
+	size_t parallel = 0;
+
+	{
+		boost::timer::auto_cpu_timer timer("query_range() of the whole boundary: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		for (int repetition = 0; repetition < 10; ++repetition)
+		{
+			std::vector<PointIterator> found;
+
+			tree.query_range(boundary, std::back_inserter(found));
+
+			sequential += found.size();
+		}
+	}
+
+	{
+		boost::timer::auto_cpu_timer timer("parallel query_range() of the whole boundary: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		for (int repetition = 0; repetition < 10; ++repetition)
+		{
+			std::vector<PointIterator> found;
+
+			eager.query_range(tree, boundary, std::back_inserter(found));
+
+			parallel += found.size();
+		}
+	}
+
+	if (sequential != parallel)
+	{
+		throw std::logic_error("parallel query_range() lost points");
+	}
+}
+
+/*
+	Returns the iterators of all points of tree within window, sorted
+*/
+template<class QuadTree>
+std::vector<PointIterator> sorted_query(const QuadTree &tree, const std::pair<Point, Point> &window)
+{
+	std::vector<PointIterator> result;
+
+	tree.query_range(window, std::back_inserter(result));
+
+	std::sort(result.begin(), result.end());
+
+	return result;
+}
+
+/*
+	Merges trees built from the quadrants of the boundary, from
+	interleaved halves of the points and with different limits and
+	compares the results against a tree of all points. Then moves the
+	merged tree around and times merging shards against adding all
+	points to one tree.
+*/
+void test_merge_and_move(std::vector<Point> &points)
+{
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
 
-#include <boost/array.hpp>
-#include <vector>
-#include <iostream>
+	std::pair<Point, Point> boundary;
 
-#include <unistd.h>
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
 
-#include <boost/timer/timer.hpp>
+	quad_tree all(boundary, points.begin(), points.end());
 
-int main()
+	std::vector<std::pair<Point, Point> > windows;
+
+	for (int query = 0; query < 100; ++query)
+	{
+		windows.push_back(random_window(random_coordinate(50)));
+	}
+
+	windows.push_back(boundary);
+
+	/*
+		The shards line up with the tree they are merged into, so they
+		are grafted
+	*/
+	quad_tree sharded(boundary);
+
+	for (int shard = 0; shard < 4; ++shard)
+	{
+		quad_tree part(boundary);
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (shard == ((*it)[0] < 50) + 2 * ((*it)[1] < 50))
+			{
+				part.add(it);
+			}
+		}
+
+		const size_t number_of_nodes = sharded.statistics().m_nodes + part.statistics().m_nodes;
+
+		sharded.merge(part);
+
+		if (0 != part.number_of_points() || 1 != part.statistics().m_nodes)
+		{
+			throw std::logic_error("merge() left points in the merged tree");
+		}
+
+		if (sharded.statistics().m_nodes > number_of_nodes)
+		{
+			throw std::logic_error("merge() created more nodes than it took over");
+		}
+
+		part.add(points.begin());
+
+		if (1 != part.number_of_points())
+		{
+			throw std::logic_error("The merged tree can not be used anymore");
+		}
+	}
+
+	/*
+		Interleaved halves overlap everywhere, so most of the points are
+		added one by one
+	*/
+	quad_tree even(boundary);
+	quad_tree odd(boundary);
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		(0 == (it - points.begin()) % 2 ? even : odd).add(it);
+	}
+
+	even.merge(odd);
+
+	/*
+		A tree with other limits is added point by point so the merged
+		tree keeps its limits
+	*/
+	::quad_tree::split_limits limits;
+
+	limits.m_capacity = 4;
+
+	quad_tree small(boundary, limits);
+	quad_tree large(boundary);
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		(0 == (it - points.begin()) % 3 ? large : small).add(it);
+	}
+
+	small.merge(large);
+
+	/*
+		Nodes owning each other are grafted the same way
+	*/
+	typedef ::quad_tree::point_quad_tree<Point, PointIterator, capacity, false, ::quad_tree::shared_ptr_allocation> shared_tree;
+
+	shared_tree first(boundary);
+	shared_tree second(boundary);
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		((*it)[0] < 50 ? first : second).add(it);
+	}
+
+	first.merge(second);
+
+	shared_tree shared(std::move(first));
+
+	check_subtree_points(*shared.m_root);
+	check_subtree_points(*sharded.m_root);
+	check_subtree_points(*even.m_root);
+	check_subtree_points(*small.m_root);
+	check_leaf_capacities(small, *small.m_root);
+	check_centers<quad_tree>(*sharded.m_root);
+
+	for (size_t query = 0; query < windows.size(); ++query)
+	{
+		const std::vector<PointIterator> expected = sorted_query(all, windows[query]);
+
+		if
+		(
+			sorted_query(sharded, windows[query]) != expected ||
+			sorted_query(even, windows[query]) != expected ||
+			sorted_query(shared, windows[query]) != expected ||
+			sorted_query(small, windows[query]) != expected
+		)
+		{
+			throw std::logic_error("Merged tree disagrees with a tree of all points");
+		}
+	}
+
+	bool thrown = false;
+
+	try
+	{
+		sharded.merge(sharded);
+	}
+	catch (std::logic_error &e)
+	{
+		thrown = true;
+	}
+
+	std::pair<Point, Point> other_boundary = boundary;
+
+	other_boundary.second[0] = 200;
+
+	quad_tree other(other_boundary);
+
+	try
+	{
+		sharded.merge(other);
+		thrown = false;
+	}
+	catch (std::runtime_error &e)
+	{
+
+	}
+
+	if (false == thrown || points.size() != sharded.number_of_points())
+	{
+		throw std::logic_error("Merging a tree into itself or one with another boundary did not throw");
+	}
+
+	quad_tree moved(std::move(sharded));
+
+	if (points.size() != moved.number_of_points() || 0 != sharded.number_of_points() || sorted_query(moved, boundary) != sorted_query(all, boundary))
+	{
+		throw std::logic_error("Moving a tree did not hand over its points");
+	}
+
+	sharded = std::move(moved);
+
+	even = std::move(sharded);
+
+	if (points.size() != even.number_of_points() || 0 != moved.number_of_points() || 0 != sharded.number_of_points())
+	{
+		throw std::logic_error("Move assignment did not hand over the points");
+	}
+
+	sharded.add(points.begin(), points.end());
+
+	if (points.size() != sharded.number_of_points())
+	{
+		throw std::logic_error("A moved from tree can not be used anymore");
+	}
+
+	std::vector<quad_tree*> shards;
+
+	for (int shard = 0; shard < 4; ++shard)
+	{
+		shards.push_back(new quad_tree(boundary));
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (shard == ((*it)[0] < 50) + 2 * ((*it)[1] < 50))
+			{
+				shards.back()->add(it);
+			}
+		}
+	}
+
+	{
+		boost::timer::auto_cpu_timer timer("merge() of 4 shards: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		for (int shard = 1; shard < 4; ++shard)
+		{
+			shards[0]->merge(*shards[shard]);
+		}
+	}
+
+	{
+		boost::timer::auto_cpu_timer timer("add() of all points: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		quad_tree added(boundary);
+
+		added.add(points.begin(), points.end());
+	}
+
+	if (points.size() != shards[0]->number_of_points())
+	{
+		throw std::logic_error("Merging the shards lost points");
+	}
+
+	for (int shard = 0; shard < 4; ++shard)
+	{
+		delete shards[shard];
+	}
+}
+
+/*
+	Returns the positions of the points a tree of indices refers to
+*/
+struct indexed_position
+{
+	const std::vector<Point> &m_points;
+
+	indexed_position(const std::vector<Point> &points)
+	:
+		m_points(points)
+	{
+
+	}
+
+	inline const Point &operator()(uint32_t index) const
+	{
+		return m_points[index];
+	}
+};
+
+/*
+	Checks a refitted tree and one of indices against brute force
+*/
+template<class QuadTree, class IndexTree>
+void check_refitted(const QuadTree &tree, const IndexTree &indices, std::vector<Point> &points, const std::vector<bool> &present)
+{
+	check_subtree_points(*tree.m_root);
+	check_subtree_points(*indices.m_root);
+	check_leaf_capacities(tree, *tree.m_root);
+	check_leaf_capacities(indices, *indices.m_root);
+
+	for (int query = 0; query < 50; ++query)
+	{
+		std::pair<Point, Point> window = random_window(random_coordinate(50));
+
+		if (0 == query)
+		{
+			window.first[0] = window.first[1] = 0;
+			window.second[0] = window.second[1] = 100;
+		}
+
+		std::vector<PointIterator> expected;
+
+		for (PointIterator it = points.begin(); it != points.end(); ++it)
+		{
+			if (true == present[it - points.begin()] && true == QuadTree::point_intersects_boundary(*it, window))
+			{
+				expected.push_back(it);
+			}
+		}
+
+		std::vector<PointIterator> result;
+
+		indices.query_range(window, points.begin(), std::back_inserter(result));
+
+		std::sort(result.begin(), result.end());
+
+		if (sorted_query(tree, window) != expected || result != expected)
+		{
+			throw std::logic_error("Refitted tree disagrees with brute force");
+		}
+	}
+}
+
+/*
+	Refits a leaf that cannot split and holds its points in the leaf, a full
+	overflow chunk and a head chunk of one point, moving that one point out
+	of the boundary and the others a little. Erasing it frees the head chunk
+	refit() is scanning, which must then go on with the full chunk.
+*/
+template<class Allocation>
+void test_refit_overflow_chunks()
+{
+	typedef ::quad_tree::point_quad_tree<Point, PointIterator, capacity, false, Allocation> quad_tree;
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	std::vector<Point> points(2 * capacity + 1);
+
+	for (size_t index = 0; index < points.size(); ++index)
+	{
+		points[index][0] = 10 + 5 * index;
+		points[index][1] = 20 + 5 * index;
+	}
+
+	quad_tree tree(boundary, ::quad_tree::split_limits(0));
+
+	tree.add(points.begin(), points.end());
+
+	if (!tree.m_root->m_overflow || 1 != tree.m_root->m_overflow->m_number_of_points || !tree.m_root->m_overflow->m_overflow)
+	{
+		throw std::logic_error("Unexpected overflow chain");
+	}
+
+	std::vector<bool> present(points.size(), true);
+
+	for (size_t index = 0; index < points.size(); ++index)
+	{
+		points[index][0] += 1;
+	}
+
+	points.back()[0] = 150;
+	present.back() = false;
+
+	const ::quad_tree::refit_statistics statistics = tree.refit();
+
+	if
+	(
+		1 != statistics.m_lost ||
+		1 != statistics.m_moved ||
+		1 != statistics.m_shrunk_leaves ||
+		0 != statistics.m_rewritten_leaves ||
+		points.size() - 1 != tree.number_of_points()
+	)
+	{
+		throw std::logic_error("refit() miscounted the points of the overflow chain");
+	}
+
+	check_subtree_points(*tree.m_root);
+
+	for (const typename quad_tree::node *chunk = &*tree.m_root; 0 != chunk; chunk = chunk->next_chunk())
+	{
+		for (int index = 0; index < chunk->m_number_of_points; ++index)
+		{
+			if (chunk->x()[index] != (*chunk->m_points[index])[0] || chunk->y()[index] != (*chunk->m_points[index])[1])
+			{
+				throw std::logic_error("refit() left a stale position in the overflow chain");
+			}
+		}
+	}
+
+	std::vector<PointIterator> expected;
+
+	for (PointIterator it = points.begin(); it != points.end(); ++it)
+	{
+		if (true == present[it - points.begin()])
+		{
+			expected.push_back(it);
+		}
+	}
+
+	if (sorted_query(tree, boundary) != expected)
+	{
+		throw std::logic_error("Refitted overflow chain disagrees with brute force");
+	}
+}
+
+/*
+	Moves points a little at a time, some far and some out of the boundary,
+	and refits a tree of iterators and one of indices to them. Then
+	gathers all points in a corner and spreads them out again so that
+	nodes are split and merged, and times refitting against building a
+	new tree.
+*/
+void test_refit(std::vector<Point> &points)
 {
-	boost::timer::auto_cpu_timer t;
+	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
+
+	typedef ::quad_tree::point_quad_tree<Point, uint32_t, capacity> index_tree;
+
+	test_refit_overflow_chunks< ::quad_tree::arena_allocation<> >();
+	test_refit_overflow_chunks< ::quad_tree::shared_ptr_allocation>();
+
+	std::pair<Point, Point> boundary;
+
+	boundary.first[0] = boundary.first[1] = 0;
+	boundary.second[0] = boundary.second[1] = 100;
+
+	/*
+		Spread out in their grid cells the points are hardly ever
+		coincident, so small steps move few of them out of their leaves
+	*/
+	std::vector<Point> moving(points);
+
+	for (size_t index = 0; index < moving.size(); ++index)
+	{
+		moving[index][0] = std::min<Point::value_type>(100, moving[index][0] + random_coordinate(1));
+		moving[index][1] = std::min<Point::value_type>(100, moving[index][1] + random_coordinate(1));
+	}
+
+	std::vector<bool> present(moving.size(), true);
+
+	quad_tree tree(boundary, moving.begin(), moving.end());
+
+	index_tree indices(boundary);
+
+	indices.bulk_load_indices(moving.begin(), moving.end());
+
+	for (int tick = 0; tick < 4; ++tick)
+	{
+		size_t lost = 0;
+
+		for (size_t index = 0; index < moving.size(); ++index)
+		{
+			Point &p = moving[index];
+
+			if (0 == index % 1000 && true == present[index])
+			{
+				p[0] = 150;
+
+				present[index] = false;
+
+				++lost;
+
+				continue;
+			}
+
+			if (0 == index % 100)
+			{
+				p[0] = random_coordinate(100);
+				p[1] = random_coordinate(100);
+
+				continue;
+			}
+
+			for (int dimension = 0; dimension < 2; ++dimension)
+			{
+				p[dimension] = std::min<Point::value_type>(100, std::max<Point::value_type>(0, p[dimension] + random_coordinate(0.04f) - 0.02f));
+			}
+		}
+
+		const size_t number_of_points = tree.number_of_points();
+
+		const ::quad_tree::refit_statistics statistics = tree.refit();
+
+		const ::quad_tree::refit_statistics index_statistics = indices.refit(indexed_position(moving));
+
+		if
+		(
+			statistics.m_points != number_of_points ||
+			statistics.m_lost != lost ||
+			index_statistics.m_lost != lost ||
+			index_statistics.m_moved != statistics.m_moved ||
+			tree.number_of_points() != number_of_points - lost ||
+			indices.number_of_points() != number_of_points - lost
+		)
+		{
+			throw std::logic_error("refit() miscounted the points");
+		}
+
+		if (statistics.churn() > 0.25 || statistics.m_shrunk_leaves + statistics.m_rewritten_leaves > statistics.m_leaves)
+		{
+			throw std::logic_error("refit() moved too many points");
+		}
+
+		check_refitted(tree, indices, moving, present);
+	}
+
+	/*
+		Gathering the points in a corner splits the nodes there and
+		spreading them out again merges them
+	*/
+	for (int round = 0; round < 2; ++round)
+	{
+		for (size_t index = 0; index < moving.size(); ++index)
+		{
+			if (true == present[index])
+			{
+				moving[index][0] = (0 == round) ? moving[index][0] / 10 : moving[index][0] * 10;
+				moving[index][1] = (0 == round) ? moving[index][1] / 10 : moving[index][1] * 10;
+			}
+		}
+
+		const ::quad_tree::refit_statistics statistics = tree.refit();
+
+		indices.refit(indexed_position(moving));
+
+		if (statistics.churn() < 0.5 || (1 == round && 0 == statistics.m_merged_nodes) || 0 != statistics.m_lost)
+		{
+			throw std::logic_error("refit() did not restructure the tree");
+		}
+
+		check_refitted(tree, indices, moving, present);
+	}
+
+	for (size_t index = 0; index < moving.size(); ++index)
+	{
+		for (int dimension = 0; dimension < 2; ++dimension)
+		{
+			moving[index][dimension] = std::min<Point::value_type>(100, std::max<Point::value_type>(0, moving[index][dimension] + random_coordinate(0.04f) - 0.02f));
+		}
+	}
+
+	std::vector<Point> copy(moving);
+
+	::quad_tree::refit_statistics statistics;
+
+	{
+		boost::timer::auto_cpu_timer timer("refit() after a small step: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		statistics = tree.refit();
+	}
+
+	{
+		boost::timer::auto_cpu_timer timer("building a new tree instead: %ws wall, %us user + %ss system = %ts CPU (%p%)\n");
+
+		quad_tree rebuilt(copy.begin(), copy.end());
+	}
+
+	std::cout << "refit(): " << statistics.m_moved << " of " << statistics.m_points << " points moved, " << statistics.m_shrunk_leaves << " of " << statistics.m_leaves << " leaves lost points, " << statistics.m_rewritten_leaves << " only had positions rewritten" << std::endl;
+}
 
-	typedef boost::array<float, 2> Point;
-	typedef std::vector<Point>::iterator PointIterator;
-	
-	const int capacity = 4;
-	
+int main()
+{
 	std::vector<Point> points;
-	
+
 	for (size_t index = 0; index < 100098; ++index)
 	{
 		Point p;
-		
+
 		p[0] = (int)(100 * (float)rand()/RAND_MAX);
 		p[1] = (int)(100 * (float)rand()/RAND_MAX);
-		
+
 		points.push_back(p);
 	}
-	
+
 	Point p1;
-	
+
 	p1[0] = 0;
 	p1[1] = 0;
-	
+
 	points.push_back(p1);
 
 	Point p2;
-	
+
 	p2[0] = 100;
 	p2[1] = 100;
-	
+
 	points.push_back(p2);
 
 	typedef quad_tree::point_quad_tree<Point, PointIterator, capacity> quad_tree;
-		
+
 	quad_tree tree(points.begin(), points.end());
-	
+
 	std::cout << tree << std::endl;
 
 	std::cout << tree.number_of_points() << std::endl;
+
+	if (tree.number_of_points() != points.size())
+	{
+		throw std::logic_error("Not all points made it into the tree");
+	}
+
+	const size_t arena_points = benchmark_build< ::quad_tree::arena_allocation<> >("arena", points, 5);
+
+	const size_t shared_ptr_points = benchmark_build< ::quad_tree::shared_ptr_allocation>("shared_ptr", points, 5);
+
+	if (arena_points != shared_ptr_points)
+	{
+		throw std::logic_error("Allocation policies disagree");
+	}
+
+	test_unique_points();
+
+	test_range_query(tree, points);
+
+	test_nearest(tree, points);
+
+	test_bulk_load(points);
+
+	test_parallel_build(points);
+
+	test_linear_quad_tree(tree);
+
+	test_batch_query(tree);
+
+	test_simd_filter();
+
+	test_remove_and_update();
+
+	test_duplicates_and_depth_limit();
+
+	test_bulk_loaded_coincident_points();
+
+	test_lazy_splitting();
+
+	test_integer_coordinates();
+
+	test_octree();
+
+	test_snapshots();
+
+	test_concurrent_add(points);
+
+	test_mapped_quad_tree(tree, points);
+
+	test_index_references(points);
+
+	test_statistics(points);
+
+	test_box_quad_tree();
+
+	test_streaming_build(points);
+
+	test_deep_tree();
+
+	test_count_in(points);
+
+	test_split_policies();
+
+	test_capacities(points);
+
+	test_parallel_queries(points);
+
+	test_merge_and_move(points);
+
+	test_refit(points);
 }